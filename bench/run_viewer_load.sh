@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compare the asio and io_uring backends under the same HTTP-FLV viewer load.
+# usage: bench/run_viewer_load.sh [viewers] [seconds] [video_kbps]
+# The server listens on port 80, run it as root. Both backends run in sharded io mode.
+
+VIEWERS=${1:-1000}
+SECONDS_PER_RUN=${2:-20}
+VIDEO_KBPS=${3:-2500}
+
+cd "$(dirname "$0")/.." || exit 1
+make bench || exit 1
+
+for backend in asio uring; do
+    echo "== backend $backend, $VIEWERS viewers, $SECONDS_PER_RUN s, $VIDEO_KBPS kbps"
+    STREAMING_IO_MODE=sharded STREAMING_IO_BACKEND=$backend ./build/server > "build/bench/server_$backend.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+
+    ./build/bench/viewer_load -n "$VIEWERS" -t "$SECONDS_PER_RUN" -b "$VIDEO_KBPS" -s "bench_$backend" -P "$SERVER_PID"
+
+    kill "$SERVER_PID"
+    wait "$SERVER_PID" 2>/dev/null
+done
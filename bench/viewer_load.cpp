@@ -0,0 +1,487 @@
+/**
+HTTP-FLV viewer load generator.
+
+Opens N viewers on one stream, optionally publishes a synthetic RTMP stream first, and reports the received throughput
+together with the CPU time the server spent during the measurement window (read from /proc/<pid>/stat).
+Run it against each io backend with the same arguments to compare them, see bench/run_viewer_load.sh.
+
+usage: viewer_load [-h host] [-r rtmp_port] [-p http_port] [-n viewers] [-t seconds] [-s stream] [-b video_kbps] [-P server_pid] [-x]
+    -x: do not publish, watch a stream published by someone else
+*/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct options
+{
+    std::string host{"127.0.0.1"};
+    uint16_t rtmp_port{1935};
+    uint16_t http_port{80};
+    size_t viewers{100};
+    uint32_t seconds{10};
+    std::string stream{"bench"};
+    uint32_t video_kbps{2500};
+    int server_pid{0};
+    bool is_publishing{true};
+};
+
+using clock_type = std::chrono::steady_clock;
+
+int connect_to(const std::string &host, uint16_t port, bool is_nonblocking)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM | (is_nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error("socket() failed");
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+    {
+        ::close(fd);
+        throw std::runtime_error("invalid host " + host);
+    }
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        ::close(fd);
+        throw std::runtime_error("cannot connect to " + host + ":" + std::to_string(port));
+    }
+    return fd;
+}
+
+void send_all(int fd, const std::string &data)
+{
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        auto n = ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            throw std::runtime_error("publisher connection closed");
+        }
+        offset += static_cast<size_t>(n);
+    }
+}
+
+void recv_exact(int fd, size_t size)
+{
+    char buf[4096];
+    while (size)
+    {
+        auto n = ::recv(fd, buf, std::min(size, sizeof(buf)), 0);
+        if (n <= 0)
+        {
+            throw std::runtime_error("publisher connection closed during handshake");
+        }
+        size -= static_cast<size_t>(n);
+    }
+}
+
+// amf0 and rtmp chunk serialization, just enough to publish
+void put_be(std::string &out, uint64_t value, size_t bytes)
+{
+    for (size_t i = bytes; i > 0; --i)
+    {
+        out.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+    }
+}
+
+std::string amf_string(const std::string &value)
+{
+    std::string out(1, '\x02');
+    put_be(out, value.size(), 2);
+    return out + value;
+}
+
+std::string amf_number(double value)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::string out(1, '\x00');
+    put_be(out, bits, 8);
+    return out;
+}
+
+std::string amf_object(const std::vector<std::pair<std::string, std::string>> &props)
+{
+    std::string out(1, '\x03');
+    for (auto &[key, value] : props)
+    {
+        put_be(out, key.size(), 2);
+        out += key + value;
+    }
+    return out + std::string("\x00\x00\x09", 3);
+}
+
+std::string amf_ecma_array(const std::vector<std::pair<std::string, std::string>> &props)
+{
+    std::string out(1, '\x08');
+    put_be(out, props.size(), 4);
+    return out + amf_object(props).substr(1);
+}
+
+constexpr size_t kChunkSize = 4096;
+
+std::string rtmp_message(uint8_t csid, uint32_t time_stamp, uint8_t type, uint32_t stream_id, const std::string &payload)
+{
+    std::string out(1, static_cast<char>(csid & 0x3f));
+    put_be(out, time_stamp, 3);
+    put_be(out, payload.size(), 3);
+    out.push_back(static_cast<char>(type));
+    for (size_t i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<char>((stream_id >> (i * 8)) & 0xff));
+    }
+
+    for (size_t offset = 0; offset < payload.size(); offset += kChunkSize)
+    {
+        if (offset)
+        {
+            out.push_back(static_cast<char>(0xc0 | csid));
+        }
+        out.append(payload, offset, kChunkSize);
+    }
+    return out;
+}
+
+/// publish a 25 fps h264 + aac stream made of random payloads until stop is set
+void publish(const options &opts, const std::atomic_bool &stop, std::atomic_bool &ready)
+{
+    int fd = connect_to(opts.host, opts.rtmp_port, false);
+
+    std::mt19937 rng{42};
+    std::string c1(1536, '\0');
+    for (auto &c : c1)
+    {
+        c = static_cast<char>(rng());
+    }
+    send_all(fd, std::string(1, '\x03') + c1);
+
+    // s0 s1 s2, then echo s1 as c2
+    std::string s0s1(1 + 1536, '\0');
+    size_t got = 0;
+    while (got < s0s1.size())
+    {
+        auto n = ::recv(fd, s0s1.data() + got, s0s1.size() - got, 0);
+        if (n <= 0)
+        {
+            throw std::runtime_error("publisher connection closed during handshake");
+        }
+        got += static_cast<size_t>(n);
+    }
+    recv_exact(fd, 1536);
+    send_all(fd, s0s1.substr(1));
+
+    std::string chunk_size;
+    put_be(chunk_size, kChunkSize, 4);
+    send_all(fd, rtmp_message(2, 0, 1, 0, chunk_size));
+
+    auto tc_url = "rtmp://" + opts.host + "/live";
+    send_all(fd, rtmp_message(3, 0, 20, 0,
+                     amf_string("connect") + amf_number(1) + amf_object({{"app", amf_string("live")}, {"tcUrl", amf_string(tc_url)}})));
+    send_all(fd, rtmp_message(3, 0, 20, 0, amf_string("createStream") + amf_number(2) + std::string(1, '\x05')));
+    send_all(fd, rtmp_message(4, 0, 20, 1,
+                     amf_string("publish") + amf_number(3) + std::string(1, '\x05') + amf_string(opts.stream + "?vhost=bench&token=bench") +
+                         amf_string("live")));
+
+    // the server sets up its tracks from the metadata
+    auto metadata = amf_ecma_array({{"duration", amf_number(0)}, {"width", amf_number(1280)}, {"height", amf_number(720)}, {"videocodecid", amf_number(7)},
+        {"videodatarate", amf_number(opts.video_kbps)}, {"framerate", amf_number(25)}, {"audiocodecid", amf_number(10)},
+        {"audiodatarate", amf_number(160)}, {"audiosamplerate", amf_number(48000)}, {"audiosamplesize", amf_number(16)},
+        {"stereo", std::string("\x01\x01", 2)}});
+    send_all(fd, rtmp_message(4, 0, 18, 1, amf_string("@setDataFrame") + amf_string("onMetaData") + metadata));
+
+    // avc sequence header and aac specific config
+    const std::string sps_bytes("\x67\x64\x00\x1f\xac\xd9\x40\x50\x05\xbb\x01\x10\x00\x00\x03\x00\x10\x00\x00\x03\x03\x20\xf1\x83\x19\x60", 26);
+    const std::string pps("\x68\xeb\xe3\xcb\x22\xc0", 6);
+    std::string avcc{'\x01', sps_bytes[1], sps_bytes[2], sps_bytes[3], '\xff', '\xe1'};
+    put_be(avcc, sps_bytes.size(), 2);
+    avcc += sps_bytes + '\x01';
+    put_be(avcc, pps.size(), 2);
+    avcc += pps;
+    send_all(fd, rtmp_message(6, 0, 9, 1, std::string("\x17\x00\x00\x00\x00", 5) + avcc));
+    send_all(fd, rtmp_message(5, 0, 8, 1, std::string("\xaf\x00\x11\x90", 4)));
+
+    ready = true;
+
+    constexpr uint32_t kFps = 25;
+    constexpr uint32_t kGop = 50;
+    size_t frame_bytes = opts.video_kbps * 1000 / 8 / kFps;
+    std::string noise(frame_bytes * 10, '\0');
+    for (auto &c : noise)
+    {
+        c = static_cast<char>(rng());
+    }
+
+    auto start = clock_type::now();
+    for (uint32_t frame = 0; !stop; ++frame)
+    {
+        bool is_key = frame % kGop == 0;
+        auto nal_size = is_key ? frame_bytes * 5 : frame_bytes;
+        std::string nal(1, is_key ? '\x65' : '\x41');
+        nal.append(noise, 0, std::min(nal_size, noise.size()));
+
+        std::string video(is_key ? "\x17\x01\x00\x00\x00" : "\x27\x01\x00\x00\x00", 5);
+        put_be(video, nal.size(), 4);
+        video += nal;
+
+        std::string audio("\xaf\x01", 2);
+        audio.append(noise, 0, 300);
+
+        uint32_t time_stamp = frame * 1000 / kFps;
+        send_all(fd, rtmp_message(6, time_stamp, 9, 1, video) + rtmp_message(5, time_stamp, 8, 1, audio));
+        std::this_thread::sleep_until(start + std::chrono::milliseconds((frame + 1) * 1000 / kFps));
+    }
+
+    ::close(fd);
+}
+
+/// utime + stime of a process in seconds, 0 if it cannot be read
+double process_cpu_seconds(int pid)
+{
+    if (!pid)
+    {
+        return 0;
+    }
+
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line))
+    {
+        return 0;
+    }
+
+    // the command name may contain spaces, the fields start after its closing parenthesis
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; ++i)
+    {
+        if (i == 14)
+        {
+            utime = std::stoull(field);
+        }
+        else if (i == 15)
+        {
+            stime = std::stoull(field);
+        }
+    }
+    return static_cast<double>(utime + stime) / static_cast<double>(::sysconf(_SC_CLK_TCK));
+}
+
+struct viewer
+{
+    int fd{-1};
+    uint64_t bytes{0};
+    bool is_closed{false};
+};
+
+options parse_options(int argc, char *argv[])
+{
+    options opts;
+    int opt = 0;
+    while ((opt = ::getopt(argc, argv, "h:r:p:n:t:s:b:P:x")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            opts.host = optarg;
+            break;
+        case 'r':
+            opts.rtmp_port = static_cast<uint16_t>(std::atoi(optarg));
+            break;
+        case 'p':
+            opts.http_port = static_cast<uint16_t>(std::atoi(optarg));
+            break;
+        case 'n':
+            opts.viewers = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            opts.seconds = static_cast<uint32_t>(std::atoi(optarg));
+            break;
+        case 's':
+            opts.stream = optarg;
+            break;
+        case 'b':
+            opts.video_kbps = static_cast<uint32_t>(std::atoi(optarg));
+            break;
+        case 'P':
+            opts.server_pid = std::atoi(optarg);
+            break;
+        case 'x':
+            opts.is_publishing = false;
+            break;
+        default:
+            std::fprintf(stderr, "usage: %s [-h host] [-r rtmp_port] [-p http_port] [-n viewers] [-t seconds] [-s stream] [-b video_kbps] "
+                                 "[-P server_pid] [-x]\n",
+                argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return opts;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto opts = parse_options(argc, argv);
+
+    std::atomic_bool stop{false};
+    std::atomic_bool ready{!opts.is_publishing};
+    std::thread publisher;
+    if (opts.is_publishing)
+    {
+        publisher = std::thread([&]() {
+            try
+            {
+                publish(opts, stop, ready);
+            }
+            catch (const std::exception &ex)
+            {
+                std::fprintf(stderr, "publisher failed: %s\n", ex.what());
+                std::exit(EXIT_FAILURE);
+            }
+        });
+    }
+
+    while (!ready)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // let the server register the stream before viewers ask for it
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    std::vector<viewer> viewers(opts.viewers);
+    auto request = "GET /live/" + opts.stream + ".flv?vhost=bench&token=bench HTTP/1.1\r\nHost: " + opts.host + "\r\n\r\n";
+
+    for (size_t i = 0; i < viewers.size(); ++i)
+    {
+        viewers[i].fd = connect_to(opts.host, opts.http_port, true);
+        epoll_event ev{};
+        ev.events = EPOLLOUT | EPOLLIN;
+        ev.data.u64 = i;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, viewers[i].fd, &ev);
+    }
+
+    std::vector<char> buf(256 * 1024);
+    std::vector<epoll_event> events(1024);
+    std::vector<bool> is_requested(viewers.size(), false);
+
+    // warm up for one second, then measure
+    auto warmup_end = clock_type::now() + std::chrono::seconds(1);
+    auto end = warmup_end + std::chrono::seconds(opts.seconds);
+    bool is_measuring = false;
+    double cpu_begin = 0;
+    uint64_t bytes_begin = 0;
+    uint64_t total_bytes = 0;
+
+    while (clock_type::now() < end)
+    {
+        if (!is_measuring && clock_type::now() >= warmup_end)
+        {
+            is_measuring = true;
+            cpu_begin = process_cpu_seconds(opts.server_pid);
+            bytes_begin = total_bytes;
+        }
+
+        int n = ::epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 100);
+        for (size_t i = 0; n > 0 && i < static_cast<size_t>(n); ++i)
+        {
+            auto index = events[i].data.u64;
+            auto &v = viewers[index];
+            if (v.is_closed)
+            {
+                continue;
+            }
+
+            if (!is_requested[index] && (events[i].events & EPOLLOUT))
+            {
+                is_requested[index] = true;
+                ::send(v.fd, request.data(), request.size(), MSG_NOSIGNAL);
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.u64 = index;
+                ::epoll_ctl(epfd, EPOLL_CTL_MOD, v.fd, &ev);
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                for (;;)
+                {
+                    auto len = ::recv(v.fd, buf.data(), buf.size(), 0);
+                    if (len > 0)
+                    {
+                        v.bytes += static_cast<uint64_t>(len);
+                        total_bytes += static_cast<uint64_t>(len);
+                        continue;
+                    }
+
+                    if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    {
+                        v.is_closed = true;
+                        ::epoll_ctl(epfd, EPOLL_CTL_DEL, v.fd, nullptr);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    double cpu = process_cpu_seconds(opts.server_pid) - cpu_begin;
+    auto measured = total_bytes - bytes_begin;
+
+    stop = true;
+    if (publisher.joinable())
+    {
+        publisher.join();
+    }
+
+    size_t alive = 0;
+    uint64_t min_bytes = UINT64_MAX;
+    for (auto &v : viewers)
+    {
+        alive += v.is_closed ? 0 : 1;
+        min_bytes = std::min(min_bytes, v.bytes);
+        ::close(v.fd);
+    }
+    ::close(epfd);
+
+    double seconds = opts.seconds;
+    std::printf("viewers %zu alive %zu\n", viewers.size(), alive);
+    std::printf("received %.1f MB in %u s, %.1f Mbit/s, slowest viewer %.1f KB\n", static_cast<double>(measured) / 1e6, opts.seconds,
+        static_cast<double>(measured) * 8 / 1e6 / seconds, static_cast<double>(min_bytes) / 1e3);
+    if (opts.server_pid)
+    {
+        std::printf("server cpu %.2f s, %.1f %% of one core, %.2f ms per MB sent\n", cpu, cpu * 100 / seconds,
+            measured ? cpu * 1e3 / (static_cast<double>(measured) / 1e6) : 0.0);
+    }
+
+    return alive == viewers.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,9 +9,9 @@ class aac_frame : public codec::frame
 public:
     using ptr = std::shared_ptr<aac_frame>;
 
-    /// @param  ptr to underlying data
+    /// @param  raw aac, without an adts header, aac_track::dump_adts_header builds one for the muxers that need it
     /// @param  dts
-    aac_frame(network::flat_buffer::ptr, uint64_t);
+    aac_frame(network::slice, uint64_t);
 
     bool is_key_frame() const override
     {
@@ -58,7 +58,7 @@ public:
         return Codec_Type::CodecAAC;
     }
 
-    void parse_config(network::flat_buffer &) override;
+    void parse_config(const network::slice &) override;
 
     adts_header extract_aac_config();
 
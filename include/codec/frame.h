@@ -1,7 +1,7 @@
 #pragma once
 
 #include "meta.h"
-#include "network/flat_buffer.h"
+#include "network/slice.h"
 
 #include <memory>
 
@@ -36,7 +36,7 @@ public:
         return pts_ ? pts_ : dts_;
     }
 
-    // h264 is 4, aac is 7
+    // h264 is 4, the avcc length of the nal unit, aac is 0
     void set_prefix_size(uint8_t size)
     {
         prefix_size_ = size;
@@ -46,24 +46,25 @@ public:
         return prefix_size_;
     }
 
-    void set_data(network::flat_buffer::ptr ptr)
+    /// usually a slice of the rtmp packet the frame was split from
+    void set_data(network::slice data)
     {
-        if (!ptr)
+        if (data.empty())
         {
             throw std::runtime_error("Unable to assign an empty buffer to the frame.");
         }
 
-        buf_ = std::move(ptr);
+        data_ = std::move(data);
     }
 
-    const network::flat_buffer::ptr data() const
+    const network::slice &data() const
     {
-        if (!buf_)
+        if (data_.empty())
         {
             throw std::runtime_error("The buffer within the frame has been lost");
         }
 
-        return buf_;
+        return data_;
     }
 
     Codec_Type codec_id() const
@@ -79,7 +80,7 @@ private:
     uint32_t dts_{0};
     uint32_t pts_{0};
     uint8_t prefix_size_{0};
-    network::flat_buffer::ptr buf_;
+    network::slice data_;
 };
 
 class frame_translator
@@ -2,7 +2,9 @@
 
 #include "frame.h"
 #include "meta.h"
-#include "network/flat_buffer.h"
+#include "network/slice.h"
+
+#include <spdlog/spdlog.h>
 
 namespace codec {
 
@@ -26,7 +28,8 @@ public:
 
     virtual Codec_Type get_codec() = 0;
 
-    virtual void parse_config(network::flat_buffer &) = 0;
+    /// the sequence header, AVCDecoderConfigurationRecord or AudioSpecificConfig
+    virtual void parse_config(const network::slice &) = 0;
 
     virtual void input_frame(const frame &fr)
     {
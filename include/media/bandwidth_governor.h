@@ -0,0 +1,124 @@
+#pragma once
+
+#include "network/session.h"
+#include "util/singleton.h"
+#include "util/timer.h"
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace media {
+
+/// bytes per second, 0 is unlimited
+struct egress_limits
+{
+    uint64_t total{0};
+    // every vhost without its own entry
+    uint64_t per_vhost{0};
+    std::unordered_map<std::string, uint64_t> vhosts{};
+
+    /**
+    Text form, one limit per line, # starts a comment:
+        total 125000000
+        per_vhost 25000000
+        vhost live.example.com 50000000
+    Throws on a line it cannot parse.
+    */
+    static egress_limits parse(const std::string &);
+};
+
+struct egress_stats
+{
+    uint64_t total_rate{0};
+    size_t viewers{0};
+    uint64_t admitted{0};
+    uint64_t rejected{0};
+    uint64_t shed{0};
+};
+
+/**
+Egress bandwidth governor of the http-flv viewers.
+Every viewer is sampled once per kUpdateIntervalMs from the bytes its session has sent, which gives the rate of the server
+and of each vhost. A new viewer is turned away while its vhost or the server is at its limit, so the viewers already
+playing keep their bandwidth. It is counted for at least the bitrate of its stream, or the configured viewer rate while that
+is not known, so a burst of joins before the next sample cannot overshoot. With a shed percentage the newest viewers of an overloaded vhost are closed first.
+*/
+class bandwidth_governor
+{
+public:
+    static constexpr uint64_t kUpdateIntervalMs = 1000;
+
+    /// loaded from util::server_config
+    bandwidth_governor();
+
+    ~bandwidth_governor() = default;
+
+    /// limits are set from the config or the limits file
+    bool is_enabled() const;
+
+    /// false when a new viewer of vhost does not fit, the viewer is counted against the limits until the next update,
+    /// stream_rate is the bitrate of the stream it asks for, 0 when unknown
+    bool admit(const std::string &vhost, uint64_t stream_rate = 0);
+
+    void add_viewer(const std::string &vhost, const std::shared_ptr<network::session> &);
+
+    /// sample the viewers, reload the limits file if it has changed and shed viewers if needed, called every kUpdateIntervalMs
+    void update();
+
+    void set_limits(egress_limits);
+
+    egress_limits limits() const;
+
+    uint64_t vhost_rate(const std::string &vhost) const;
+
+    /// live viewers of vhost in the order they would be shed, newest first
+    std::vector<std::weak_ptr<network::session>> rank(const std::string &vhost) const;
+
+    egress_stats get_stats() const;
+
+private:
+    struct viewer
+    {
+        std::weak_ptr<network::session> weak_session;
+        uint64_t serial{0};
+        uint64_t last_bytes_sent{0};
+        uint64_t rate{0};
+    };
+
+    struct vhost_entry
+    {
+        std::vector<viewer> viewers{};
+        uint64_t rate{0};
+        // expected rate of the viewers admitted since the last update
+        uint64_t reserved{0};
+    };
+
+    uint64_t limit_of(const std::string &vhost) const;
+    /// rate one more viewer of the vhost is expected to add
+    uint64_t expected_rate(const vhost_entry &, uint64_t stream_rate) const;
+    void reload_limits_file();
+    void shed(vhost_entry &, uint64_t limit);
+
+private:
+    mutable std::mutex mtx_{};
+    egress_limits limits_{};
+    std::string limits_file_{};
+    std::time_t limits_file_mtime_{0};
+    uint32_t shed_percent_{0};
+    uint64_t viewer_rate_{0};
+
+    std::unordered_map<std::string, vhost_entry> vhosts_{};
+    uint64_t total_rate_{0};
+    uint64_t total_reserved_{0};
+    util::ticker ticker_{};
+    egress_stats stats_{};
+};
+
+using egress_governor = util::singleton<bandwidth_governor>;
+
+} // namespace media
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+namespace media {
+
+/**
+Time the publishers spend in packet_dispatcher::distribute, over every stream of the process.
+In list mode it grows with the number of viewers, in ring mode it is one ring write plus one post per io executor.
+*/
+class dispatch_stats
+{
+public:
+    struct snapshot
+    {
+        uint64_t calls{0};
+        uint64_t total_ns{0};
+        uint64_t max_ns{0};
+    };
+
+    static void record(uint64_t elapsed_ns);
+
+    /// the calls recorded since the previous get_stats()
+    static snapshot get_stats();
+};
+
+} // namespace media
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "util/singleton.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace media {
+
+/// limits of the gop cache of one source, 0 disables a limit
+struct gop_budget
+{
+    size_t max_gops{1};
+    uint64_t max_bytes{0};
+    uint32_t max_duration_ms{0};
+
+    /// loaded from util::server_config
+    static gop_budget from_config();
+};
+
+/// what the registry sees of a gop cache
+class gop_cache_base
+{
+public:
+    virtual ~gop_cache_base() = default;
+
+    /// bytes of the cached packets
+    virtual uint64_t bytes() const = 0;
+
+    /// drop the oldest gop, never the one being filled, false when there is nothing left to drop
+    virtual bool evict_oldest_gop() = 0;
+};
+
+struct gop_cache_stats
+{
+    size_t caches{0};
+    uint64_t bytes{0};
+    uint64_t limit{0};
+    uint64_t evicted_gops{0};
+};
+
+/**
+Memory of the gop caches of every source on the node.
+Caches report the bytes they add and drop. Once the total passes the limit, the oldest gops of the largest caches are
+evicted until it fits again, by whichever publisher pushed it over.
+*/
+class gop_cache_registry
+{
+public:
+    /// loaded from util::server_config
+    gop_cache_registry();
+    ~gop_cache_registry() = default;
+
+    void add(std::weak_ptr<gop_cache_base>);
+
+    /// 0 is unlimited
+    void set_limit(uint64_t);
+
+    /// called by a cache without holding its own lock, may evict from any cache
+    void grow(uint64_t bytes);
+
+    void shrink(uint64_t bytes);
+
+    gop_cache_stats get_stats() const;
+
+private:
+    void enforce();
+
+private:
+    mutable std::mutex mtx_{};
+    std::vector<std::weak_ptr<gop_cache_base>> caches_{};
+    std::atomic<uint64_t> limit_{0};
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> evicted_gops_{0};
+    // over the limit with nothing left to evict, guarded by mtx_
+    bool is_saturated_{false};
+};
+
+using gop_registry = util::singleton<gop_cache_registry>;
+
+/// immutable copy of a gop cache, shared by the viewers that join while it is current
+template<typename T>
+struct gop_snapshot
+{
+    std::vector<T> packets{};
+    // sequence of the first packet pushed after the snapshot was taken, where the live packets of a viewer resume
+    uint64_t end_sequence{0};
+};
+
+/**
+The packets of the last gops of a source, a replay from it always begins on a keyframe.
+Whole gops are dropped from the front while the cache holds more than max_gops or lasts longer than max_duration_ms, the gop
+being filled is always kept. A gop that alone passes max_bytes is dropped too, then nothing is cached until the next keyframe.
+Sources without keyframes, e.g. audio only, keep one run of packets trimmed from the front instead.
+Every push gets the next sequence, skipped packets included, so it matches a packet_ring fed with the same packets.
+*/
+template<typename T>
+class gop_cache : public gop_cache_base
+{
+public:
+    using ptr = std::shared_ptr<gop_cache>;
+    using snapshot_ptr = std::shared_ptr<const gop_snapshot<T>>;
+
+    // bound of the run of packets kept when a source has no keyframes
+    static constexpr size_t kMaxKeyframelessPackets = 1024;
+
+    /// with needs_keyframe, packets before the first keyframe are not cached
+    static ptr create(gop_budget budget, bool needs_keyframe)
+    {
+        auto cache = std::shared_ptr<gop_cache>(new gop_cache(budget, needs_keyframe));
+        gop_registry::instance().add(cache);
+        return cache;
+    }
+
+    ~gop_cache() override
+    {
+        gop_registry::instance().shrink(bytes_);
+    }
+
+    /// called by the publisher, returns the sequence of the packet
+    uint64_t push(const T &pkt, bool is_keyframe, size_t bytes, uint32_t time_stamp)
+    {
+        uint64_t dropped = 0;
+        uint64_t sequence = 0;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            sequence = next_sequence_.fetch_add(1, std::memory_order_release);
+            if (is_keyframe)
+            {
+                gops_.emplace_back();
+                gops_.back().is_keyframe = true;
+            }
+            else if (gops_.empty())
+            {
+                if (needs_keyframe_)
+                {
+                    return sequence;
+                }
+                gops_.emplace_back();
+            }
+
+            auto &gop = gops_.back();
+            gop.packets.push_back({pkt, bytes, time_stamp});
+            gop.bytes += bytes;
+            bytes_ += bytes;
+
+            dropped = trim();
+            if (dropped)
+            {
+                release_snapshot();
+            }
+        }
+
+        if (bytes >= dropped)
+        {
+            gop_registry::instance().grow(bytes - dropped);
+        }
+        else
+        {
+            gop_registry::instance().shrink(dropped - bytes);
+        }
+        return sequence;
+    }
+
+    /**
+    The cached packets, rebuilt only when a packet has been pushed since the last snapshot: a burst of viewers joining
+    between two packets copies the cache once, later ones only load the pointer.
+    */
+    snapshot_ptr snapshot() const
+    {
+        auto snap = std::atomic_load(&snapshot_);
+        if (snap && snap->end_sequence == next_sequence_.load(std::memory_order_acquire))
+        {
+            return snap;
+        }
+
+        auto fresh = std::make_shared<gop_snapshot<T>>();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            fresh->end_sequence = next_sequence_.load(std::memory_order_relaxed);
+            size_t packets = 0;
+            for (auto &gop : gops_)
+            {
+                packets += gop.packets.size();
+            }
+
+            fresh->packets.reserve(packets);
+            for (auto &gop : gops_)
+            {
+                for (auto &entry : gop.packets)
+                {
+                    fresh->packets.emplace_back(entry.pkt);
+                }
+            }
+        }
+
+        snap = std::move(fresh);
+        std::atomic_store(&snapshot_, snap);
+        return snap;
+    }
+
+    uint64_t bytes() const override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return bytes_;
+    }
+
+    size_t gops() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return gops_.size();
+    }
+
+    bool evict_oldest_gop() override
+    {
+        uint64_t dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (gops_.size() < 2)
+            {
+                return false;
+            }
+            dropped = pop_front_gop();
+            release_snapshot();
+        }
+
+        gop_registry::instance().shrink(dropped);
+        return true;
+    }
+
+private:
+    struct entry
+    {
+        T pkt;
+        size_t bytes;
+        uint32_t time_stamp;
+    };
+
+    struct gop
+    {
+        std::deque<entry> packets{};
+        uint64_t bytes{0};
+        bool is_keyframe{false};
+    };
+
+    gop_cache(gop_budget budget, bool needs_keyframe)
+        : budget_{budget}
+        , needs_keyframe_{needs_keyframe}
+    {}
+
+    /// a snapshot holding dropped packets would keep their memory until the next viewer joins
+    void release_snapshot()
+    {
+        std::atomic_store(&snapshot_, snapshot_ptr{});
+    }
+
+    uint64_t pop_front_gop()
+    {
+        auto dropped = gops_.front().bytes;
+        bytes_ -= dropped;
+        gops_.pop_front();
+        return dropped;
+    }
+
+    bool is_over_bytes() const
+    {
+        return budget_.max_bytes && bytes_ > budget_.max_bytes;
+    }
+
+    bool is_over_duration() const
+    {
+        return budget_.max_duration_ms &&
+               gops_.back().packets.back().time_stamp - gops_.front().packets.front().time_stamp > budget_.max_duration_ms;
+    }
+
+    /// apply the budget after a push, returns the bytes dropped
+    uint64_t trim()
+    {
+        uint64_t dropped = 0;
+        while (gops_.size() > 1 && ((budget_.max_gops && gops_.size() > budget_.max_gops) || is_over_bytes() || is_over_duration()))
+        {
+            dropped += pop_front_gop();
+        }
+
+        auto &gop = gops_.front();
+        if (gop.is_keyframe)
+        {
+            if (is_over_bytes())
+            {
+                dropped += pop_front_gop();
+            }
+            return dropped;
+        }
+
+        // a run without keyframe can start anywhere
+        while (gop.packets.size() > 1 && (gop.packets.size() > kMaxKeyframelessPackets || is_over_bytes() || is_over_duration()))
+        {
+            auto bytes = gop.packets.front().bytes;
+            gop.packets.pop_front();
+            gop.bytes -= bytes;
+            bytes_ -= bytes;
+            dropped += bytes;
+        }
+        return dropped;
+    }
+
+private:
+    gop_budget budget_;
+    bool needs_keyframe_{true};
+    mutable std::mutex mtx_{};
+    std::deque<gop> gops_{};
+    uint64_t bytes_{0};
+    std::atomic<uint64_t> next_sequence_{0};
+    mutable snapshot_ptr snapshot_{};
+};
+
+} // namespace media
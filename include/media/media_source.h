@@ -28,6 +28,9 @@ public:
 
     bool is_registered();
 
+    /// bytes per second of all tracks together, safe to read from any thread
+    uint64_t get_total_bytes_speed() const;
+
     media_source(const media_source &) = delete;
     media_source &operator=(const media_source &) = delete;
     media_source(media_source &&) = delete;
@@ -42,12 +45,22 @@ protected:
 
     int get_bytes_speed(codec::Track_Type);
 
+    /// called by the thread that feeds speed_, publishes the total about once a second
+    void update_total_bytes_speed();
+
 protected:
     media_info::ptr media_info_;
 
     util::bytes_speed speed_[codec::kTrackCount];
 
 private:
+    static constexpr uint64_t kSpeedUpdateIntervalMs = 1000;
+
+    // only touched by the thread that feeds speed_
+    util::ticker speed_ticker_{};
+    // written by that thread, read by the viewers' threads
+    std::atomic<uint64_t> total_bytes_speed_{0};
+
     std::atomic_flag owned_{false};
     std::atomic_bool is_registered_{false};
 };
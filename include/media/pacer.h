@@ -0,0 +1,62 @@
+#pragma once
+
+#include "network/session.h"
+#include "util/timer.h"
+
+#include <cstdint>
+
+namespace media {
+
+struct pacing_stats
+{
+    uint64_t stream_rate{0}; // bytes per second of the stream at the last update
+    uint64_t rate{0};        // pacing rate set on the socket, 0 when it is not paced
+    uint64_t updates{0};     // times the socket rate has been changed
+};
+
+/**
+Per-viewer egress pacing.
+A keyframe is queued to every viewer at once, unpaced it leaves as one line-rate burst per viewer. The pacer caps the socket
+at the stream's measured bitrate times a headroom factor, so the kernel spreads the burst over time instead.
+The egress muxer calls update() from the thread distributing packets to this viewer, once the gop cache replayed on join has
+been written.
+*/
+class pacer
+{
+public:
+    static constexpr uint64_t kUpdateIntervalMs = 1000;
+    /// never pace below this, the bitrate of a stream that has just started is not known yet
+    static constexpr uint64_t kMinRate = 64 * 1024;
+
+    /// headroom_percent == 0 disables pacing, 150 paces at one and a half times the stream bitrate
+    explicit pacer(uint32_t headroom_percent);
+
+    /// loaded from util::server_config
+    pacer();
+
+    ~pacer() = default;
+
+    bool is_enabled() const
+    {
+        return headroom_percent_ != 0;
+    }
+
+    /// true once per kUpdateIntervalMs, so the bitrate is only looked up when update() may use it
+    bool is_due();
+
+    /// stream_rate in bytes per second, the socket is only touched when the rate has moved by more than an eighth
+    void update(network::session &, uint64_t stream_rate);
+
+    const pacing_stats &stats() const
+    {
+        return stats_;
+    }
+
+private:
+    uint32_t headroom_percent_;
+    util::ticker ticker_{};
+    bool is_first_{true};
+    pacing_stats stats_{};
+};
+
+} // namespace media
@@ -1,18 +1,42 @@
 #pragma once
 
 #include "network/session.h"
+#include "media/dispatch_stats.h"
+#include "media/gop_cache.h"
+#include "media/packet_ring.h"
 #include "util/util.h"
 
-#include <list>
+#include <mutex>
 #include <unordered_map>
 #include <set>
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <vector>
 
 namespace media {
 
 template<typename T, typename = std::enable_if_t<util::is_shared_ptr_v<T>>>
 class packet_dispatcher;
 
+template<typename T>
+struct reader_group;
+
+/**
+list: the publisher caches packets in a list and calls every reader inline.
+ring and affinity are for sharded io, where every executor runs on one thread and groups the readers of a whole shard.
+ring: the publisher writes packets into a packet_ring and wakes each io executor that has readers once, the readers of an
+executor pull their packets there in one batch.
+affinity: the readers on the shard of the publisher are called inline, every other shard with readers gets one handoff per
+packet. The readers of a shard are only touched on that shard.
+*/
+enum class Dispatch_Mode : uint8_t
+{
+    list = 0,
+    ring = 1,
+    affinity = 2,
+};
+
 #define CLIENT_READER_PARAMS                                                                                                               \
     std::weak_ptr<network::session> weak_session, std::weak_ptr<packet_dispatcher<T>> weak_dispatcher, const std::string &token
 
@@ -53,6 +77,20 @@ public:
         read_cb_(pkt);
     }
 
+    /// optional, called on the thread of the reader once the cached gops have been replayed, the packets after it are live
+    void set_replayed_cb(std::function<void()> cb)
+    {
+        replayed_cb_ = std::move(cb);
+    }
+
+    void on_replayed()
+    {
+        if (replayed_cb_)
+        {
+            replayed_cb_();
+        }
+    }
+
     void set_detach(std::function<void(bool)> cb)
     {
         if (!cb)
@@ -117,17 +155,96 @@ private:
         is_registered_ = is_registered;
     }
 
+    /// list mode, live packets reach the reader here, they wait in pending_ while it replays the gop cache
+    void deliver(const T &pkt)
+    {
+        if (is_replaying_.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> lock(replay_mtx_);
+            if (is_replaying_)
+            {
+                pending_.emplace_back(pkt);
+                return;
+            }
+        }
+
+        on_read(pkt);
+    }
+
+    /// replay the snapshot, then the live packets that arrived meanwhile, and go live
+    void replay(const gop_snapshot<T> &snap)
+    {
+        for (auto &pkt : snap.packets)
+        {
+            on_read(pkt);
+        }
+        on_replayed();
+
+        std::vector<T> pending;
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(replay_mtx_);
+                if (pending_.empty())
+                {
+                    is_replaying_ = false;
+                    return;
+                }
+                pending.swap(pending_);
+            }
+
+            for (auto &pkt : pending)
+            {
+                on_read(pkt);
+            }
+            pending.clear();
+        }
+    }
+
 private:
     std::weak_ptr<network::session> weak_session_;
     std::weak_ptr<packet_dispatcher<T>> weak_dispatcher_;
     std::function<void(const T &)> read_cb_;
+    std::function<void()> replayed_cb_;
     std::function<void(bool)> detach_cb_;
     std::string id_;
     std::atomic_bool is_registered_{false};
+
+    // set from registration until the gop cache has been replayed
+    std::atomic_bool is_replaying_{false};
+    std::mutex replay_mtx_{};
+    std::vector<T> pending_{};
+
+    // ring and affinity modes, cursor_ is only advanced on the session executor
+    std::shared_ptr<const gop_snapshot<T>> snapshot_{};
+    std::atomic<uint64_t> cursor_{0};
+    uint64_t overruns_{0};
+    std::weak_ptr<reader_group<T>> weak_group_;
+};
+
+/// the readers whose sessions run on one io executor, they are woken and pulled together in ring mode, in affinity mode
+/// readers is only touched on the executor and mtx is not used
+template<typename T>
+struct reader_group
+{
+    explicit reader_group(boost::asio::any_io_executor ex)
+        : executor{std::move(ex)}
+    {}
+
+    boost::asio::any_io_executor executor;
+    std::mutex mtx{};
+    std::vector<typename client_reader<T>::ptr> readers{};
+    // the readers a pull walks through, only touched by the pull
+    std::vector<typename client_reader<T>::ptr> batch{};
+    // set while no pull of the group is queued or running, whoever clears it queues the next pull
+    std::atomic_bool is_parked{true};
+    // affinity mode, the registered readers of the group, counted under the client mutex of the dispatcher
+    size_t registered{0};
 };
 
 /**
 This class is used to store and distribute packets to clients; all clients register their callback functions here.
+T points to a packet with size() and time_stamp, which the gop cache is budgeted by.
 */
 template<typename T, typename>
 class packet_dispatcher : public std::enable_shared_from_this<packet_dispatcher<T>>
@@ -135,13 +252,23 @@ class packet_dispatcher : public std::enable_shared_from_this<packet_dispatcher<
 public:
     using ptr = std::shared_ptr<packet_dispatcher>;
     using client_reader_ptr = typename client_reader<T>::ptr;
+    using group_ptr = std::shared_ptr<reader_group<T>>;
+    using group_list = std::vector<group_ptr>;
 
     static constexpr size_t kMaxPacketCacheSize = 1024;
     static constexpr size_t kMinPacketCacheSize = 32;
+    // packets each reader of a group pulls before the group lets the other handlers of its io thread run
+    static constexpr size_t kMaxPullBatch = 64;
 
-    static ptr create(size_t max_size = kMaxPacketCacheSize)
+    /// max_size is the capacity of the ring, has_video makes the gop cache wait for a keyframe
+    static ptr create(size_t max_size = kMaxPacketCacheSize, Dispatch_Mode mode = Dispatch_Mode::list, bool has_video = true)
     {
-        return std::shared_ptr<packet_dispatcher>(new packet_dispatcher(max_size));
+        return std::shared_ptr<packet_dispatcher>(new packet_dispatcher(max_size, mode, has_video));
+    }
+
+    Dispatch_Mode mode() const
+    {
+        return mode_;
     }
 
     ~packet_dispatcher()
@@ -156,12 +283,55 @@ public:
             return;
         }
 
-        // register in new clients set
+        if (mode_ == Dispatch_Mode::ring)
+        {
+            auto strong_session = client_ptr->weak_session_.lock();
+            if (!strong_session)
+            {
+                return;
+            }
+
+            // the first pull replays the cached gops, then reads the ring from the packet after them
+            auto snap = cache_->snapshot();
+            client_ptr->cursor_ = snap->end_sequence;
+            client_ptr->snapshot_ = std::move(snap);
+            client_ptr->is_replaying_ = true;
+
+            // joined under client_mtx_, an empty group is pruned under it too
+            group_ptr group;
+            {
+                std::scoped_lock lock(client_mtx_);
+                client_ptr->set_registered(true);
+                clients_.insert(client_ptr);
+                group = find_group(strong_session->get_executor());
+                client_ptr->weak_group_ = group;
+
+                std::lock_guard<std::mutex> group_lock(group->mtx);
+                group->readers.emplace_back(client_ptr);
+            }
+            wake(group);
+            return;
+        }
+
+        if (mode_ == Dispatch_Mode::affinity)
+        {
+            regist_local_reader(client_ptr);
+            return;
+        }
+
+        // the snapshot is taken and the reader added while no packet is being distributed, so the live packets of the
+        // reader begin right after the snapshot
+        typename gop_cache<T>::snapshot_ptr snap;
         {
             std::scoped_lock lock(client_mtx_);
+            snap = cache_->snapshot();
+            client_ptr->is_replaying_ = true;
             client_ptr->set_registered(true);
-            new_clients_.insert(client_ptr);
+            clients_.insert(client_ptr);
         }
+
+        // replayed on the thread of the viewer, which is registering, instead of the publisher
+        client_ptr->replay(*snap);
     }
 
     void deregist_reader(const client_reader_ptr &client_ptr)
@@ -171,134 +341,391 @@ public:
             return;
         }
 
+        if (mode_ == Dispatch_Mode::ring)
         {
             std::lock_guard<std::recursive_mutex> lock(client_mtx_);
-            new_clients_.erase(client_ptr);
+            client_ptr->set_registered(false);
+            clients_.erase(client_ptr);
+
+            auto group = client_ptr->weak_group_.lock();
+            if (!group)
+            {
+                return;
+            }
+
+            bool is_empty = false;
+            {
+                std::lock_guard<std::mutex> group_lock(group->mtx);
+                group->readers.erase(std::remove(group->readers.begin(), group->readers.end(), client_ptr), group->readers.end());
+                is_empty = group->readers.empty();
+            }
+
+            // the publisher stops waking the executor once its last reader has left
+            if (is_empty)
+            {
+                remove_group(group);
+            }
+            return;
         }
-    }
 
-    void distribute(const T &pkt, bool is_idr = false)
-    {
-        // 1. dispatch this single packet to old clients
+        if (mode_ == Dispatch_Mode::affinity)
         {
-            std::lock_guard<std::recursive_mutex> lock(client_mtx_);
-            for (auto it = old_clients_.begin(); it != old_clients_.end();)
+            group_ptr group;
             {
-                auto &client_ptr = *it;
-                if (!client_ptr)
-                {
-                    it = old_clients_.erase(it);
-                }
-                else
+                std::lock_guard<std::recursive_mutex> lock(client_mtx_);
+                client_ptr->set_registered(false);
+                group = client_ptr->weak_group_.lock();
+                // the publisher stops handing packets to the shard once its last reader has left, a reader joining
+                // later finds no group and adds a new one
+                if (clients_.erase(client_ptr) && group && --group->registered == 0)
                 {
-                    client_ptr->on_read(pkt);
-                    ++it;
+                    remove_group(group);
                 }
             }
+
+            // posted even on the shard itself, the reader may be leaving from inside a handoff walking the readers
+            if (group)
+            {
+                boost::asio::post(group->executor, [group, client_ptr]() {
+                    group->readers.erase(std::remove(group->readers.begin(), group->readers.end(), client_ptr), group->readers.end());
+                });
+            }
+            return;
         }
 
-        // 2. emplace the packet at the back of the packet list
         {
-            std::lock_guard<std::recursive_mutex> lock(pkt_mtx_);
-            // clear
-            if (is_idr)
+            std::lock_guard<std::recursive_mutex> lock(client_mtx_);
+            client_ptr->set_registered(false);
+            clients_.erase(client_ptr);
+        }
+    }
+
+    void distribute(const T &pkt, bool is_idr = false)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        if (mode_ == Dispatch_Mode::ring)
+        {
+            distribute_ring(pkt, is_idr);
+        }
+        else if (mode_ == Dispatch_Mode::affinity)
+        {
+            distribute_affinity(pkt, is_idr);
+        }
+        else
+        {
+            distribute_list(pkt, is_idr);
+        }
+        dispatch_stats::record(
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()));
+    }
+
+    void detach_all_readers(bool is_normal = false)
+    {
+        // detach callbacks shut sessions down, which deregisters them, so they run on a copy
+        std::set<client_reader_ptr> clients;
+        {
+            std::lock_guard<std::recursive_mutex> lock(client_mtx_);
+            clients.swap(clients_);
+        }
+
+        for (auto &ptr : clients)
+        {
+            ptr->detach();
+            ptr->set_registered(false);
+        }
+
+        if (mode_ == Dispatch_Mode::ring)
+        {
+            for (auto &group : *std::atomic_load(&groups_))
             {
-                packet_list_.clear();
+                std::lock_guard<std::mutex> lock(group->mtx);
+                group->readers.clear();
             }
-            else
+        }
+        else if (mode_ == Dispatch_Mode::affinity)
+        {
+            for (auto &group : *std::atomic_load(&groups_))
             {
-                while (packet_list_.size() >= max_size_)
-                {
-                    packet_list_.pop_front();
-                }
+                boost::asio::post(group->executor, [group]() { group->readers.clear(); });
             }
+        }
+    }
+
+private:
+    packet_dispatcher(size_t max_size, Dispatch_Mode mode, bool has_video)
+        : mode_{mode}
+    {
+        if (max_size < kMinPacketCacheSize)
+        {
+            max_size = kMinPacketCacheSize;
+        }
+        max_size_ = max_size;
 
-            packet_list_.emplace_back(pkt);
+        if (mode_ == Dispatch_Mode::ring)
+        {
+            ring_ = std::make_unique<packet_ring<T>>(max_size_);
+        }
+        if (mode_ != Dispatch_Mode::list)
+        {
+            groups_ = std::make_shared<group_list>();
+        }
+        cache_ = gop_cache<T>::create(gop_budget::from_config(), has_video);
+    }
+
+    void distribute_list(const T &pkt, bool is_idr)
+    {
+        // the cache and the readers change together, see regist_reader()
+        std::lock_guard<std::recursive_mutex> lock(client_mtx_);
+        cache_->push(pkt, is_idr, pkt->size(), pkt->time_stamp);
+        for (auto it = clients_.begin(); it != clients_.end();)
+        {
+            // step over the reader first, it may deregister itself from its callback
+            auto client_ptr = *it++;
+            client_ptr->deliver(pkt);
+        }
+    }
+
+    /**
+    The reader joins the group of its shard on the shard itself: it replays a snapshot of the cache there and then takes
+    the handoffs from the end of the snapshot on. A handoff that ran before was pushed to the cache before the snapshot,
+    one that runs after and is already in the snapshot is skipped by its sequence.
+    */
+    void regist_local_reader(const client_reader_ptr &client_ptr)
+    {
+        auto strong_session = client_ptr->weak_session_.lock();
+        if (!strong_session)
+        {
+            return;
         }
 
-        // 3. distribute the cached packets to new clients and merge two clients
+        group_ptr group;
         {
-            std::scoped_lock lock(pkt_mtx_, client_mtx_);
-            if (new_clients_.empty())
+            std::scoped_lock lock(client_mtx_);
+            client_ptr->set_registered(true);
+            clients_.insert(client_ptr);
+            group = find_group(strong_session->get_executor());
+            ++group->registered;
+            client_ptr->weak_group_ = group;
+        }
+
+        // pairs with the fence in distribute_affinity(), a packet missing from the snapshot sees the new group
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // inline when the viewer registers from its own shard, which is the common case
+        boost::asio::dispatch(group->executor, [this, strong_self = this->shared_from_this(), group, client_ptr]() {
+            if (!client_ptr->is_registered_)
             {
                 return;
             }
 
-            for (auto &pkt : packet_list_)
+            auto snap = cache_->snapshot();
+            client_ptr->cursor_.store(snap->end_sequence, std::memory_order_relaxed);
+            for (auto &cached_pkt : snap->packets)
             {
-                for (auto it = new_clients_.begin(); it != new_clients_.end();)
-                {
-                    auto &client_ptr = *it;
-                    if (!client_ptr)
-                    {
-                        it = new_clients_.erase(it);
-                    }
-                    else
-                    {
-                        client_ptr->on_read(pkt);
-                        ++it;
-                    }
-                }
+                client_ptr->on_read(cached_pkt);
             }
+            client_ptr->on_replayed();
+            group->readers.emplace_back(client_ptr);
+        });
+    }
+
+    /// the readers on the shard of the publisher are called right away, the other shards get the packet posted
+    void distribute_affinity(const T &pkt, bool is_idr)
+    {
+        auto sequence = cache_->push(pkt, is_idr, pkt->size(), pkt->time_stamp);
 
-            old_clients_.merge(new_clients_);
-            new_clients_.clear();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto groups = std::atomic_load(&groups_);
+        for (auto &group : *groups)
+        {
+            boost::asio::dispatch(group->executor, [group, pkt, sequence]() { hand_off(*group, pkt, sequence); });
         }
     }
 
-    void detach_all_readers(bool is_normal = false)
+    /// runs on the shard of the group
+    static void hand_off(reader_group<T> &group, const T &pkt, uint64_t sequence)
     {
-        if (new_clients_.empty() && old_clients_.empty())
+        for (auto &client_ptr : group.readers)
         {
-            return;
+            if (!client_ptr->is_registered_ || sequence < client_ptr->cursor_.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            client_ptr->cursor_.store(sequence + 1, std::memory_order_relaxed);
+            client_ptr->on_read(pkt);
         }
+    }
 
+    /// the publisher only advances the ring and wakes the groups that wait for it, one post per io executor
+    void distribute_ring(const T &pkt, bool is_idr)
+    {
+        // cached first, a reader resuming after a snapshot of the cache never misses the packet in the ring
+        cache_->push(pkt, is_idr, pkt->size(), pkt->time_stamp);
+        ring_->publish(pkt, is_idr);
+
+        // pairs with the fence in pull(), either the group sees the packet or the publisher sees the group parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto groups = std::atomic_load(&groups_);
+        for (auto &group : *groups)
         {
-            std::lock_guard<std::recursive_mutex> lock(client_mtx_);
-            for (auto it = new_clients_.begin(); it != new_clients_.end();)
+            wake(group);
+        }
+    }
+
+    /// the group of the executor, created on first use, client_mtx_ must be held
+    group_ptr find_group(const boost::asio::any_io_executor &ex)
+    {
+        auto groups = std::atomic_load(&groups_);
+        for (auto &group : *groups)
+        {
+            if (group->executor == ex)
             {
-                auto &ptr = *it;
-                if (ptr)
-                {
-                    ptr->detach();
-                    ptr->set_registered(false);
-                }
-                it = new_clients_.erase(it);
+                return group;
             }
+        }
+
+        // copy on write, the publisher keeps walking the list it loaded
+        auto group = std::make_shared<reader_group<T>>(ex);
+        auto new_groups = std::make_shared<group_list>(*groups);
+        new_groups->emplace_back(group);
+        std::atomic_store(&groups_, std::shared_ptr<const group_list>(std::move(new_groups)));
+        return group;
+    }
+
+    /// client_mtx_ must be held
+    void remove_group(const group_ptr &group)
+    {
+        auto groups = std::atomic_load(&groups_);
+        auto new_groups = std::make_shared<group_list>();
+        new_groups->reserve(groups->size());
+        std::copy_if(groups->begin(), groups->end(), std::back_inserter(*new_groups), [&group](const group_ptr &ptr) { return ptr != group; });
+        std::atomic_store(&groups_, std::shared_ptr<const group_list>(std::move(new_groups)));
+    }
+
+    void wake(const group_ptr &group)
+    {
+        if (group->is_parked.exchange(false))
+        {
+            post_pull(group);
+        }
+    }
 
-            for (auto it = old_clients_.begin(); it != old_clients_.end();)
+    void post_pull(const group_ptr &group)
+    {
+        std::weak_ptr<packet_dispatcher> weak_self = this->shared_from_this();
+        boost::asio::post(group->executor, [weak_self, group]() {
+            if (auto strong_self = weak_self.lock())
             {
-                auto &ptr = *it;
-                if (ptr)
-                {
-                    ptr->detach();
-                    ptr->set_registered(false);
-                }
-                it = old_clients_.erase(it);
+                strong_self->pull(group);
             }
+        });
+    }
+
+    /// runs on the executor of the group
+    void pull(const group_ptr &group)
+    {
+        {
+            std::lock_guard<std::mutex> lock(group->mtx);
+            group->batch = group->readers;
+        }
+
+        bool is_drained = true;
+        for (auto &client_ptr : group->batch)
+        {
+            is_drained = pull(client_ptr) && is_drained;
+        }
+        group->batch.clear();
+
+        // let the other handlers of the io thread run before the rest is pulled
+        if (!is_drained)
+        {
+            post_pull(group);
+            return;
+        }
+
+        group->is_parked = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // a packet published or a reader registered while the group was pulled did not wake it
+        if (has_pending(group))
+        {
+            wake(group);
         }
     }
 
-private:
-    packet_dispatcher(size_t max_size)
+    /// false when the reader still has packets after a batch
+    bool pull(const client_reader_ptr &client_ptr)
     {
-        if (max_size < kMinPacketCacheSize)
+        if (client_ptr->is_replaying_.load(std::memory_order_acquire))
         {
-            max_size = kMinPacketCacheSize;
+            auto snap = std::move(client_ptr->snapshot_);
+            client_ptr->is_replaying_ = false;
+            for (auto &cached_pkt : snap->packets)
+            {
+                client_ptr->on_read(cached_pkt);
+            }
+            client_ptr->on_replayed();
         }
-        max_size_ = max_size;
+
+        T pkt;
+        auto cursor = client_ptr->cursor_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kMaxPullBatch; ++i)
+        {
+            if (!client_ptr->is_registered_)
+            {
+                return true;
+            }
+
+            auto state = ring_->read(cursor, pkt);
+            if (state == packet_ring<T>::Read_State::empty)
+            {
+                return true;
+            }
+
+            if (state == packet_ring<T>::Read_State::overrun)
+            {
+                auto resume = ring_->resume_sequence();
+                spdlog::warn("{} fell {} packets behind the publisher, skip to {}, overruns = {}", client_ptr->id_, ring_->head() - cursor,
+                    resume, ++client_ptr->overruns_);
+                cursor = resume;
+                client_ptr->cursor_.store(cursor, std::memory_order_relaxed);
+                continue;
+            }
+
+            client_ptr->cursor_.store(++cursor, std::memory_order_relaxed);
+            client_ptr->on_read(pkt);
+        }
+        return false;
+    }
+
+    bool has_pending(const group_ptr &group)
+    {
+        auto head = ring_->head();
+        std::lock_guard<std::mutex> lock(group->mtx);
+        return std::any_of(group->readers.begin(), group->readers.end(), [head](const client_reader_ptr &client_ptr) {
+            return client_ptr->is_registered_ &&
+                   (client_ptr->is_replaying_.load(std::memory_order_relaxed) || client_ptr->cursor_.load(std::memory_order_relaxed) < head);
+        });
     }
 
 private:
-    // for packet list
+    Dispatch_Mode mode_;
+
+    // capacity of the ring
     size_t max_size_;
-    std::recursive_mutex pkt_mtx_{};
-    std::list<T> packet_list_{};
+
+    // replayed to new readers
+    typename gop_cache<T>::ptr cache_{};
 
     // for readers set
     std::recursive_mutex client_mtx_{};
-    std::set<client_reader_ptr> new_clients_{};
-    std::set<client_reader_ptr> old_clients_{};
+    std::set<client_reader_ptr> clients_{};
+
+    // ring mode
+    std::unique_ptr<packet_ring<T>> ring_{};
+    // ring and affinity modes, one group per io executor, replaced as a whole when a group is added or removed
+    std::shared_ptr<const group_list> groups_{};
 };
 
 } // namespace media
\ No newline at end of file
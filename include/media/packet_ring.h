@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace media {
+
+/**
+Fixed capacity ring written by one publisher and read by any number of readers, each reader keeps its own sequence.
+
+  slots_:  | seq & mask_ | ... |
+  oldest readable sequence = head_ - capacity_ + 1, the slot of head_ - capacity_ may be under rewrite
+
+A reader that falls more than capacity_ - 1 packets behind gets overrun and has to resume elsewhere, see resume_sequence().
+Slots are shared_ptrs stored and loaded with the atomic shared_ptr functions, no lock of the ring is taken on either side.
+*/
+template<typename T>
+class packet_ring
+{
+public:
+    static constexpr uint64_t kNoKeyframe = std::numeric_limits<uint64_t>::max();
+
+    enum class Read_State : uint8_t
+    {
+        ok = 0,
+        empty = 1,
+        overrun = 2,
+    };
+
+    /// capacity is rounded up to a power of two
+    explicit packet_ring(size_t capacity)
+    {
+        capacity_ = 1;
+        while (capacity_ < capacity)
+        {
+            capacity_ <<= 1;
+        }
+        mask_ = capacity_ - 1;
+        slots_.resize(capacity_);
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /// called by the publisher only
+    void publish(const T &pkt, bool is_keyframe)
+    {
+        auto seq = head_.load(std::memory_order_relaxed);
+        std::atomic_store_explicit(&slots_[seq & mask_], pkt, std::memory_order_release);
+        if (is_keyframe)
+        {
+            keyframe_.store(seq, std::memory_order_relaxed);
+        }
+        head_.store(seq + 1, std::memory_order_release);
+    }
+
+    /// the sequence of the next packet to be published
+    uint64_t head() const
+    {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    Read_State read(uint64_t seq, T &pkt) const
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        if (seq >= head)
+        {
+            return Read_State::empty;
+        }
+
+        if (head - seq >= capacity_)
+        {
+            return Read_State::overrun;
+        }
+
+        pkt = std::atomic_load_explicit(&slots_[seq & mask_], std::memory_order_acquire);
+
+        // the publisher may have started to rewrite the slot while it was loaded
+        if (head_.load(std::memory_order_acquire) - seq >= capacity_)
+        {
+            pkt = nullptr;
+            return Read_State::overrun;
+        }
+        return Read_State::ok;
+    }
+
+    /// where an overrun reader continues: the last keyframe when it is still readable, the next packet otherwise
+    uint64_t resume_sequence() const
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        auto keyframe = keyframe_.load(std::memory_order_relaxed);
+        return keyframe != kNoKeyframe && head - keyframe < capacity_ / 2 ? keyframe : head;
+    }
+
+private:
+    size_t capacity_{0};
+    size_t mask_{0};
+    std::vector<T> slots_;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    std::atomic<uint64_t> keyframe_{kNoKeyframe};
+};
+
+} // namespace media
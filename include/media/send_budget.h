@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace media {
+
+/// what a viewer does once it is further behind than its budget allows
+enum class Overflow_Policy : uint8_t
+{
+    drop_until_keyframe = 0, // drop everything, resume audio once caught up and video on the next keyframe
+    drop_non_reference = 1,  // drop video frames nothing else refers to, escalate to drop_until_keyframe at twice the budget
+    disconnect = 2,          // close the viewer
+};
+
+Overflow_Policy policy_from_string(const std::string &);
+
+struct viewer_stats
+{
+    uint64_t lag_bytes{0};       // bytes queued in the session but not yet written
+    uint32_t lag_ms{0};          // media duration queued in the session but not yet written
+    uint64_t sent_packets{0};    // packets handed to the session
+    uint64_t dropped_packets{0}; // packets skipped because of the budget
+    uint64_t dropped_bytes{0};
+    uint64_t overflows{0};       // times the viewer went over its budget
+};
+
+/**
+Bounded per-viewer send budget.
+The egress muxer asks admit() before queueing a packet, and reports with on_queued() where it ended in the session's byte stream.
+Both run on the same thread, the one distributing packets to this viewer.
+*/
+class send_budget
+{
+public:
+    enum class Verdict : uint8_t
+    {
+        send = 0,
+        drop = 1,
+        disconnect = 2,
+    };
+
+    /// max_bytes/max_ms == 0 disable the corresponding limit
+    send_budget(uint64_t max_bytes, uint32_t max_ms, Overflow_Policy);
+
+    /// loaded from util::server_config
+    send_budget();
+
+    ~send_budget() = default;
+
+    /// bytes_sent/bytes_queued are the session counters, size is the payload size of the packet
+    Verdict admit(uint64_t bytes_sent, uint64_t bytes_queued, uint32_t time_stamp, size_t size, bool is_video, bool is_keyframe,
+        bool is_non_reference);
+
+    /// stream_offset is the session's total queued bytes right after the packet has been queued
+    void on_queued(uint64_t stream_offset, uint32_t time_stamp);
+
+    /// the bytes queued up to stream_offset, e.g. the gop cache replayed on join, are not counted as lag
+    void skip_until(uint64_t stream_offset);
+
+    /// true once the skipped bytes have been written
+    bool is_skip_drained(uint64_t bytes_sent) const
+    {
+        return bytes_sent >= skipped_offset_;
+    }
+
+    const viewer_stats &stats() const
+    {
+        return stats_;
+    }
+
+    Overflow_Policy policy() const
+    {
+        return policy_;
+    }
+
+private:
+    void update_lag(uint64_t bytes_sent, uint64_t bytes_queued, uint32_t time_stamp);
+    bool is_over(uint64_t scale) const;
+    Verdict drop(size_t);
+
+private:
+    uint64_t max_bytes_;
+    uint32_t max_ms_;
+    Overflow_Policy policy_;
+
+    // video waits for a keyframe after an overflow
+    bool is_dropping_{false};
+    bool is_over_{false};
+
+    // end of the bytes that are not counted as lag, inside the session's byte stream
+    uint64_t skipped_offset_{0};
+
+    // end offset inside the session's byte stream and time stamp of every queued but unwritten packet
+    std::deque<std::pair<uint64_t, uint32_t>> in_flight_{};
+
+    viewer_stats stats_{};
+};
+
+} // namespace media
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "slice.h"
+
 #include <bitset>
 #include <cassert>
 #include <cstring>
@@ -85,6 +87,52 @@ private:
     size_t len_;
 };
 
+/**
+  read-only view into memory owned by someone else, e.g. the payload of a media packet
+
+  ************************ (memory kept alive by owner)
+      |----------------|
+     data      size
+*/
+class buffer_slice : public buffer
+{
+public:
+    using ptr = std::shared_ptr<buffer_slice>;
+
+    static ptr create(std::shared_ptr<const void> owner, const char *data, size_t size)
+    {
+        return std::make_shared<buffer_slice>(std::move(owner), data, size);
+    }
+
+    /// keeps only the block of the slice alive, not whatever else holds it
+    static ptr create(const slice &s)
+    {
+        return std::make_shared<buffer_slice>(s.block(), s.data(), s.size());
+    }
+
+    buffer_slice(std::shared_ptr<const void> owner, const char *data, size_t size)
+        : owner_{std::move(owner)}
+        , data_{data}
+        , size_{size}
+    {}
+
+    ~buffer_slice() override = default;
+
+    char *data() const override
+    {
+        return const_cast<char *>(data_);
+    }
+    size_t size() const override
+    {
+        return size_;
+    }
+
+private:
+    std::shared_ptr<const void> owner_;
+    const char *data_;
+    size_t size_;
+};
+
 class buffer_raw : public buffer
 {
 public:
@@ -188,6 +236,13 @@ public:
         {
             return;
         }
+        else
+        {
+            // shrink a pooled buffer that once held something much larger
+            delete[] data_;
+            data_ = nullptr;
+            set_size(0);
+        }
 
     alloc:
         data_ = new char[capacity];
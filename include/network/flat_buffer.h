@@ -1,6 +1,10 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util/slab_allocator.h"
 
 #include <spdlog/spdlog.h>
 
@@ -15,6 +19,26 @@
 
 namespace network {
 
+/**
+  heap mode
+
+  ****************************************** data_ (capacity_)
+  |---- consumed ----|---- unread ----|---- writable ----|
+                 read_index_     write_index_
+
+  unread bytes are moved back to the front (memmove) whenever the tail runs out of room,
+  the memory comes from util::slab_allocator and capacity_ is rounded up to its size class
+
+  mirrored mode, the same capacity_ bytes of memory are mapped twice back to back
+
+  ********************** ********************** data_ (2 * capacity_ of address space)
+  |       page(s) A      |       page(s) A      |
+          |---- unread ----|---- writable ----|
+      read_index_     write_index_
+
+  the unread bytes are always contiguous even when they wrap around the end of the memory,
+  so consuming and writing never move data, read_index_ is rewound by capacity_ before each write instead
+*/
 class flat_buffer
 {
 public:
@@ -22,25 +46,41 @@ public:
 
     static constexpr size_t kInitialSize = 1024;
 
-    static ptr create(size_t initial_size = kInitialSize)
+    enum class Mode : uint8_t
+    {
+        heap = 0,
+        mirrored = 1,
+    };
+
+    static ptr create(size_t initial_size = kInitialSize, Mode mode = Mode::heap)
     {
-        return std::make_shared<flat_buffer>(initial_size);
+        return std::make_shared<flat_buffer>(initial_size, mode);
     }
 
-    explicit flat_buffer(size_t initial_size = kInitialSize)
+    /// a mirrored buffer rounds initial_size up to whole pages and falls back to the heap if the mapping fails
+    explicit flat_buffer(size_t initial_size = kInitialSize, Mode mode = Mode::heap)
         : capacity_{initial_size}
     {
         read_index_ = write_index_ = 0;
-        data_ = new char[capacity_];
+        if (mode == Mode::mirrored)
+        {
+            capacity_ = round_up_to_page(initial_size);
+            data_ = map_mirrored(capacity_);
+            if (data_)
+            {
+                is_mirrored_ = true;
+                return;
+            }
+
+            spdlog::warn("cannot map a mirrored flat_buffer of {} bytes, errno = {}, fall back to heap", capacity_, errno);
+            capacity_ = initial_size;
+        }
+        data_ = util::slab_allocator::allocate(capacity_);
     }
 
     ~flat_buffer()
     {
-        if (data_)
-        {
-            delete[] data_;
-            data_ = nullptr;
-        }
+        release();
         capacity_ = 0;
     }
 
@@ -49,7 +89,7 @@ public:
         , read_index_{other.read_index_}
         , write_index_{other.write_index_}
     {
-        data_ = new char[capacity_];
+        allocate_like(other);
         std::memcpy(data_, other.data_, capacity_);
     }
 
@@ -57,15 +97,11 @@ public:
     {
         if (this != &other)
         {
+            release();
             capacity_ = other.capacity_;
             read_index_ = other.read_index_;
             write_index_ = other.write_index_;
-            if (data_)
-            {
-                delete[] data_;
-                data_ = nullptr;
-            }
-            data_ = new char[capacity_];
+            allocate_like(other);
             std::memcpy(data_, other.data_, capacity_);
         }
 
@@ -78,26 +114,29 @@ public:
         std::swap(capacity_, other.capacity_);
         std::swap(read_index_, other.read_index_);
         std::swap(write_index_, other.write_index_);
+        std::swap(is_mirrored_, other.is_mirrored_);
     }
 
     flat_buffer &operator=(flat_buffer &&other) noexcept
     {
         if (this != &other)
         {
-            if (data_)
-            {
-                delete[] data_;
-                data_ = nullptr;
-            }
+            release();
             std::swap(data_, other.data_);
             std::swap(capacity_, other.capacity_);
             std::swap(read_index_, other.read_index_);
             std::swap(write_index_, other.write_index_);
+            std::swap(is_mirrored_, other.is_mirrored_);
         }
 
         return *this;
     }
 
+    bool is_mirrored() const
+    {
+        return is_mirrored_;
+    }
+
     void print()
     {
         spdlog::info("read_index = {}, write_index = {}, capacity = {}", read_index_, write_index_, capacity_);
@@ -134,6 +173,12 @@ public:
 
     size_t writable_bytes() const
     {
+        if (is_mirrored_)
+        {
+            assert(capacity_ >= unread_length());
+            return capacity_ - unread_length();
+        }
+
         assert(capacity_ >= write_index_);
         return capacity_ - write_index_;
     }
@@ -332,17 +377,21 @@ public:
     {
         static constexpr size_t kMaxCacheSize = 4 * 1024 * 1024;
 
+        rewind_mirrored();
         if (writable_bytes() >= n)
         {
             // if buffer has enough space for the next read for session
             return n;
         }
 
-        move_unread_to_begin();
-
-        if (writable_bytes() >= n)
+        if (!is_mirrored_)
         {
-            return n;
+            move_unread_to_begin();
+
+            if (writable_bytes() >= n)
+            {
+                return n;
+            }
         }
 
         if (capacity() > kMaxCacheSize)
@@ -359,6 +408,7 @@ public:
 
     void socket_consume(size_t n)
     {
+        rewind_mirrored();
         if (n > writable_bytes())
         {
             throw std::runtime_error("session write_index is out of range");
@@ -375,6 +425,12 @@ public:
             return;
         }
 
+        if (is_mirrored_)
+        {
+            prepend_mirrored(data, size);
+            return;
+        }
+
         // 0 ---------- size ---------- read_index_
         if (read_index_ >= size)
         {
@@ -409,15 +465,11 @@ public:
         }
 
         // The current buffer is unable to accommodate both the prepended data and the existing data
-        size_t capacity = capacity_ << 1 + size;
-        char *temp = new char[capacity];
+        size_t capacity = (capacity_ << 1) + size;
+        char *temp = util::slab_allocator::allocate(capacity);
         std::memcpy(temp, data, size);
         std::memcpy(temp + size, data_ + read_index_, unread_length());
-        if (data_)
-        {
-            delete[] data_;
-            data_ = nullptr;
-        }
+        release();
         capacity_ = capacity;
         read_index_ = 0;
         write_index_ = size + unread_length();
@@ -436,6 +488,7 @@ private:
 
     void ensure_writable_bytes(size_t n)
     {
+        rewind_mirrored();
         if (writable_bytes() < n)
         {
             grow(n);
@@ -445,23 +498,25 @@ private:
     // grow the buffer to hold len bytes in written area
     void grow(size_t len)
     {
+        if (is_mirrored_)
+        {
+            grow_mirrored(len);
+            return;
+        }
+
         auto available_bytes = writable_bytes();
         if (available_bytes < len)
         {
             // grow the capacity
             size_t capacity = (capacity_ << 1) + len;
             size_t unconsumed_length = unread_length();
-            char *temp = new char[capacity];
+            char *temp = util::slab_allocator::allocate(capacity);
             // copy the data that hasn't been consumed
             std::memcpy(temp, begin() + read_index_, unconsumed_length);
+            release();
             read_index_ = 0;
             write_index_ = unconsumed_length;
             capacity_ = capacity;
-            if (data_)
-            {
-                delete[] data_;
-                data_ = nullptr;
-            }
             data_ = temp;
         }
         else
@@ -479,11 +534,138 @@ private:
         write_index_ = unconsumed_length;
     }
 
+    // keep read_index_ inside the first mapping, so the writable area never runs past the second one
+    void rewind_mirrored()
+    {
+        if (is_mirrored_ && read_index_ >= capacity_)
+        {
+            read_index_ -= capacity_;
+            write_index_ -= capacity_;
+        }
+    }
+
+    void prepend_mirrored(const char *data, size_t size)
+    {
+        rewind_mirrored();
+        if (writable_bytes() < size)
+        {
+            grow_mirrored(size);
+        }
+
+        // the bytes just before read_index_ are the tail of the first mapping when read_index_ is too small
+        if (read_index_ < size)
+        {
+            read_index_ += capacity_;
+            write_index_ += capacity_;
+        }
+        read_index_ -= size;
+        std::memcpy(data_ + read_index_, data, size);
+    }
+
+    // the only copy of the mirrored mode, into a larger mapping
+    void grow_mirrored(size_t len)
+    {
+        size_t unconsumed_length = unread_length();
+        size_t capacity = round_up_to_page((capacity_ << 1) + len);
+        char *temp = map_mirrored(capacity);
+        if (!temp)
+        {
+            throw std::runtime_error(fmt::format("cannot grow mirrored flat_buffer to {} bytes, errno = {}", capacity, errno));
+        }
+
+        std::memcpy(temp, data_ + read_index_, unconsumed_length);
+        release();
+        is_mirrored_ = true;
+        data_ = temp;
+        capacity_ = capacity;
+        read_index_ = 0;
+        write_index_ = unconsumed_length;
+    }
+
+    void allocate_like(const flat_buffer &other)
+    {
+        is_mirrored_ = false;
+        if (other.is_mirrored_)
+        {
+            data_ = map_mirrored(capacity_);
+            if (!data_)
+            {
+                throw std::runtime_error(fmt::format("cannot map a mirrored flat_buffer of {} bytes, errno = {}", capacity_, errno));
+            }
+            is_mirrored_ = true;
+            return;
+        }
+        data_ = util::slab_allocator::allocate(capacity_);
+    }
+
+    void release()
+    {
+        if (!data_)
+        {
+            return;
+        }
+
+        if (is_mirrored_)
+        {
+            ::munmap(data_, capacity_ << 1);
+        }
+        else
+        {
+            util::slab_allocator::deallocate(data_, capacity_);
+        }
+        data_ = nullptr;
+        is_mirrored_ = false;
+    }
+
+    static size_t round_up_to_page(size_t size)
+    {
+        static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        if (!size)
+        {
+            size = 1;
+        }
+        return (size + page_size - 1) / page_size * page_size;
+    }
+
+    /// map the same size bytes of a memfd twice back to back, nullptr on failure
+    static char *map_mirrored(size_t size)
+    {
+        int fd = ::memfd_create("flat_buffer", MFD_CLOEXEC);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        char *addr = nullptr;
+        if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+        {
+            // reserve the whole range first so nothing else can be mapped into the second half
+            void *reserved = ::mmap(nullptr, size << 1, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (reserved != MAP_FAILED)
+            {
+                auto base = static_cast<char *>(reserved);
+                if (::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                    ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED)
+                {
+                    addr = base;
+                }
+                else
+                {
+                    ::munmap(reserved, size << 1);
+                }
+            }
+        }
+
+        ::close(fd);
+        return addr;
+    }
+
 private:
     char *data_{nullptr};
     size_t capacity_;
     size_t read_index_;
     size_t write_index_;
+    bool is_mirrored_{false};
 
     size_t capacity_temp_{0};
     size_t read_index_temp_{0};
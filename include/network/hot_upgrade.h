@@ -0,0 +1,95 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace network {
+
+/**
+Binary upgrade without closing the listening sockets.
+
+  old process                                   new process
+  upgrade_listener on the unix socket path
+                                                upgrade_client::connect(path)
+  one message per listening socket  ---------->  take(address) for each listener it creates
+  "E"                               ---------->
+                                                starts accepting, ready()
+                                    <----------  "R"
+  on_ready: stop accepting, drain sessions       upgrade_listener on the same path for the next upgrade
+
+Both processes accept on the same sockets until the old one has been told the new one is ready, so no connection is refused.
+*/
+class upgrade_listener : public std::enable_shared_from_this<upgrade_listener>
+{
+public:
+    using ptr = std::shared_ptr<upgrade_listener>;
+    /// address and fd of every listening socket to hand over, see tcp_server::address()
+    using listeners_getter = std::function<std::vector<std::pair<std::string, int>>()>;
+
+    /// replaces a stale socket file at path, throws if it cannot listen on it
+    static ptr create(boost::asio::io_context &, const std::string &path, listeners_getter, std::function<void()> on_ready);
+
+    ~upgrade_listener();
+
+    upgrade_listener(const upgrade_listener &) = delete;
+    upgrade_listener &operator=(const upgrade_listener &) = delete;
+
+    void close();
+
+private:
+    upgrade_listener(boost::asio::io_context &, const std::string &path, listeners_getter, std::function<void()> on_ready);
+
+    void do_accept();
+    void hand_over(boost::asio::local::stream_protocol::socket);
+
+private:
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    std::string path_;
+    listeners_getter get_listeners_;
+    std::function<void()> on_ready_;
+};
+
+/// new process side of the upgrade, takes the listening sockets of the old process at startup
+class upgrade_client
+{
+public:
+    using ptr = std::shared_ptr<upgrade_client>;
+
+    /// nullptr when no process listens on path or the handover breaks off or times out, both are a fresh start
+    static ptr connect(const std::string &path);
+
+    /// closes the sockets that have not been taken
+    ~upgrade_client();
+
+    upgrade_client(const upgrade_client &) = delete;
+    upgrade_client &operator=(const upgrade_client &) = delete;
+
+    /// one listening socket of address, -1 if the old process has none left
+    int take(const std::string &address);
+
+    /// tell the old process to stop accepting, must be called once every listener accepts
+    void ready();
+
+    size_t size() const
+    {
+        return listeners_.size();
+    }
+
+private:
+    upgrade_client(int channel);
+
+    void receive();
+
+private:
+    int channel_{-1};
+    std::multimap<std::string, int> listeners_{};
+};
+
+} // namespace network
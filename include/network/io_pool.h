@@ -0,0 +1,126 @@
+#pragma once
+
+#include "uring_loop.h"
+#include "util/timer_wheel.h"
+
+#include <boost/asio.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace network {
+
+/**
+An io_context together with the threads that run it.
+In sharded mode every shard is run by exactly one thread, so everything bound to it never hops between cores.
+*/
+class io_shard
+{
+public:
+    using ptr = std::shared_ptr<io_shard>;
+
+    io_shard(size_t index, size_t thread_count)
+        : index_{index}
+        , thread_count_{thread_count}
+    {}
+
+    ~io_shard() = default;
+
+    io_shard(const io_shard &) = delete;
+    io_shard &operator=(const io_shard &) = delete;
+
+    size_t index() const
+    {
+        return index_;
+    }
+
+    boost::asio::io_context &context()
+    {
+        return io_context_;
+    }
+
+    /// only one thread runs this shard, handlers do not need a strand
+    bool is_pinned() const
+    {
+        return thread_count_ == 1;
+    }
+
+    size_t thread_count() const
+    {
+        return thread_count_;
+    }
+
+    /// timeouts and periodic jobs of everything running on this shard
+    const util::timer_wheel::ptr &timers() const
+    {
+        return timers_;
+    }
+
+    /// the io_uring loop of this shard, nullptr when the shard uses the asio reactor
+    const uring_loop::ptr &uring() const
+    {
+        return uring_;
+    }
+
+    /// the shard run by the calling thread, nullptr outside of io threads
+    static io_shard *current();
+
+private:
+    friend class io_pool;
+
+    size_t index_;
+    size_t thread_count_;
+    boost::asio::io_context io_context_{};
+    uring_loop::ptr uring_{nullptr};
+    util::timer_wheel::ptr timers_{nullptr};
+};
+
+class io_pool
+{
+public:
+    using ptr = std::shared_ptr<io_pool>;
+
+    /// is_sharded == false: one shard run by thread_count threads
+    /// is_sharded == true: thread_count shards run by one thread each
+    static ptr create(size_t thread_count, bool is_sharded, uint32_t timer_tick_ms = util::timer_wheel::kDefaultTickMs);
+
+    ~io_pool() = default;
+
+    io_pool(const io_pool &) = delete;
+    io_pool &operator=(const io_pool &) = delete;
+
+    size_t size() const
+    {
+        return shards_.size();
+    }
+
+    bool is_sharded() const
+    {
+        return is_sharded_;
+    }
+
+    io_shard &shard(size_t index)
+    {
+        return *shards_.at(index);
+    }
+
+    /// give every shard its own io_uring loop, returns false and keeps the asio reactor
+    /// if the kernel lacks io_uring or a shard is run by more than one thread
+    bool enable_uring();
+
+    /// run every shard on util::bs_thread_pool and block until all of them exit,
+    /// on_exception is invoked on the failing io thread before the shard is run again
+    void run(const std::function<void(io_shard &, const std::exception &)> &on_exception);
+
+    void stop();
+
+private:
+    io_pool(size_t thread_count, bool is_sharded, uint32_t timer_tick_ms);
+
+private:
+    bool is_sharded_;
+    std::vector<io_shard::ptr> shards_;
+};
+
+} // namespace network
@@ -19,6 +19,8 @@ enum class Ip_Type : uint8_t
 class server : public std::enable_shared_from_this<server>
 {
 public:
+    using ptr = std::shared_ptr<server>;
+
     virtual ~server() = default;
 
     server(const server &) = delete;
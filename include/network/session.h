@@ -2,17 +2,24 @@
 
 #include <boost/asio.hpp>
 
+#include "buffer.h"
 #include "flat_buffer.h"
+#include "tls_stream.h"
+#include "uring_loop.h"
+#include "util/timer_wheel.h"
 
+#include <array>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 #include <atomic>
 
 #define SESSION_CONSTRUCTOR_PARAMS                                                                                                         \
-    boost::asio::ip::tcp::socket sock, const std::string &session_prefix, const network::session_manager_ptr &manager
+    boost::asio::generic::stream_protocol::socket sock, const std::string &session_prefix, const network::session_manager_ptr &manager
 
 namespace network {
 
@@ -24,15 +31,33 @@ enum class err
 class session_manager;
 using session_manager_ptr = std::shared_ptr<session_manager>;
 
+/// what keeps a session from timing out
+enum class Idle_Policy : uint8_t
+{
+    // the session is stopped at the deadline whatever it does, e.g. a handshake
+    deadline = 0,
+    // the session is stopped when nothing has been received for the timeout, e.g. a publisher
+    recv = 1,
+    // the session is stopped when queued data has not drained for the timeout, e.g. a player
+    send = 2,
+};
+
 class session : public std::enable_shared_from_this<session>
 {
 public:
     using ptr = std::shared_ptr<session>;
+    using socket_type = boost::asio::generic::stream_protocol::socket;
 
     friend class session_manager;
 
     static constexpr size_t kMaxBufferCacheSize = 8 * 1024;
     static constexpr size_t kSocketReadSize = kMaxBufferCacheSize / 2;
+    // a busy session doubles its read size up to this, an idle one stays at kSocketReadSize
+    static constexpr size_t kMaxSocketReadSize = 256 * 1024;
+    // consecutive short reads before the read size is halved
+    static constexpr uint32_t kShortReadsToShrink = 8;
+    // upper bound of buffers gathered into one writev
+    static constexpr size_t kMaxWriteBatch = 64;
 
     virtual ~session();
 
@@ -43,31 +68,234 @@ public:
 
     const std::string &id();
 
+    /// process-wide unique integer id, the key of the session in its session_manager
+    uint64_t serial() const
+    {
+        return serial_;
+    }
+
     void shutdown();
+    /// shutdown() on the executor of the session, for callers on other threads
+    void post_shutdown();
+
+    /// handlers posted here run on the io thread of the session, serialized with its reads and writes
+    boost::asio::any_io_executor get_executor()
+    {
+        return socket_.get_executor();
+    }
     virtual void start() = 0;
 
+    /// move reads and writes of this session onto the io_uring loop of its shard, must be called before start()
+    void use_uring(uring_loop::ptr);
+
+    /// the timer wheel of the shard running this session, must be called before start()
+    void use_timers(util::timer_wheel::ptr);
+
+#ifdef ENABLE_OPENSSL
+    /// run a tls handshake before the first read, must be called before start()
+    void use_tls(const tls_context::ptr &);
+#endif
+
+    /// send batches of at least min_bytes with MSG_ZEROCOPY, 0 disables it, must be called before start()
+    void use_zerocopy(size_t min_bytes);
+
+    /// re-arm TCP_QUICKACK after every read, the kernel falls back to delayed acks on its own, must be called before start()
+    void use_quick_ack();
+
+    /// replace the idle timeout of the session, 0 disables it, ignored without a timer wheel
+    void set_idle_timeout(uint32_t timeout_ms, Idle_Policy);
+
+    /// cap the rate at which the kernel sends this socket out, in bytes per second, 0 removes the cap
+    bool set_pacing_rate(uint64_t bytes_per_second);
+
+    /// bytes handed to do_write() but not yet written to the socket
+    size_t bytes_queued() const
+    {
+        return bytes_queued_;
+    }
+
+    /// bytes written to the socket since the session started
+    uint64_t bytes_sent() const
+    {
+        return bytes_sent_;
+    }
+
+    /// number of gathered writes issued so far
+    uint64_t write_calls() const
+    {
+        return write_calls_;
+    }
+
+    /// bytes read from the socket since the session started
+    uint64_t bytes_received() const
+    {
+        return bytes_received_;
+    }
+
+    /// number of completed reads, one per recv completion on the io_uring backend
+    uint64_t read_calls() const
+    {
+        return read_calls_;
+    }
+
+    /// size of the next read on the asio backend
+    size_t read_size() const
+    {
+        return read_size_;
+    }
+
+    /// current SO_MAX_PACING_RATE of the socket, 0 when it is not paced
+    uint64_t pacing_rate() const
+    {
+        return pacing_rate_;
+    }
+
+    /// sendmsg() calls made with MSG_ZEROCOPY
+    uint64_t zerocopy_sends() const
+    {
+        return zerocopy_sends_;
+    }
+
+    /// zerocopy sends the kernel ended up copying anyway, e.g. over loopback
+    uint64_t zerocopy_copied() const
+    {
+        return zerocopy_copied_;
+    }
+
 protected:
     session(SESSION_CONSTRUCTOR_PARAMS);
 
     /// Perform an asynchronous read operation.
     void do_read();
-    void do_write(const char *, size_t, bool is_async = false, bool is_close = false);
+    /// copy the data into an owned buffer and queue it
+    void do_write(const char *, size_t, bool is_close = false);
+    /// queue the buffers as a whole, is_close closes the session once everything queued so far has been written
+    void do_write(buffer::ptr, bool is_close = false);
+    void do_write(std::vector<buffer::ptr>, bool is_close = false);
     virtual void on_recv(flat_buffer &) = 0;
 
+    /// nullptr when the session was not given a timer wheel
+    const util::timer_wheel::ptr &timers() const
+    {
+        return timers_;
+    }
+
 private:
     /// only session_manager can close the socket
     void stop();
 
+    /// must run on the executor of socket_, writes everything queued with one async_write
+    void flush();
+    /// send writing_ from write_offset_ on with one sendmsg on the io_uring loop
+    void uring_send();
+    /// account bytes_sent bytes of writing_, true once all of them have been written
+    bool on_written(size_t bytes_sent);
+    void on_write_error(int err, const std::string &msg);
+
+    /// send writing_ from write_offset_ on with MSG_ZEROCOPY sendmsg() calls
+    void zerocopy_send();
+    /// release the buffers of the zerocopy sends the kernel has reported as done
+    void reap_zerocopy();
+    void wait_zerocopy();
+    /// keep the buffers of the zerocopy calls made for writing_ until they complete
+    void retire_zerocopy_batch();
+
+    /// count a completed read and adapt the size of the next one to it
+    void on_read(size_t bytes_read);
+    /// append what has been read to buffer_, decrypted when tls runs in userspace, false if the session has to stop
+    bool on_received(const char *, size_t);
+
+#ifdef ENABLE_OPENSSL
+    void do_tls_handshake();
+    /// replace writing_ with the tls records carrying it
+    void encrypt_writing();
+#endif
+
+    void schedule_idle_check(uint64_t delay_ms);
+    /// activity is only recorded on reads and writes, the timer compares it when it fires
+    void on_idle_check(uint64_t epoch);
+    /// close the socket and log its counters, deferred by stop() while a send on the io_uring loop is pending
+    void close_socket();
+
 protected:
     flat_buffer buffer_{kMaxBufferCacheSize};
-    boost::asio::ip::tcp::socket socket_;
+    // a tcp or a unix stream socket
+    socket_type socket_;
     std::string session_prefix_;
     int raw_fd_{-1};
+    uint64_t serial_{0};
     std::string id_;
     session_manager_ptr session_manager_;
     std::atomic_bool is_closed_{false};
+
+private:
+    // adaptive read size, grows when reads fill the buffer and shrinks after a run of short reads
+    size_t read_size_{kSocketReadSize};
+    uint32_t short_reads_{0};
+    std::atomic_uint64_t bytes_received_{0};
+    std::atomic_uint64_t read_calls_{0};
+    bool is_quick_ack_{false};
+
+    // write queue, buffers are released after they have been written
+    std::mutex write_mtx_{};
+    std::deque<buffer::ptr> write_queue_{};
+    std::vector<buffer::ptr> writing_{};
+    bool is_writing_{false};
+    bool close_after_write_{false};
+    std::atomic_size_t bytes_queued_{0};
+    std::atomic_uint64_t bytes_sent_{0};
+    std::atomic_uint64_t write_calls_{0};
+
+    // io_uring backend, nullptr when the session runs on the asio reactor
+    uring_loop::ptr uring_{nullptr};
+    uint64_t recv_token_{0};
+    bool is_uring_sending_{false};
+    std::vector<iovec> iovecs_{};
+    size_t writing_size_{0};
+    size_t write_offset_{0};
+
+    // MSG_ZEROCOPY, a batch keeps its buffers until the kernel has reported all of its sendmsg() calls done
+    struct zerocopy_batch
+    {
+        uint32_t first{0};
+        uint32_t last{0};
+        uint32_t remaining{0};
+        std::vector<buffer::ptr> bufs{};
+    };
+    size_t zerocopy_min_bytes_{0};
+    // kernel counter of the next zerocopy sendmsg() on this socket
+    uint32_t zerocopy_next_{0};
+    uint32_t zerocopy_batch_first_{0};
+    uint32_t zerocopy_batch_calls_{0};
+    std::deque<zerocopy_batch> zerocopy_inflight_{};
+    bool is_zerocopy_waiting_{false};
+    std::atomic_uint64_t pacing_rate_{0};
+    std::atomic_uint64_t zerocopy_sends_{0};
+    std::atomic_uint64_t zerocopy_copied_{0};
+
+#ifdef ENABLE_OPENSSL
+    tls_stream::ptr tls_{nullptr};
+    // ciphertext read on the asio backend when the kernel does not decrypt
+    std::vector<char> tls_read_buffer_{};
+#endif
+
+    // idle timeout, checked lazily against the coarse clock of the wheel
+    util::timer_wheel::ptr timers_{nullptr};
+    util::timer_wheel::timer_id idle_timer_{0};
+    uint64_t idle_epoch_{0};
+    uint32_t idle_timeout_ms_{0};
+    Idle_Policy idle_policy_{Idle_Policy::deadline};
+    uint64_t idle_since_ms_{0};
+    std::atomic_uint64_t last_recv_ms_{0};
+    std::atomic_uint64_t last_send_ms_{0};
 };
 
+/**
+Registry of the sessions accepted by one listener.
+
+Sessions are keyed by their serial and spread over kShards buckets, each with its own mutex, so accepting and closing on
+different threads rarely contend. Sessions are only stopped outside of the bucket locks.
+*/
 class session_manager : public std::enable_shared_from_this<session_manager>
 {
 public:
@@ -75,6 +303,18 @@ public:
 
     using ptr = std::shared_ptr<session_manager>;
 
+    static constexpr size_t kShards = 16;
+
+    struct stats
+    {
+        // sessions currently registered
+        size_t live{0};
+        // sessions registered since the manager was created
+        uint64_t accepted{0};
+        // sessions removed since the manager was created
+        uint64_t closed{0};
+    };
+
     static ptr create(const std::string &);
 
     ~session_manager();
@@ -88,18 +328,48 @@ public:
     void stop(const session::ptr &);
     void stop_all();
 
-    std::string generate_session_prefix();
+    /// copy of the registered sessions, safe to iterate while sessions come and go
+    std::vector<session::ptr> snapshot() const;
+
+    size_t size() const
+    {
+        return live_;
+    }
+
+    stats get_stats() const;
+
+    /// prefix of the ids of the sessions, the session appends its serial and socket to it
+    const std::string &session_prefix() const
+    {
+        return session_prefix_;
+    }
 
 private:
     session_manager(const std::string &);
 
-    void erase(const std::string &);
+    static uint64_t next_serial();
+
+    void erase(uint64_t serial);
+
+private:
+    struct alignas(64) bucket
+    {
+        mutable std::mutex mtx{};
+        /// @brief except session_manager, no class should store session::ptr
+        std::unordered_map<uint64_t, session::ptr> sessions{};
+    };
+
+    bucket &bucket_of(uint64_t serial)
+    {
+        return buckets_[serial & (kShards - 1)];
+    }
 
 private:
     std::string session_prefix_;
-    std::recursive_mutex mtx_{};
-    /// @brief except session_manager, no class should store session::ptr
-    std::unordered_map<std::string, session::ptr> session_map_{};
+    std::array<bucket, kShards> buckets_{};
+    std::atomic_size_t live_{0};
+    std::atomic_uint64_t accepted_{0};
+    std::atomic_uint64_t closed_{0};
 };
 
 } // namespace network
\ No newline at end of file
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace network {
+
+/**
+Single producer, single consumer ring of records in shared memory, used by same-host publishers to hand FLV tags to the
+server without a socket. Header only, so producers can build it without the rest of the server.
+
+  | ring_header | data, capacity bytes |
+
+Every record is a record_header followed by its payload, padded to kRecordAlign. A record never wraps: when the space left
+before the end of the data is too small the producer fills it with a pad record and starts over at offset 0. head and tail
+are byte positions that only grow, position & (capacity - 1) is the offset in the data.
+The producer owns tail, the consumer owns head, each one only reads the other one's.
+*/
+namespace shm {
+
+static constexpr uint32_t kMagic = 0x53484d52; // "SHMR"
+static constexpr uint32_t kVersion = 1;
+static constexpr size_t kRecordAlign = 16;
+
+/// record types, the audio, video and script data values are the FLV tag types
+enum class Record_Type : uint8_t
+{
+    pad = 0,
+    audio = 8,
+    video = 9,
+    script = 18,
+};
+
+struct ring_header
+{
+    uint32_t magic{kMagic};
+    uint32_t version{kVersion};
+    // bytes of data, a power of two
+    uint64_t capacity{0};
+
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+};
+
+struct record_header
+{
+    // payload bytes, without this header and the padding
+    uint32_t size;
+    uint8_t type;
+    uint8_t reserved[3];
+    // milliseconds, the FLV tag timestamp with its extension
+    uint32_t time_stamp;
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(record_header) == kRecordAlign, "a pad record must fit into any gap left before the end of the data");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+
+inline size_t align_record(size_t size)
+{
+    return (sizeof(record_header) + size + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+/// bytes to map for a ring of capacity bytes of data
+inline size_t mapped_size(size_t capacity)
+{
+    return sizeof(ring_header) + capacity;
+}
+
+/// view of a mapped ring, it neither owns nor unmaps the memory
+class spsc_ring
+{
+public:
+    /// lay a new empty ring out in memory of mapped_size(capacity) bytes, capacity must be a power of two
+    static bool init(void *base, size_t capacity)
+    {
+        if (!base || capacity < 2 * kRecordAlign || (capacity & (capacity - 1)))
+        {
+            return false;
+        }
+
+        auto *header = new (base) ring_header;
+        header->capacity = capacity;
+        return true;
+    }
+
+    /// false when the memory does not hold a ring of this version that fits into mapped bytes
+    bool attach(void *base, size_t mapped)
+    {
+        if (!base || mapped < sizeof(ring_header))
+        {
+            return false;
+        }
+
+        auto *header = static_cast<ring_header *>(base);
+        auto capacity = header->capacity;
+        if (header->magic != kMagic || header->version != kVersion || capacity < 2 * kRecordAlign || (capacity & (capacity - 1)) ||
+            mapped_size(capacity) > mapped)
+        {
+            return false;
+        }
+
+        header_ = header;
+        data_ = static_cast<char *>(base) + sizeof(ring_header);
+        capacity_ = capacity;
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /// the largest payload a single record can carry
+    size_t max_payload() const
+    {
+        return capacity_ / 2 - sizeof(record_header);
+    }
+
+    /// the consumer has released every record pushed so far
+    bool is_empty() const
+    {
+        return header_->head.load(std::memory_order_acquire) == header_->tail.load(std::memory_order_acquire);
+    }
+
+    // producer
+    /// false when the ring has no room for the record yet
+    bool push(Record_Type type, uint32_t time_stamp, const void *payload, size_t size)
+    {
+        if (size > max_payload())
+        {
+            return false;
+        }
+
+        auto tail = header_->tail.load(std::memory_order_relaxed);
+        auto head = header_->head.load(std::memory_order_acquire);
+        auto offset = tail & (capacity_ - 1);
+        auto needed = align_record(size);
+        auto gap = capacity_ - offset;
+        auto total = gap < needed ? gap + needed : needed;
+        if (capacity_ - (tail - head) < total)
+        {
+            return false;
+        }
+
+        if (gap < needed)
+        {
+            write_header(offset, Record_Type::pad, static_cast<uint32_t>(gap - sizeof(record_header)), 0);
+            offset = 0;
+        }
+
+        write_header(offset, type, static_cast<uint32_t>(size), time_stamp);
+        if (size)
+        {
+            std::memcpy(data_ + offset + sizeof(record_header), payload, size);
+        }
+        header_->tail.store(tail + total, std::memory_order_release);
+        return true;
+    }
+
+    // consumer
+    /// the oldest record, false when the ring is empty or corrupt(), pad records are skipped
+    bool front(record_header &record, const char *&payload)
+    {
+        while (true)
+        {
+            auto head = header_->head.load(std::memory_order_relaxed);
+            auto tail = header_->tail.load(std::memory_order_acquire);
+            if (head == tail)
+            {
+                return false;
+            }
+
+            auto offset = head & (capacity_ - 1);
+            std::memcpy(&record, data_ + offset, sizeof(record));
+            auto length = align_record(record.size);
+            if (tail - head > capacity_ || length > capacity_ - offset || length > tail - head)
+            {
+                is_corrupt_ = true;
+                return false;
+            }
+
+            if (record.type != static_cast<uint8_t>(Record_Type::pad))
+            {
+                payload = data_ + offset + sizeof(record_header);
+                return true;
+            }
+
+            header_->head.store(head + length, std::memory_order_release);
+        }
+    }
+
+    /// release the record returned by front(), its payload must not be used afterwards
+    void pop(const record_header &record)
+    {
+        auto head = header_->head.load(std::memory_order_relaxed);
+        header_->head.store(head + align_record(record.size), std::memory_order_release);
+    }
+
+    /// the producer wrote a record that does not fit the ring, nothing more can be read
+    bool is_corrupt() const
+    {
+        return is_corrupt_;
+    }
+
+private:
+    void write_header(size_t offset, Record_Type type, uint32_t size, uint32_t time_stamp)
+    {
+        record_header record{};
+        record.size = size;
+        record.type = static_cast<uint8_t>(type);
+        record.time_stamp = time_stamp;
+        std::memcpy(data_ + offset, &record, sizeof(record));
+    }
+
+private:
+    ring_header *header_{nullptr};
+    char *data_{nullptr};
+    size_t capacity_{0};
+    bool is_corrupt_{false};
+};
+
+/**
+Handshake on the unix control socket of the server.
+The producer sends one hello carrying the memfd of the ring and an eventfd as SCM_RIGHTS, the server answers with a
+hello_reply. The memfd must be sealed with F_SEAL_SHRINK, a ring that could be truncated under the server is rejected.
+Afterwards the producer writes to the eventfd whenever it has pushed records, and closes the control socket
+to end the stream.
+*/
+struct hello
+{
+    uint32_t magic{kMagic};
+    uint32_t version{kVersion};
+    // app/stream?vhost=...&token=..., nul terminated
+    char url[512]{};
+};
+
+struct hello_reply
+{
+    // 0 when the stream is published, an errno value otherwise
+    int32_t error{0};
+};
+
+} // namespace shm
+
+} // namespace network
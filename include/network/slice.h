@@ -0,0 +1,161 @@
+#pragma once
+
+#include "util/slab_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace network {
+
+/**
+  immutable view into a refcounted block, copying a slice or cutting a sub slice never copies the bytes
+
+  ************************ block_ (one allocation, freed with the last slice)
+      |----------------|
+    offset_    size_
+
+  media payloads are written once into their block (see block_writer), the packet, its codec frames and the muxers
+  all hold slices of it
+*/
+class slice
+{
+public:
+    using block_ptr = std::shared_ptr<const char[]>;
+
+    slice() = default;
+
+    slice(block_ptr block, size_t offset, size_t size)
+        : block_{std::move(block)}
+        , offset_{offset}
+        , size_{size}
+    {}
+
+    /// a new block holding a copy of the bytes, for payloads that do not come from a block_writer
+    static slice copy_of(const char *data, size_t size)
+    {
+        auto block = util::slab_allocator::make_block(size);
+        if (size)
+        {
+            std::memcpy(block.get(), data, size);
+        }
+        return slice(std::move(block), 0, size);
+    }
+
+    static slice copy_of(const std::string &data)
+    {
+        return copy_of(data.data(), data.size());
+    }
+
+    const char *data() const
+    {
+        return block_ ? block_.get() + offset_ : nullptr;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return !size_;
+    }
+
+    const block_ptr &block() const
+    {
+        return block_;
+    }
+
+    uint8_t operator[](size_t index) const
+    {
+        return static_cast<uint8_t>(data()[index]);
+    }
+
+    void require_length_or_fail(size_t len) const
+    {
+        if (len > size_)
+        {
+            throw std::runtime_error("slice of " + std::to_string(size_) + " bytes does not contain the required length " +
+                                     std::to_string(len));
+        }
+    }
+
+    /// the len bytes from offset on, len == npos means up to the end
+    slice sub(size_t offset, size_t len = npos) const
+    {
+        require_length_or_fail(offset);
+        if (len == npos)
+        {
+            len = size_ - offset;
+        }
+        require_length_or_fail(offset + len);
+        return slice(block_, offset_ + offset, len);
+    }
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+private:
+    block_ptr block_;
+    size_t offset_{0};
+    size_t size_{0};
+};
+
+/// fills a block of a size known up front, e.g. a message assembled from rtmp chunks, and then seals it into a slice
+class block_writer
+{
+public:
+    block_writer() = default;
+
+    /// the block comes from the slab allocator, sized to the class of capacity
+    explicit block_writer(size_t capacity)
+        : block_(util::slab_allocator::make_block(capacity))
+        , capacity_{capacity}
+    {}
+
+    void write(const char *data, size_t size)
+    {
+        if (size > capacity_ - size_)
+        {
+            throw std::runtime_error("block_writer cannot write " + std::to_string(size) + " bytes, writable = " +
+                                     std::to_string(capacity_ - size_));
+        }
+
+        std::memcpy(block_.get() + size_, data, size);
+        size_ += size;
+    }
+
+    bool is_allocated() const
+    {
+        return static_cast<bool>(block_);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /// the written bytes, the writer is empty afterwards
+    slice seal()
+    {
+        slice sealed(std::move(block_), 0, size_);
+        block_.reset();
+        size_ = capacity_ = 0;
+        return sealed;
+    }
+
+private:
+    std::shared_ptr<char[]> block_;
+    size_t capacity_{0};
+    size_t size_{0};
+};
+
+} // namespace network
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace network {
+
+/**
+Socket options of one listener, set on the listening socket and on every accepted session.
+A field left at 0 or false keeps the kernel default, so the "none" profile changes nothing.
+*/
+struct socket_profile
+{
+    std::string name{"none"};
+
+    bool no_delay{false};
+    // bytes of unsent data above which the socket stops being writable, keeps the backlog in userspace where frames can be dropped
+    uint32_t notsent_lowat{0};
+    // setting a buffer size turns off the kernel autotuning of that buffer
+    int send_buffer{0};
+    int recv_buffer{0};
+    // not sticky, the kernel falls back to delayed acks on its own, so the session re-arms it after every read
+    bool quick_ack{false};
+
+    bool keepalive{false};
+    int keepalive_idle_s{0};
+    int keepalive_interval_s{0};
+    int keepalive_count{0};
+
+    /// rtmp publishers: big receive window, prompt acks and control messages
+    static socket_profile ingest();
+    /// http-flv players: small unsent queue, so a slow viewer backs up into its send budget instead of the kernel
+    static socket_profile play();
+    /// ingest, play or none, an unknown name falls back to none
+    static socket_profile from_name(const std::string &);
+
+    /// buffer sizes are set on the listener before any SYN arrives, so the window scale of accepted sockets matches them
+    void apply_to_listener(int fd) const;
+    void apply(int fd) const;
+};
+
+} // namespace network
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "buffer.h"
+
 #include <memory>
+#include <vector>
 
 namespace network {
 
@@ -8,11 +11,17 @@ class socket_sender
 {
 public:
     using ptr = std::shared_ptr<socket_sender>;
+    using buffer_list = std::vector<buffer::ptr>;
 
     socket_sender() = default;
     virtual ~socket_sender() = default;
 
+    /// the data is copied before this call returns, is_async is kept for compatibility, every write is asynchronous
     virtual void send(const char *, size_t, bool is_async = false, bool is_close = false) = 0;
+
+    /// the buffers are kept alive until they have been written, a list is queued as a whole
+    virtual void send(buffer::ptr, bool is_close = false) = 0;
+    virtual void send(buffer_list, bool is_close = false) = 0;
 };
 
 } // namespace network
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "server.h"
 #include "session.h"
+#include "socket_profile.h"
+#include "uring_loop.h"
 
 #include <boost/asio.hpp>
 
@@ -9,7 +11,7 @@ namespace network {
 
 using boost::asio::ip::tcp;
 
-#define TCP_SERVER_PARAMS boost::asio::io_context &io_context, uint16_t port, Ip_Type ip_type
+#define TCP_SERVER_PARAMS boost::asio::io_context &io_context, uint16_t port, Ip_Type ip_type, bool is_sharded, int listen_fd
 
 class tcp_server : public server
 {
@@ -19,7 +21,21 @@ public:
     static constexpr char kDefaultLocalIpv4[] = "0.0.0.0";
     static constexpr char kDefaultLocalIpv6[] = "0::0";
 
-    static ptr create(TCP_SERVER_PARAMS = Ip_Type::ipv4);
+    /// is_sharded: the listener binds with SO_REUSEPORT next to its siblings on the other io shards,
+    /// the kernel balances connections between them and every session stays on the accepting shard
+    /// listen_fd: an already listening socket of port, e.g. handed over by the process being upgraded, -1 to bind a new one
+    static ptr create(boost::asio::io_context &, uint16_t port, Ip_Type = Ip_Type::ipv4, bool is_sharded = false, int listen_fd = -1);
+
+    /**
+    Listener of a unix stream socket, for encoders running on the same host.
+    The sessions are the same as on tcp, an AF_UNIX stream carries the bytes just like a tcp stream, the acceptor and the
+    sockets are opened with the AF_UNIX protocol. listen_fd is a socket from listen_local() and the listener takes ownership
+    of it, to share the socket between the io shards the caller passes every shard its own dup() of it.
+    */
+    static ptr create_local(boost::asio::io_context &, const std::string &path, int listen_fd, bool is_sharded = false);
+
+    /// bind and listen on path, a stale socket file left behind by a previous process is replaced, throws on failure
+    static int listen_local(const std::string &path);
 
     ~tcp_server();
 
@@ -27,16 +43,86 @@ public:
 
     void restart() override;
 
+    /// close the acceptor and let the sessions run on, for a process handing its listeners over
+    void stop_accepting();
+
+    /// fd of the listening socket
+    int listen_fd() const
+    {
+        return raw_fd_;
+    }
+
+    /// 0 for a unix socket listener
+    uint16_t port() const
+    {
+        return port_;
+    }
+
+    /// socket path of a unix socket listener, empty for tcp
+    const std::string &local_path() const
+    {
+        return local_path_;
+    }
+
+    /// what the listening socket is handed over by on an upgrade, "tcp:<port>" or "unix:<path>"
+    std::string address() const;
+
+    static std::string address_of(uint16_t port);
+    static std::string address_of(const std::string &local_path);
+
+    /// accept with a multishot accept on the loop and hand it to every new session, must be called before start()
+    void use_uring(uring_loop::ptr);
+
+    /// timer wheel handed to every new session for its idle timeouts and periodic jobs
+    void use_timers(util::timer_wheel::ptr);
+
+    /// set the buffers of the profile on the listener and the rest on every accepted session, must be called before start()
+    void use_socket_profile(socket_profile);
+
+#ifdef ENABLE_OPENSSL
+    /// every accepted session runs a tls handshake before its protocol starts
+    void use_tls(tls_context::ptr);
+#endif
+
+    /// sessions send batches of at least min_bytes with MSG_ZEROCOPY, must be called before start()
+    void use_zerocopy(size_t min_bytes)
+    {
+        zerocopy_min_bytes_ = min_bytes;
+    }
+
+    /// registry of the sessions accepted by this listener
+    const session_manager::ptr &sessions() const
+    {
+        return session_manager_;
+    }
+
     template<typename SessionProtocol, typename = std::enable_if_t<std::is_base_of_v<session, SessionProtocol>>>
     void start()
     {
-        session_alloc_ = [this](boost::asio::ip::tcp::socket sock) {
+        session_alloc_ = [this](session::socket_type sock) {
             if (!session_manager_)
             {
                 session_manager_ = session_manager::create(info());
             }
 
-            auto session_ptr = SessionProtocol::create(std::move(sock), session_manager_->generate_session_prefix(), session_manager_);
+            profile_.apply(sock.native_handle());
+            auto session_ptr = SessionProtocol::create(std::move(sock), session_manager_->session_prefix(), session_manager_);
+            session_ptr->use_timers(timers_);
+            if (profile_.quick_ack)
+            {
+                session_ptr->use_quick_ack();
+            }
+#ifdef ENABLE_OPENSSL
+            if (tls_)
+            {
+                session_ptr->use_tls(tls_);
+            }
+#endif
+            // io_uring sends are not tracked for zerocopy completions
+            if (!uring_)
+            {
+                session_ptr->use_zerocopy(zerocopy_min_bytes_);
+            }
             session_manager_->add(session_ptr);
             return session_ptr;
         };
@@ -45,12 +131,13 @@ public:
     }
 
 private:
-    tcp_server(TCP_SERVER_PARAMS);
+    tcp_server(TCP_SERVER_PARAMS, const std::string &local_path);
 
     // callback after receiving termination signal
     void start_signal_listener();
 
     void do_accept();
+    void do_uring_accept();
 
 private:
     boost::asio::io_context &io_context_;
@@ -58,17 +145,37 @@ private:
     /// The signal_set is used to register for process termination notifications.
     boost::asio::signal_set signals_;
 
-    /// Acceptor used to listen for incoming connections.
-    tcp::acceptor acceptor_;
+    /// Acceptor used to listen for incoming connections, tcp or unix.
+    boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> acceptor_;
 
     // socket fd of this tcp server
     int raw_fd_{-1};
+    // protocol of the listening socket, the accepted sockets are opened with it too
+    boost::asio::generic::stream_protocol protocol_{AF_INET, IPPROTO_TCP};
+
+    // one of several SO_REUSEPORT listeners, one per io shard
+    bool is_sharded_{false};
+
+    // path of a unix socket listener
+    std::string local_path_{};
 
     std::string server_name_;
 
     session_manager::ptr session_manager_;
 
-    std::function<session::ptr(boost::asio::ip::tcp::socket)> session_alloc_;
+    std::function<session::ptr(session::socket_type)> session_alloc_;
+
+    socket_profile profile_{};
+    size_t zerocopy_min_bytes_{0};
+
+#ifdef ENABLE_OPENSSL
+    tls_context::ptr tls_{nullptr};
+#endif
+
+    uring_loop::ptr uring_{nullptr};
+    util::timer_wheel::ptr timers_{nullptr};
+    // token of the multishot accept, 0 if none is armed
+    uint64_t accept_token_{0};
 };
 
 } // namespace network
\ No newline at end of file
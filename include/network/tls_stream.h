@@ -0,0 +1,115 @@
+#pragma once
+
+#ifdef ENABLE_OPENSSL
+
+#include "buffer.h"
+#include "flat_buffer.h"
+
+#include <openssl/ssl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace network {
+
+/// certificate, key and settings shared by every tls session of a listener
+class tls_context
+{
+public:
+    using ptr = std::shared_ptr<tls_context>;
+
+    /// throws if the certificate or the key cannot be loaded
+    static ptr create(const std::string &cert_file, const std::string &key_file);
+
+    ~tls_context();
+
+    tls_context(const tls_context &) = delete;
+    tls_context &operator=(const tls_context &) = delete;
+
+    SSL_CTX *native_handle() const
+    {
+        return ctx_;
+    }
+
+private:
+    tls_context(const std::string &cert_file, const std::string &key_file);
+
+private:
+    SSL_CTX *ctx_{nullptr};
+};
+
+/**
+Server side tls of one session.
+
+The handshake runs in OpenSSL on the socket. Once it is done, OpenSSL hands the record layer of each direction to the kernel
+(kTLS) when it can, and the session reads and writes plaintext on the socket as if tls was not there, keeping gathered
+writes and io_uring sends intact. A direction the kernel does not take is switched to a memory BIO, the session then
+passes what it reads through decrypt() and what it writes through encrypt().
+*/
+class tls_stream
+{
+public:
+    using ptr = std::shared_ptr<tls_stream>;
+
+    enum class Want : uint8_t
+    {
+        done = 0,
+        read = 1,
+        write = 2,
+    };
+
+    static ptr create(const tls_context::ptr &, int fd);
+
+    ~tls_stream();
+
+    tls_stream(const tls_stream &) = delete;
+    tls_stream &operator=(const tls_stream &) = delete;
+
+    /// one step of the handshake on a non-blocking socket, throws if it fails
+    Want handshake();
+
+    bool is_established() const
+    {
+        return is_established_;
+    }
+
+    /// the kernel encrypts what the session writes
+    bool is_ktls_send() const
+    {
+        return is_ktls_send_;
+    }
+
+    /// the kernel decrypts what the session reads
+    bool is_ktls_recv() const
+    {
+        return is_ktls_recv_;
+    }
+
+    /// append the plaintext of the records in data to buf, false once the peer has sent close_notify, throws on a bad record
+    bool decrypt(const char *data, size_t size, flat_buffer &buf);
+    /// records carrying bufs, plus anything OpenSSL has queued on its own such as a key update
+    buffer::ptr encrypt(const std::vector<buffer::ptr> &bufs);
+
+    /// protocol version and cipher, e.g. TLSv1.3 TLS_AES_256_GCM_SHA384
+    std::string description() const;
+
+private:
+    tls_stream(const tls_context::ptr &, int fd);
+
+    void on_established();
+
+private:
+    tls_context::ptr context_;
+    SSL *ssl_{nullptr};
+    // memory BIOs of the directions left to userspace, owned by ssl_
+    BIO *rbio_{nullptr};
+    BIO *wbio_{nullptr};
+    bool is_established_{false};
+    bool is_ktls_send_{false};
+    bool is_ktls_recv_{false};
+};
+
+} // namespace network
+
+#endif
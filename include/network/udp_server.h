@@ -0,0 +1,212 @@
+#pragma once
+
+#include "buffer.h"
+#include "server.h"
+#include "util/timer_wheel.h"
+
+#include <boost/asio.hpp>
+
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace network {
+
+using boost::asio::ip::udp;
+
+class udp_server;
+
+#define UDP_PEER_CONSTRUCTOR_PARAMS const std::weak_ptr<network::udp_server> &server, const boost::asio::ip::udp::endpoint &endpoint
+
+/**
+One remote address of a udp_server, created when its first datagram arrives and dropped after it has been idle for
+udp_server::kPeerIdleMs. All callbacks of a peer run on the strand of its server.
+*/
+class udp_peer : public std::enable_shared_from_this<udp_peer>
+{
+public:
+    using ptr = std::shared_ptr<udp_peer>;
+
+    friend class udp_server;
+
+    virtual ~udp_peer() = default;
+
+    udp_peer(const udp_peer &) = delete;
+    udp_peer &operator=(const udp_peer &) = delete;
+    udp_peer(udp_peer &&) = delete;
+    udp_peer &operator=(udp_peer &&) = delete;
+
+    const std::string &id() const
+    {
+        return id_;
+    }
+
+    const udp::endpoint &endpoint() const
+    {
+        return endpoint_;
+    }
+
+    /// one datagram per buffer, queued and sent in batches by the server
+    void send(buffer::ptr);
+    void send(std::vector<buffer::ptr>);
+
+protected:
+    udp_peer(UDP_PEER_CONSTRUCTOR_PARAMS);
+
+    /// one call per datagram, GRO coalesced datagrams are split again before they get here
+    virtual void on_recv(const char *, size_t) = 0;
+    /// the peer has been idle for too long or the server is closing
+    virtual void on_close() {}
+
+protected:
+    std::weak_ptr<udp_server> server_;
+    udp::endpoint endpoint_;
+    std::string id_;
+
+private:
+    // coarse time of the last datagram, from the timer wheel of the server
+    uint64_t last_recv_ms_{0};
+};
+
+/**
+Datagram listener with batched io.
+
+Reads drain the socket with recvmmsg() kRecvBatch datagrams at a time, with UDP_GRO enabled when the kernel supports it.
+Datagrams queued by peers are flushed with sendmmsg(), and consecutive datagrams of one size to the same peer are
+packed into one UDP_SEGMENT (GSO) message when the kernel supports it.
+*/
+class udp_server : public server
+{
+public:
+    using ptr = std::shared_ptr<udp_server>;
+
+    static constexpr size_t kRecvBatch = 32;
+    // large enough for a GRO coalesced batch
+    static constexpr size_t kRecvBufferSize = 64 * 1024;
+    static constexpr size_t kSendBatch = 64;
+    static constexpr int kSocketBufferSize = 4 * 1024 * 1024;
+    // UDP_MAX_SEGMENTS of the kernel
+    static constexpr size_t kMaxGsoSegments = 64;
+    static constexpr size_t kMaxGsoBytes = 65507;
+    // the segments of a GSO message must fit the path MTU, 1500 bytes minus the ipv4 and udp headers
+    static constexpr size_t kMaxGsoSegmentSize = 1472;
+    static constexpr size_t kMaxPendingDatagrams = 8192;
+    // batches read in a row before other handlers get a chance to run
+    static constexpr size_t kMaxReadRounds = 8;
+    static constexpr uint32_t kPeerIdleMs = 30000;
+
+    struct stats
+    {
+        uint64_t recv_calls{0};
+        uint64_t datagrams_received{0};
+        uint64_t bytes_received{0};
+        uint64_t send_calls{0};
+        uint64_t datagrams_sent{0};
+        uint64_t bytes_sent{0};
+        uint64_t datagrams_dropped{0};
+        size_t peers{0};
+    };
+
+    static ptr create(boost::asio::io_context &, uint16_t port, Ip_Type = Ip_Type::ipv4, bool is_sharded = false);
+
+    ~udp_server();
+
+    const std::string &info() override;
+
+    void restart() override;
+
+    /// expire idle peers on the wheel, without it peers live as long as the server
+    void use_timers(util::timer_wheel::ptr);
+
+    template<typename PeerProtocol, typename = std::enable_if_t<std::is_base_of_v<udp_peer, PeerProtocol>>>
+    void start()
+    {
+        peer_alloc_ = [this](const udp::endpoint &endpoint) {
+            return PeerProtocol::create(std::static_pointer_cast<udp_server>(shared_from_this()), endpoint);
+        };
+
+        do_read();
+    }
+
+    /// one datagram per buffer, may be called from any thread
+    void send_to(const udp::endpoint &, std::vector<buffer::ptr>);
+
+    stats get_stats() const;
+
+private:
+    udp_server(boost::asio::io_context &, uint16_t port, Ip_Type, bool is_sharded);
+
+    void start_signal_listener();
+
+    void do_read();
+    /// false once the socket has no more data
+    bool read_batch();
+    void dispatch(const udp::endpoint &, const char *, size_t);
+
+    void do_write();
+    void flush();
+
+    void expire_peers();
+    void close();
+
+private:
+    struct endpoint_hash
+    {
+        size_t operator()(const udp::endpoint &endpoint) const
+        {
+            return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char *>(endpoint.data()), endpoint.size()));
+        }
+    };
+
+    struct datagram
+    {
+        udp::endpoint endpoint;
+        buffer::ptr buf;
+    };
+
+    boost::asio::io_context &io_context_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::signal_set signals_;
+    udp::socket socket_;
+    int raw_fd_{-1};
+    bool is_sharded_{false};
+    std::string server_name_;
+
+    bool is_gro_{false};
+    bool is_gso_{false};
+    bool is_reading_{false};
+    bool is_writing_{false};
+
+    std::function<udp_peer::ptr(const udp::endpoint &)> peer_alloc_;
+    std::unordered_map<udp::endpoint, udp_peer::ptr, endpoint_hash> peers_{};
+
+    // recvmmsg scratch, only touched on the strand
+    std::vector<char> recv_buffers_{};
+    std::array<mmsghdr, kRecvBatch> recv_msgs_{};
+    std::array<iovec, kRecvBatch> recv_iovecs_{};
+    std::array<sockaddr_storage, kRecvBatch> recv_addrs_{};
+    std::array<std::array<char, CMSG_SPACE(sizeof(int))>, kRecvBatch> recv_controls_{};
+
+    std::deque<datagram> pending_{};
+
+    util::timer_wheel::ptr timers_{nullptr};
+    util::timer_wheel::timer_id expire_timer_{0};
+
+    std::atomic_uint64_t recv_calls_{0};
+    std::atomic_uint64_t datagrams_received_{0};
+    std::atomic_uint64_t bytes_received_{0};
+    std::atomic_uint64_t send_calls_{0};
+    std::atomic_uint64_t datagrams_sent_{0};
+    std::atomic_uint64_t bytes_sent_{0};
+    std::atomic_uint64_t datagrams_dropped_{0};
+    std::atomic_size_t peer_count_{0};
+};
+
+} // namespace network
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+
+namespace network {
+
+/**
+io_uring driven socket I/O for one io shard, an alternative to the epoll reactor of asio.
+
+Completions are signalled through an eventfd watched by the shard's io_context, so every callback runs on the shard's io thread.
+Submissions are not sent right away, they are collected and handed to the kernel with a single io_uring_enter()
+once the current batch of handlers has finished.
+
+- accepts use multishot accept, one sqe serves every connection of a listener
+- receives use multishot recv with a ring of provided buffers
+- sends use sendmsg with the whole write queue of a session as iovecs
+*/
+class uring_loop : public std::enable_shared_from_this<uring_loop>
+{
+public:
+    using ptr = std::shared_ptr<uring_loop>;
+
+    /// res is the accepted fd, or -errno
+    using accept_cb = std::function<void(int res)>;
+    /// res > 0: bytes received into data, res == 0: peer closed, res < 0: -errno
+    using recv_cb = std::function<void(int res, const char *data)>;
+    /// res is the number of bytes sent, or -errno
+    using send_cb = std::function<void(int res)>;
+
+    static constexpr unsigned kDefaultEntries = 4096;
+    static constexpr unsigned kRecvBufferCount = 1024;
+    static constexpr unsigned kRecvBufferSize = 16 * 1024;
+
+    struct stats
+    {
+        uint64_t enter_calls{0};
+        uint64_t submitted{0};
+        uint64_t completed{0};
+    };
+
+    /// probe the kernel once, false if io_uring or one of the features used here is unavailable
+    static bool is_supported();
+
+    static ptr create(boost::asio::io_context &, unsigned entries = kDefaultEntries);
+
+    ~uring_loop();
+
+    uring_loop(const uring_loop &) = delete;
+    uring_loop &operator=(const uring_loop &) = delete;
+
+    /// returns a token usable with cancel()
+    uint64_t accept(int listen_fd, accept_cb);
+    uint64_t recv(int fd, recv_cb);
+    /// the iovecs and the memory they point to must stay valid until cb has been called
+    uint64_t send(int fd, const iovec *, size_t count, send_cb);
+
+    /// stop a pending or multishot operation, its callback is not called anymore
+    void cancel(uint64_t token);
+
+    stats get_stats() const;
+
+private:
+    enum class Op_Type : uint8_t
+    {
+        accept = 0,
+        recv = 1,
+        send = 2,
+        cancel = 3,
+    };
+
+    struct operation
+    {
+        Op_Type type;
+        int fd;
+        accept_cb on_accept;
+        recv_cb on_recv;
+        send_cb on_send;
+        msghdr msg{};
+    };
+
+    explicit uring_loop(boost::asio::io_context &, unsigned entries);
+
+    void setup(unsigned entries);
+    void setup_buffer_ring();
+
+    io_uring_sqe *get_sqe();
+    void prepare_accept(uint64_t token, int fd);
+    void prepare_recv(uint64_t token, int fd);
+
+    /// defer io_uring_enter() until the running handlers are done
+    void schedule_submit();
+    void submit();
+
+    void wait_completions();
+    void reap();
+    void recycle_buffer(uint16_t bid);
+
+private:
+    boost::asio::io_context &io_context_;
+    boost::asio::posix::stream_descriptor event_fd_;
+
+    int ring_fd_{-1};
+
+    // submission queue
+    void *sq_ptr_{nullptr};
+    size_t sq_size_{0};
+    unsigned *sq_head_{nullptr};
+    unsigned *sq_tail_{nullptr};
+    unsigned *sq_mask_{nullptr};
+    unsigned *sq_array_{nullptr};
+    io_uring_sqe *sqes_{nullptr};
+    size_t sqes_size_{0};
+    unsigned sq_local_tail_{0};
+    unsigned sq_pending_{0};
+
+    // completion queue
+    void *cq_ptr_{nullptr};
+    size_t cq_size_{0};
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned *cq_mask_{nullptr};
+    void *cqes_{nullptr};
+
+    // provided buffers for multishot recv
+    io_uring_buf_ring *buf_ring_{nullptr};
+    size_t buf_ring_size_{0};
+    char *buf_base_{nullptr};
+    uint16_t buf_tail_{0};
+
+    std::recursive_mutex mtx_{};
+    bool is_submit_scheduled_{false};
+    uint64_t next_token_{1};
+    std::unordered_map<uint64_t, std::unique_ptr<operation>> ops_{};
+
+    std::atomic_uint64_t enter_calls_{0};
+    std::atomic_uint64_t submitted_{0};
+    std::atomic_uint64_t completed_{0};
+};
+
+} // namespace network
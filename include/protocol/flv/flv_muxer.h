@@ -8,6 +8,8 @@
 #include "flv_header.h"
 #include "http/http_flv_header.h"
 #include "media/packet_dispatcher.h"
+#include "media/send_budget.h"
+#include "media/pacer.h"
 
 namespace flv {
 
@@ -24,18 +26,45 @@ public:
 
     ~flv_muxer();
 
+    /// lag and drop counters of this viewer
+    const media::viewer_stats &stats() const
+    {
+        return budget_.stats();
+    }
+
+    /// pacing rate of this viewer's socket
+    const media::pacing_stats &pacing() const
+    {
+        return pacer_.stats();
+    }
+
 private:
     flv_muxer();
 
     network::buffer_raw::ptr prepare_flv_header();
 
-    void write_flv(network::socket_sender *, tag_type, const char *, size_t, uint32_t time_stamp = 0);
+    /// tag header, body and previous tag size are queued as one gathered write, the body is not copied
+    void write_flv(network::socket_sender *, tag_type, network::buffer::ptr, uint32_t time_stamp = 0);
+
+    void write_flv(network::socket_sender *, const rtmp::rtmp_packet::ptr &);
+
+    /// live packets go through the send budget of the viewer first, and keep the pacing of its socket at the stream bitrate,
+    /// the replayed gop cache is queued as it is
+    void write_live(network::socket_sender *, network::session &, const rtmp::rtmp_packet::ptr &);
 
     network::buffer_raw::ptr prepare_flv_tag_header(tag_type, size_t, uint32_t time_stamp = 0);
 
+    network::buffer_raw::ptr prepare_previous_tag_size(size_t);
+
 private:
     util::resource_pool<network::buffer_raw>::ptr pool_;
     std::weak_ptr<client_reader> weak_client_reader_;
+    std::weak_ptr<rtmp::rtmp_media_source> weak_src_;
+    media::send_budget budget_;
+    media::pacer pacer_;
+    // set once the gop cache has been replayed, only touched by the thread delivering packets to the viewer
+    bool is_live_{false};
+    std::string id_;
 };
 
 } // namespace flv
\ No newline at end of file
@@ -2,7 +2,6 @@
 
 #include "network/session.h"
 #include "http_protocol.h"
-#include "util/timer.h"
 
 namespace http {
 
@@ -18,6 +17,8 @@ public:
     void start() override;
 
     void send(const char *, size_t, bool is_async = false, bool is_close = false) override;
+    void send(network::buffer::ptr, bool is_close = false) override;
+    void send(buffer_list, bool is_close = false) override;
 
     std::weak_ptr<network::session> get_session() override;
 
@@ -25,9 +26,5 @@ private:
     http_session(SESSION_CONSTRUCTOR_PARAMS);
 
     void on_recv(network::flat_buffer &) override;
-
-private:
-    // ticker
-    util::ticker ticker_;
 };
 } // namespace http
\ No newline at end of file
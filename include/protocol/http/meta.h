@@ -17,6 +17,7 @@ enum class Status
     Method_Not_Allowed = 405,
     Unsupported_Media_Type = 415,
     Internal_Server_Error = 500,
+    Service_Unavailable = 503,
 };
 
 const char *code_to_msg(Status);
@@ -24,6 +24,11 @@ public:
 
     void input_rtmp(rtmp_packet::ptr);
 
+    bool has_video() const
+    {
+        return static_cast<bool>(video_rtmp_decoder_);
+    }
+
 private:
     double duration_{0.0};
     codec::video_track::ptr video_track_;
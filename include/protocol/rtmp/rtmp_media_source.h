@@ -1,6 +1,7 @@
 #pragma once
 
 #include "media/media_source.h"
+#include "amf.h"
 #include "rtmp_demuxer.h"
 #include "media/packet_dispatcher.h"
 
@@ -19,6 +20,9 @@ public:
 
     static ptr create(media::media_info::ptr);
 
+    /// parse the onMetaData of a data message into the map, with or without the @setDataFrame of obs in front of it
+    static void load_metadata(AMFDecoder &, metadata_map &);
+
     ~rtmp_media_source() = default;
 
     /// not responsible for releasing the metadata_map *
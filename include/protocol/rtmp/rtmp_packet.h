@@ -1,6 +1,7 @@
 #pragma once
 
-#include "network/flat_buffer.h"
+#include "network/slice.h"
+#include "util/resource_pool.h"
 
 #include <cstdint>
 #include <cstdlib>
@@ -155,15 +156,22 @@ class rtmp_packet : public std::enable_shared_from_this<rtmp_packet>
 public:
     using ptr = std::shared_ptr<rtmp_packet>;
 
+    /// packets recycled per thread, a pool holds at most this many idle packets
+    static constexpr size_t kPoolSize = 1024;
+
+    /// from the pool of the calling thread, the packet goes back to that pool wherever its last reference is dropped
     static ptr create();
 
+    /// packets the pool of the calling thread had to allocate, flat once the thread has warmed up
+    static size_t pool_allocations();
+
     bool is_abs_stamp{false};
-    uint32_t chunk_stream_id;
-    uint32_t msg_stream_id;
-    uint32_t msg_length;
-    uint8_t msg_type_id;
-    uint32_t ts_delta;
-    uint32_t time_stamp;
+    uint32_t chunk_stream_id{0};
+    uint32_t msg_stream_id{0};
+    uint32_t msg_length{0};
+    uint8_t msg_type_id{0};
+    uint32_t ts_delta{0};
+    uint32_t time_stamp{0};
 
     ~rtmp_packet() = default;
     rtmp_packet(const rtmp_packet &) = delete;
@@ -173,15 +181,32 @@ public:
 
     rtmp_packet &restore_context(const rtmp_packet &);
 
+    /// back to a new packet before it is recycled, drops its reference to the payload block
+    void reset();
+
     bool is_video_keyframe() const;
     bool is_config_frame() const;
+    bool is_non_reference_frame() const;
     rtmp_flv_codec_id get_av_codec_id() const;
 
     void set_pkt_header_length(size_t);
 
-    size_t size();
+    /// chunk headers plus the bytes of the message received so far
+    size_t size() const;
+
+    /// copy the next chunk of the message into its block, the block is allocated with msg_length bytes on the first chunk
+    void append(const char *data, size_t size);
 
-    const network::flat_buffer::ptr buf();
+    /// bytes of the message received so far
+    size_t received() const;
+
+    /// the message is complete, its block becomes the immutable payload
+    void seal();
+
+    void set_payload(network::slice);
+
+    /// the message body, shared with the codec frames and the muxers, never modified once sealed
+    const network::slice &payload() const;
 
     bool is_video_pkt() const;
 
@@ -190,8 +215,14 @@ public:
 private:
     rtmp_packet();
 
+    static const util::resource_pool<rtmp_packet>::ptr &local_pool();
+
+    /// the first byte of the payload, the flv audio or video tag header
+    uint8_t peek_tag_header() const;
+
 private:
-    network::flat_buffer::ptr buf_;
+    network::block_writer writer_;
+    network::slice payload_;
     size_t pkt_header_length_{0};
 };
 
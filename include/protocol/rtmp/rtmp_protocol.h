@@ -4,6 +4,7 @@
 #include "media/media_info.h"
 #include "network/buffer.h"
 #include "network/flat_buffer.h"
+#include "network/session_receiver.h"
 #include "network/socket_sender.h"
 #include "rtmp_media_source.h"
 #include "rtmp_packet.h"
@@ -15,7 +16,7 @@
 
 namespace rtmp {
 
-class rtmp_protocol : public network::socket_sender
+class rtmp_protocol : public network::socket_sender, public network::session_receiver
 {
 public:
     virtual ~rtmp_protocol() = default;
@@ -25,6 +26,15 @@ protected:
 
     void on_parse_rtmp(network::flat_buffer &);
 
+    /// periodic job, acknowledge the received bytes once the window announced by the peer is full
+    void check_acknowledgement();
+
+    /// true once a publish command has claimed the media source
+    bool is_publishing() const
+    {
+        return rtmp_source_ != nullptr;
+    }
+
 private:
     const char *handle_C0C1(const char *, size_t);
     const char *handle_C2(const char *, size_t);
@@ -40,6 +50,7 @@ private:
     void send_rtmp(uint8_t msg_type_id, uint32_t msg_stream_id, const std::string &data, uint32_t time_stamp, int chunk_stream_id);
 
     void send_acknowledgement(uint32_t);
+    void set_window_ack_size(uint32_t);
     void set_chunk_size(uint32_t);
     void set_peer_bandwidth(uint32_t);
 
@@ -59,9 +70,8 @@ private:
 
     double transaction_id_ = 0;
 
-    // Acknowledgement
+    // Acknowledgement, windows_size_ is announced by the peer
     uint64_t bytes_sent_{0};
-    uint64_t bytes_sent_last_{0};
     uint64_t bytes_recv_{0};
     uint64_t bytes_recv_last_{0};
     uint32_t windows_size_{0};
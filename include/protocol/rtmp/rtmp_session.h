@@ -2,7 +2,6 @@
 
 #include "network/session.h"
 #include "rtmp_protocol.h"
-#include "util/timer.h"
 
 namespace rtmp {
 
@@ -13,24 +12,33 @@ class rtmp_session : public network::session, public rtmp_protocol
 public:
     using ptr = std::shared_ptr<rtmp_session>;
 
+    // period of the acknowledgement window check
+    static constexpr uint32_t kAckCheckMs = 500;
+
     static ptr create(RTMP_CONSTRUCTOR_PARAMS);
 
-    ~rtmp_session() override = default;
+    ~rtmp_session() override;
 
     void start() override;
 
     void send(const char *, size_t, bool is_async = false, bool is_close = false) override;
+    void send(network::buffer::ptr, bool is_close = false) override;
+    void send(buffer_list, bool is_close = false) override;
+
+    std::weak_ptr<network::session> get_session() override;
 
 private:
     rtmp_session(RTMP_CONSTRUCTOR_PARAMS);
 
     void on_recv(network::flat_buffer &) override;
+    /// move the unread bytes of the read buffer into a mirrored one, once the session has started publishing
+    void switch_to_mirrored(network::flat_buffer &);
 
 private:
     std::function<const char *(const char *, size_t)> next_step_fun_;
 
-    // ticker
-    util::ticker ticker_;
+    util::timer_wheel::timer_id ack_timer_{0};
+    bool is_buffer_switched_{false};
 };
 
 } // namespace rtmp
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "network/shm_ring.h"
+#include "rtmp_media_source.h"
+
+#include <boost/asio.hpp>
+
+#include <memory>
+#include <string>
+
+namespace rtmp {
+
+/**
+A publisher on the same host writing FLV tags into a shared memory ring, see network/shm_ring.h.
+Tags are read straight out of the ring into rtmp packets for the media source, there is no socket read and no chunk parsing.
+The publisher keeps itself alive while it waits on its eventfd and its control socket, it stops when the producer closes
+the control socket or writes something the ring or the media source rejects.
+*/
+class shm_publisher : public std::enable_shared_from_this<shm_publisher>
+{
+public:
+    using ptr = std::shared_ptr<shm_publisher>;
+
+    /// records handled per wakeup before the other handlers of the executor get a turn
+    static constexpr size_t kMaxRecordsPerWake = 256;
+
+    using executor_type = boost::asio::local::stream_protocol::socket::executor_type;
+
+    /// takes ring_fd and event_fd, throws if the ring cannot be mapped or the stream cannot be published
+    static ptr create(const executor_type &, int ring_fd, int event_fd, const std::string &url);
+
+    ~shm_publisher();
+
+    shm_publisher(const shm_publisher &) = delete;
+    shm_publisher &operator=(const shm_publisher &) = delete;
+
+    /// answer the hello on the control socket and start reading the ring
+    void start(boost::asio::local::stream_protocol::socket control);
+
+    const std::string &id() const
+    {
+        return id_;
+    }
+
+private:
+    shm_publisher(const executor_type &, int ring_fd, int event_fd);
+
+    void map_ring(int ring_fd);
+    void publish(const std::string &url);
+
+    void wait_event();
+    void wait_close();
+    void drain();
+    void on_record(const network::shm::record_header &, const char *payload);
+    void stop(const std::string &reason);
+
+private:
+    boost::asio::local::stream_protocol::socket control_;
+    boost::asio::posix::stream_descriptor event_;
+    uint64_t event_value_{0};
+    char close_byte_{0};
+
+    void *mapped_{nullptr};
+    size_t mapped_size_{0};
+    network::shm::spsc_ring ring_{};
+
+    media::media_info::ptr media_info_;
+    rtmp_media_source::ptr rtmp_source_;
+    std::shared_ptr<void> src_ownership_;
+    rtmp_media_source::metadata_map meta_data_{};
+
+    std::string id_;
+    bool is_stopped_{false};
+    uint64_t records_{0};
+    uint64_t bytes_{0};
+};
+
+/// unix control socket on which same-host publishers hand their ring and eventfd over
+class shm_ingest_listener : public std::enable_shared_from_this<shm_ingest_listener>
+{
+public:
+    using ptr = std::shared_ptr<shm_ingest_listener>;
+
+    /// replaces a stale socket file at path, throws if it cannot listen on it
+    static ptr create(boost::asio::io_context &, const std::string &path);
+
+    ~shm_ingest_listener();
+
+    shm_ingest_listener(const shm_ingest_listener &) = delete;
+    shm_ingest_listener &operator=(const shm_ingest_listener &) = delete;
+
+    void close();
+
+private:
+    shm_ingest_listener(boost::asio::io_context &, const std::string &path);
+
+    void do_accept();
+    void on_hello(boost::asio::local::stream_protocol::socket);
+
+private:
+    boost::asio::io_context &io_context_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    std::string path_;
+};
+
+} // namespace rtmp
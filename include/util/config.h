@@ -0,0 +1,328 @@
+#pragma once
+
+#include "singleton.h"
+
+#include <cstdint>
+#include <string>
+
+namespace util {
+
+/**
+Server wide settings, loaded once from the environment (see Dockerfile ENV).
+Every setting falls back to a built-in default when its variable is missing or malformed.
+*/
+class config
+{
+public:
+    static constexpr char kIoMode[] = "STREAMING_IO_MODE";
+    static constexpr char kIoShards[] = "STREAMING_IO_SHARDS";
+    static constexpr char kIoBackend[] = "STREAMING_IO_BACKEND";
+    static constexpr char kTimerTickMs[] = "STREAMING_TIMER_TICK_MS";
+    static constexpr char kHandshakeTimeoutMs[] = "STREAMING_HANDSHAKE_TIMEOUT_MS";
+    static constexpr char kPublishIdleTimeoutMs[] = "STREAMING_PUBLISH_IDLE_TIMEOUT_MS";
+    static constexpr char kPlayIdleTimeoutMs[] = "STREAMING_PLAY_IDLE_TIMEOUT_MS";
+    static constexpr char kStatsIntervalMs[] = "STREAMING_STATS_INTERVAL_MS";
+    static constexpr char kRtmpSocketProfile[] = "STREAMING_RTMP_SOCKET_PROFILE";
+    static constexpr char kHttpSocketProfile[] = "STREAMING_HTTP_SOCKET_PROFILE";
+    static constexpr char kRtmpUnixSocket[] = "STREAMING_RTMP_UNIX_SOCKET";
+    static constexpr char kShmIngestSocket[] = "STREAMING_SHM_INGEST_SOCKET";
+    static constexpr char kZerocopyMinBytes[] = "STREAMING_ZEROCOPY_MIN_BYTES";
+    static constexpr char kPacingHeadroomPercent[] = "STREAMING_PACING_HEADROOM_PERCENT";
+    static constexpr char kEgressMaxRate[] = "STREAMING_EGRESS_MAX_RATE";
+    static constexpr char kEgressVhostMaxRate[] = "STREAMING_EGRESS_VHOST_MAX_RATE";
+    static constexpr char kEgressLimitsFile[] = "STREAMING_EGRESS_LIMITS_FILE";
+    static constexpr char kEgressShedPercent[] = "STREAMING_EGRESS_SHED_PERCENT";
+    static constexpr char kEgressViewerRate[] = "STREAMING_EGRESS_VIEWER_RATE";
+    static constexpr char kTlsCertFile[] = "STREAMING_TLS_CERT_FILE";
+    static constexpr char kTlsKeyFile[] = "STREAMING_TLS_KEY_FILE";
+    static constexpr char kRtmpsPort[] = "STREAMING_RTMPS_PORT";
+    static constexpr char kHttpsPort[] = "STREAMING_HTTPS_PORT";
+    static constexpr char kUpgradeSocket[] = "STREAMING_UPGRADE_SOCKET";
+    static constexpr char kUpgradeDrainMs[] = "STREAMING_UPGRADE_DRAIN_MS";
+    static constexpr char kViewerMaxLagBytes[] = "STREAMING_VIEWER_MAX_LAG_BYTES";
+    static constexpr char kViewerMaxLagMs[] = "STREAMING_VIEWER_MAX_LAG_MS";
+    static constexpr char kViewerOverflowPolicy[] = "STREAMING_VIEWER_OVERFLOW_POLICY";
+    static constexpr char kDispatcherMode[] = "STREAMING_DISPATCHER_MODE";
+    static constexpr char kGopCacheGops[] = "STREAMING_GOP_CACHE_GOPS";
+    static constexpr char kGopCacheMaxBytes[] = "STREAMING_GOP_CACHE_MAX_BYTES";
+    static constexpr char kGopCacheMaxMs[] = "STREAMING_GOP_CACHE_MAX_MS";
+    static constexpr char kGopCacheTotalBytes[] = "STREAMING_GOP_CACHE_TOTAL_BYTES";
+
+    config();
+    ~config() = default;
+
+    /// "shared": one io_context run by every thread, "sharded": one io_context per thread
+    const std::string &io_mode() const
+    {
+        return io_mode_;
+    }
+
+    bool is_sharded() const
+    {
+        return io_mode_ == "sharded";
+    }
+
+    /// 0 means one shard per thread of the thread pool, a set count grows the pool to it and overrides the debug single shard
+    size_t io_shards() const
+    {
+        return io_shards_;
+    }
+
+    /// "asio": epoll reactor of asio, "uring": io_uring loop per shard, falls back to asio when unsupported
+    const std::string &io_backend() const
+    {
+        return io_backend_;
+    }
+
+    bool is_uring() const
+    {
+        return io_backend_ == "uring";
+    }
+
+    /// resolution of the timer wheel of every io shard
+    uint32_t timer_tick_ms() const
+    {
+        return timer_tick_ms_;
+    }
+
+    /// time a connection has to complete its handshake and publish or play request, 0 disables the limit
+    uint32_t handshake_timeout_ms() const
+    {
+        return handshake_timeout_ms_;
+    }
+
+    /// a publisher that has sent nothing for this long is dropped, 0 disables the limit
+    uint32_t publish_idle_timeout_ms() const
+    {
+        return publish_idle_timeout_ms_;
+    }
+
+    /// a player whose queued data has not drained for this long is dropped, 0 disables the limit
+    uint32_t play_idle_timeout_ms() const
+    {
+        return play_idle_timeout_ms_;
+    }
+
+    /// period of the io shard stats log, 0 disables it
+    uint32_t stats_interval_ms() const
+    {
+        return stats_interval_ms_;
+    }
+
+    /// socket profile of the rtmp listener: ingest, play or none
+    const std::string &rtmp_socket_profile() const
+    {
+        return rtmp_socket_profile_;
+    }
+
+    /// socket profile of the http listener: ingest, play or none
+    const std::string &http_socket_profile() const
+    {
+        return http_socket_profile_;
+    }
+
+    /// unix socket path on which rtmp publishers on the same host are accepted, empty disables it
+    const std::string &rtmp_unix_socket() const
+    {
+        return rtmp_unix_socket_;
+    }
+
+    /// unix socket on which publishers on the same host hand a shared memory ring over, empty disables it
+    const std::string &shm_ingest_socket() const
+    {
+        return shm_ingest_socket_;
+    }
+
+    /// writes of at least this many bytes are sent with MSG_ZEROCOPY on the asio backend, 0 disables it
+    uint64_t zerocopy_min_bytes() const
+    {
+        return zerocopy_min_bytes_;
+    }
+
+    /// viewers are paced at this percentage of the stream bitrate, 0 disables pacing
+    uint32_t pacing_headroom_percent() const
+    {
+        return pacing_headroom_percent_;
+    }
+
+    /// http-flv egress of the whole server in bytes per second above which new viewers get a 503, 0 is unlimited
+    uint64_t egress_max_rate() const
+    {
+        return egress_max_rate_;
+    }
+
+    /// the same limit for each vhost
+    uint64_t egress_vhost_max_rate() const
+    {
+        return egress_vhost_max_rate_;
+    }
+
+    /// limits re-read whenever the file changes, they replace the two above, empty disables it
+    const std::string &egress_limits_file() const
+    {
+        return egress_limits_file_;
+    }
+
+    /// once egress is this many percent over a limit the newest viewers are closed, 0 only rejects new viewers
+    uint32_t egress_shed_percent() const
+    {
+        return egress_shed_percent_;
+    }
+
+    /// bytes per second a new viewer is counted for while neither its stream nor the egress has been measured yet
+    uint64_t egress_viewer_rate() const
+    {
+        return egress_viewer_rate_;
+    }
+
+    /// pem certificate chain of the rtmps and https listeners, they are only started with a certificate and a key
+    const std::string &tls_cert_file() const
+    {
+        return tls_cert_file_;
+    }
+
+    /// pem private key of the certificate
+    const std::string &tls_key_file() const
+    {
+        return tls_key_file_;
+    }
+
+    bool is_tls() const
+    {
+        return !tls_cert_file_.empty() && !tls_key_file_.empty();
+    }
+
+    uint16_t rtmps_port() const
+    {
+        return rtmps_port_;
+    }
+
+    uint16_t https_port() const
+    {
+        return https_port_;
+    }
+
+    /// unix socket on which the listening sockets are handed to the next binary, empty disables hot upgrades
+    const std::string &upgrade_socket() const
+    {
+        return upgrade_socket_;
+    }
+
+    /// time the sessions of an upgraded process have to finish before they are closed
+    uint32_t upgrade_drain_ms() const
+    {
+        return upgrade_drain_ms_;
+    }
+
+    /// bytes a viewer may have queued before its overflow policy kicks in, 0 disables the limit
+    uint64_t viewer_max_lag_bytes() const
+    {
+        return viewer_max_lag_bytes_;
+    }
+
+    /// milliseconds of media a viewer may have queued, 0 disables the limit
+    uint32_t viewer_max_lag_ms() const
+    {
+        return viewer_max_lag_ms_;
+    }
+
+    /// drop_until_keyframe, drop_non_reference or disconnect
+    const std::string &viewer_overflow_policy() const
+    {
+        return viewer_overflow_policy_;
+    }
+
+    /// "list": the publisher calls every viewer of a stream inline, "ring": viewers pull packets from a ring on their own io thread,
+    /// "affinity": viewers on the shard of the publisher are called inline, each other shard gets one handoff per packet,
+    /// ring and affinity need sharded io
+    const std::string &dispatcher_mode() const
+    {
+        return dispatcher_mode_;
+    }
+
+    bool is_ring_dispatcher() const
+    {
+        return dispatcher_mode_ == "ring";
+    }
+
+    bool is_affinity_dispatcher() const
+    {
+        return dispatcher_mode_ == "affinity";
+    }
+
+    /// gops kept per source for viewers that join, 0 leaves the count to the byte and duration budgets
+    size_t gop_cache_gops() const
+    {
+        return gop_cache_gops_;
+    }
+
+    /// bytes the gop cache of one source may hold, 0 is unlimited
+    uint64_t gop_cache_max_bytes() const
+    {
+        return gop_cache_max_bytes_;
+    }
+
+    /// milliseconds of media the gop cache of one source may span, 0 is unlimited
+    uint32_t gop_cache_max_ms() const
+    {
+        return gop_cache_max_ms_;
+    }
+
+    /// bytes the gop caches of every source may hold together before the oldest gops are evicted, 0 is unlimited
+    uint64_t gop_cache_total_bytes() const
+    {
+        return gop_cache_total_bytes_;
+    }
+
+private:
+    std::string io_mode_{"shared"};
+    size_t io_shards_{0};
+    std::string io_backend_{"asio"};
+
+    uint32_t timer_tick_ms_{10};
+    uint32_t handshake_timeout_ms_{10000};
+    uint32_t publish_idle_timeout_ms_{20000};
+    uint32_t play_idle_timeout_ms_{30000};
+    uint32_t stats_interval_ms_{60000};
+
+    std::string rtmp_socket_profile_{"ingest"};
+    std::string http_socket_profile_{"play"};
+    std::string rtmp_unix_socket_{};
+    std::string shm_ingest_socket_{};
+    uint64_t zerocopy_min_bytes_{0};
+    uint32_t pacing_headroom_percent_{0};
+
+    uint64_t egress_max_rate_{0};
+    uint64_t egress_vhost_max_rate_{0};
+    std::string egress_limits_file_{};
+    uint32_t egress_shed_percent_{0};
+    uint64_t egress_viewer_rate_{256 * 1024};
+
+    std::string tls_cert_file_{};
+    std::string tls_key_file_{};
+    uint16_t rtmps_port_{1936};
+    uint16_t https_port_{443};
+
+    std::string upgrade_socket_{};
+    uint32_t upgrade_drain_ms_{60000};
+
+    uint64_t viewer_max_lag_bytes_{8 * 1024 * 1024};
+    uint32_t viewer_max_lag_ms_{5000};
+    std::string viewer_overflow_policy_{"drop_until_keyframe"};
+
+    std::string dispatcher_mode_{"list"};
+
+    size_t gop_cache_gops_{1};
+    // within the default viewer budget, a viewer that has just joined can still take a whole gop
+    uint64_t gop_cache_max_bytes_{8 * 1024 * 1024};
+    uint32_t gop_cache_max_ms_{5000};
+    uint64_t gop_cache_total_bytes_{512 * 1024 * 1024};
+};
+
+using server_config = singleton<config>;
+
+// read an environment variable, return the default value if it is absent
+std::string env_or(const char *, const std::string &);
+uint64_t env_or(const char *, uint64_t);
+
+} // namespace util
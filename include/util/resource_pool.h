@@ -4,22 +4,33 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 namespace util {
 
+/**
+Recycles objects instead of freeing them, obtain() hands out a shared_ptr whose deleter puts the object back.
+The pool is meant to be used by one thread, e.g. one per session or a thread_local one, but the last reference to an
+object may be dropped on any thread: busy_ is only ever tried, never waited on, whoever finds it taken allocates or
+deletes instead. Objects released after the pool is gone are deleted.
+*/
 template<typename T>
 class resource_pool : public std::enable_shared_from_this<resource_pool<T>>
 {
 public:
     using ptr = std::shared_ptr<resource_pool>;
+    using alloc_func = std::function<T *(void)>;
+    using reset_func = std::function<void(T &)>;
 
     static constexpr size_t kDefaultPoolSize = 64;
 
-    static ptr create(size_t pool_size = kDefaultPoolSize)
+    /// alloc defaults to new T(), reset runs on every recycled object before it is kept for the next obtain()
+    static ptr create(size_t pool_size = kDefaultPoolSize, alloc_func alloc = nullptr, reset_func reset = nullptr)
     {
         pool_size = pool_size ? pool_size : kDefaultPoolSize;
-        return std::shared_ptr<resource_pool<T>>(new resource_pool<T>(pool_size));
+        return std::shared_ptr<resource_pool<T>>(new resource_pool<T>(pool_size, std::move(alloc), std::move(reset)));
     }
 
     ~resource_pool()
@@ -52,42 +63,56 @@ public:
         });
     }
 
+    /// objects allocated because the pool was empty or busy, it stops growing once the pool has warmed up
+    size_t allocations() const
+    {
+        return allocations_.load(std::memory_order_relaxed);
+    }
+
 private:
-    resource_pool(size_t pool_size)
-        : objs_(pool_size)
+    resource_pool(size_t pool_size, alloc_func alloc, reset_func reset)
+        : pool_size_{pool_size}
+        , alloc_{std::move(alloc)}
+        , reset_{std::move(reset)}
     {
-        alloc_ = []() -> T * { return new T(); };
-        for (auto &ptr : objs_)
+        if (!alloc_)
         {
-
-            if (!ptr)
+            if constexpr (std::is_default_constructible_v<T>)
             {
-                ptr = alloc_();
+                alloc_ = []() -> T * { return new T(); };
             }
+            else
+            {
+                throw std::invalid_argument("resource_pool needs an alloc function for a type without a public default constructor");
+            }
+        }
+
+        objs_.reserve(pool_size_);
+        for (size_t i = 0; i < pool_size_; ++i)
+        {
+            objs_.emplace_back(alloc_());
         }
     }
 
     T *get_obj_ptr()
     {
         T *ptr = nullptr;
-        auto is_busy = busy_.test_and_set();
+        auto is_busy = busy_.test_and_set(std::memory_order_acquire);
         // if not busy, then obtain a pointer
         if (!is_busy)
         {
-            if (objs_.size() == 0)
-            {
-                ptr = alloc_();
-            }
-            else
+            if (!objs_.empty())
             {
                 ptr = objs_.back();
                 objs_.pop_back();
             }
 
-            busy_.clear();
+            busy_.clear(std::memory_order_release);
         }
-        else
+
+        if (!ptr)
         {
+            allocations_.fetch_add(1, std::memory_order_relaxed);
             ptr = alloc_();
         }
         return ptr;
@@ -95,39 +120,39 @@ private:
 
     void recycle(T *ptr)
     {
-        auto is_busy = busy_.test_and_set();
-        if (!is_busy)
+        if (!ptr)
         {
-            if (objs_.size() >= pool_size_)
-            {
-                if (ptr)
-                {
-                    delete ptr;
-                    ptr = nullptr;
-                }
-            }
-            else
-            {
-                objs_.emplace_back(ptr);
-            }
+            return;
+        }
 
-            busy_.clear();
+        // reset outside of the flag, it may release what the object holds
+        if (reset_)
+        {
+            reset_(*ptr);
         }
-        else
+
+        auto is_busy = busy_.test_and_set(std::memory_order_acquire);
+        if (!is_busy)
         {
-            if (ptr)
+            if (objs_.size() < pool_size_)
             {
-                delete ptr;
+                objs_.emplace_back(ptr);
                 ptr = nullptr;
             }
+
+            busy_.clear(std::memory_order_release);
         }
+
+        delete ptr;
     }
 
 private:
     size_t pool_size_{0};
     std::vector<T *> objs_;
-    std::function<T *(void)> alloc_;
-    std::atomic_flag busy_{false};
+    alloc_func alloc_;
+    reset_func reset_;
+    std::atomic_flag busy_ = ATOMIC_FLAG_INIT;
+    std::atomic<size_t> allocations_{0};
 };
 
-} // namespace util
\ No newline at end of file
+} // namespace util
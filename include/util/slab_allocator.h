@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace util {
+
+/**
+Size class allocator for buffer storage: packet blocks and the heap memory of flat_buffer.
+Sizes are rounded up to a power of two between kMinClassSize and kMaxClassSize, freed blocks go to a cache of the thread
+that frees them and are handed out again by that thread, no lock is taken on either path. Every thread keeps at most
+kMaxCachedBytes per class, the rest goes back to the heap. Larger sizes always go to the heap.
+Blocks of make_block() usually die on another thread than the one that allocated them, e.g. packets on the viewers' io
+threads. They are returned to the thread that allocated them through a lock free list, which that thread takes over once
+its own cache runs dry.
+*/
+class slab_allocator
+{
+public:
+    static constexpr size_t kMinClassSize = 1024;
+    static constexpr size_t kMaxClassSize = 4 * 1024 * 1024;
+    static constexpr size_t kClassCount = 13;
+    static constexpr size_t kMaxCachedBytes = 4 * 1024 * 1024;
+
+    static_assert(kMinClassSize << (kClassCount - 1) == kMaxClassSize);
+
+    struct class_stats
+    {
+        size_t size{0};
+        // served from the cache of the thread
+        uint64_t hits{0};
+        // served from the heap
+        uint64_t misses{0};
+        // blocks sitting in the caches of all threads
+        uint64_t cached{0};
+        // blocks of make_block() freed on another thread and returned to the one that allocated them
+        uint64_t returned{0};
+    };
+
+    /// at least size bytes, size is updated to the bytes actually usable
+    static char *allocate(size_t &size);
+
+    /// size is what allocate() returned for the block
+    static void deallocate(char *ptr, size_t size);
+
+    /// a block for slices, released into the cache of the thread that allocated it, whichever thread drops the last reference
+    static std::shared_ptr<char[]> make_block(size_t size);
+
+    /// one entry per class, then one with size 0 for the sizes above kMaxClassSize
+    static std::vector<class_stats> get_stats();
+
+    /// the class of size, kClassCount when size is above kMaxClassSize
+    static size_t class_of(size_t size);
+};
+
+} // namespace util
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace util {
+
+/**
+Hierarchical timer wheel driven by a single steady_timer, one per io shard.
+
+  level 0: 64 slots of 1 tick
+  level 1: 64 slots of 64 ticks
+  level 2: 64 slots of 64^2 ticks
+  level 3: 64 slots of 64^3 ticks
+
+A timer is linked into the slot of the lowest level that covers its delay. When a lower level wraps around, the current slot of
+the level above is cascaded down, so scheduling, cancelling and expiring are O(1) and no allocation is made per timer
+once the node pool has grown. Callbacks run on the io_context, outside of the wheel's lock.
+*/
+class timer_wheel : public std::enable_shared_from_this<timer_wheel>
+{
+public:
+    using ptr = std::shared_ptr<timer_wheel>;
+    /// 0 is never a valid id
+    using timer_id = uint64_t;
+    using callback = std::function<void()>;
+
+    static constexpr uint32_t kDefaultTickMs = 10;
+    static constexpr uint32_t kSlotBits = 6;
+    static constexpr uint32_t kSlots = 1 << kSlotBits;
+    static constexpr uint32_t kLevels = 4;
+
+    static ptr create(boost::asio::io_context &, uint32_t tick_ms = kDefaultTickMs);
+
+    ~timer_wheel() = default;
+
+    timer_wheel(const timer_wheel &) = delete;
+    timer_wheel &operator=(const timer_wheel &) = delete;
+
+    /// run cb once after delay_ms, rounded up to whole ticks
+    timer_id schedule(uint64_t delay_ms, callback cb);
+    /// run cb every interval_ms until it is cancelled
+    timer_id schedule_every(uint64_t interval_ms, callback cb);
+    /// false if the timer has already fired or been cancelled
+    bool cancel(timer_id);
+
+    /// coarse monotonic milliseconds, advanced once per tick, cheap enough to be read on every packet
+    uint64_t now_ms() const
+    {
+        return now_ms_;
+    }
+
+    uint32_t tick_ms() const
+    {
+        return tick_ms_;
+    }
+
+    /// number of pending timers
+    size_t size() const;
+
+    void stop();
+
+private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct node
+    {
+        uint64_t expire{0};
+        uint64_t interval{0};
+        uint32_t generation{0};
+        uint32_t prev{kNil};
+        uint32_t next{kNil};
+        // level * kSlots + slot, kNil when the node is free or being fired
+        uint32_t slot{kNil};
+        callback cb;
+    };
+
+    timer_wheel(boost::asio::io_context &, uint32_t tick_ms);
+
+    void wait_tick();
+    void advance(uint64_t target_tick, std::vector<std::pair<timer_id, callback>> &expired);
+    void cascade(uint32_t level);
+
+    timer_id add(uint64_t delay_ms, uint64_t interval_ms, callback cb);
+    uint64_t to_ticks(uint64_t ms) const;
+    /// a node due on the current tick or before goes to the next tick, unless it is cascaded down right before the current
+    /// level 0 slot runs
+    void link(uint32_t index, bool is_cascade = false);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+
+    static timer_id make_id(uint32_t index, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | index;
+    }
+
+private:
+    boost::asio::steady_timer timer_;
+    uint32_t tick_ms_;
+    std::chrono::steady_clock::time_point start_;
+    std::atomic_uint64_t now_ms_{0};
+
+    mutable std::mutex mtx_{};
+    uint64_t current_tick_{0};
+    std::vector<node> nodes_{};
+    uint32_t free_head_{kNil};
+    size_t pending_{0};
+    std::array<uint32_t, kLevels * kSlots> slots_{};
+    bool is_stopped_{false};
+};
+
+} // namespace util
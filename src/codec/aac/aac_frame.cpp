@@ -2,10 +2,10 @@
 
 namespace codec {
 
-aac_frame::aac_frame(network::flat_buffer::ptr buf, uint64_t dts)
+aac_frame::aac_frame(network::slice data, uint64_t dts)
     : frame(codec::Codec_Type::CodecAAC)
 {
-    frame::set_data(std::move(buf));
+    frame::set_data(std::move(data));
     frame::set_dts(dts);
     frame::set_pts(0);
     frame::set_prefix_size(0);
@@ -2,11 +2,11 @@
 
 namespace codec {
 
-void aac_track::parse_config(network::flat_buffer &buf)
+void aac_track::parse_config(const network::slice &buf)
 {
     buf.require_length_or_fail(2);
 
-    cfg_.assign(buf.data(), buf.unread_length());
+    cfg_.assign(buf.data(), buf.size());
 
     uint8_t cfg1 = cfg_[0];
     uint8_t cfg2 = cfg_[1];
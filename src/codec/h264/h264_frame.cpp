@@ -8,10 +8,9 @@ h264_frame::h264_frame()
 
 h264_frame::Nal_Type h264_frame::frame_type() const
 {
-    const auto &ptr = data();
-    ptr->require_length_or_fail(frame::prefix_size());
-    uint8_t *nal_ptr = reinterpret_cast<uint8_t *>(ptr->data()) + frame::prefix_size();
-    return Nal_Type(nal_ptr[0] & 0x1F);
+    const auto &buf = data();
+    buf.require_length_or_fail(frame::prefix_size() + 1);
+    return Nal_Type(buf[frame::prefix_size()] & 0x1F);
 }
 
 bool h264_frame::is_key_frame() const
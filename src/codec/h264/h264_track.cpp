@@ -1,5 +1,6 @@
 #include "codec/h264/h264_track.h"
 #include "SPSParser.h"
+#include "util/util.h"
 
 namespace codec {
 
@@ -30,7 +31,7 @@ void h264_track::extract_bitstream_sps()
 }
 
 // https://www.jianshu.com/p/4f95617f30d0
-void h264_track::parse_config(network::flat_buffer &buf)
+void h264_track::parse_config(const network::slice &buf)
 {
     // byte[0] version
     // byte[1] avc profile
@@ -38,23 +39,23 @@ void h264_track::parse_config(network::flat_buffer &buf)
     // byte[3] avc level
     // byte[4] FF
     // byte[5] E1
-    buf.consume_or_fail(6);
-
     // byte[6] byte[7] sps length
-    auto sps_size = buf.read_uint16();
-    buf.require_length_or_fail(sps_size);
-
-    sps_.assign(buf.data(), sps_size);
-    buf.consume_or_fail(sps_size);
+    size_t offset = 6;
+    buf.require_length_or_fail(offset + 2);
+    size_t sps_size = (buf[offset] << 8) | buf[offset + 1];
+    offset += 2;
+    buf.require_length_or_fail(offset + sps_size);
+    sps_.assign(buf.data() + offset, sps_size);
+    offset += sps_size;
 
     // skip the byte 01
-    buf.consume_or_fail(1);
-
-    auto pps_size = buf.read_uint16();
-    buf.require_length_or_fail(pps_size);
+    offset += 1;
 
-    pps_.assign(buf.data(), pps_size);
-    buf.consume_or_fail(pps_size);
+    buf.require_length_or_fail(offset + 2);
+    size_t pps_size = (buf[offset] << 8) | buf[offset + 1];
+    offset += 2;
+    buf.require_length_or_fail(offset + pps_size);
+    pps_.assign(buf.data() + offset, pps_size);
 
     extract_bitstream_sps();
 
@@ -67,23 +68,22 @@ void h264_track::parse_config(network::flat_buffer &buf)
 
 void h264_track::encapsulate_config_frame(const std::string &config)
 {
-    static_assert(sizeof(kH264HeaderPrefix) == 5);
     if (config.empty())
     {
         return;
     }
 
-    auto config_frame_len = sizeof(kH264HeaderPrefix) - 1 + config.size();
-    auto config_ptr = network::flat_buffer::create(config_frame_len);
-    config_ptr->write(kH264HeaderPrefix, sizeof(kH264HeaderPrefix) - 1);
-    config_ptr->write(config.data(), config.size());
-
-    h264_frame config_frame;
-    config_frame.set_prefix_size(4);
-    config_frame.set_dts(0);
-    config_frame.set_pts(0);
-    config_frame.set_data(config_ptr);
-    track::input_frame(config_frame);
+    // prefixed with its avcc length like the nal units split from rtmp packets
+    std::string config_frame(4, '\0');
+    util::set_be32(config_frame.data(), static_cast<uint32_t>(config.size()));
+    config_frame += config;
+
+    h264_frame frame;
+    frame.set_prefix_size(4);
+    frame.set_dts(0);
+    frame.set_pts(0);
+    frame.set_data(network::slice::copy_of(config_frame));
+    track::input_frame(frame);
 }
 
 } // namespace codec
\ No newline at end of file
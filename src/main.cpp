@@ -1,7 +1,17 @@
+#include "media/bandwidth_governor.h"
+#include "media/dispatch_stats.h"
+#include "media/gop_cache.h"
+#include "network/hot_upgrade.h"
+#include "network/io_pool.h"
 #include "network/tcp_server.h"
 #include "protocol/rtmp/rtmp_session.h"
+#include "protocol/rtmp/rtmp_shm_ingest.h"
 #include "protocol/http/http_session.h"
+#include "util/config.h"
 #include "util/singleton.h"
+#include "util/slab_allocator.h"
+
+#include <unistd.h>
 
 int main()
 {
@@ -9,49 +19,270 @@ int main()
     spdlog::set_level(spdlog::level::debug); // Set global log level to debug
 #endif
 
-    boost::asio::io_context io_context;
-    auto rtmpserver = network::tcp_server::create(io_context, 1935);
-    auto httpserver = network::tcp_server::create(io_context, 80);
+    auto &conf = util::server_config::instance();
+    auto &thread_pool = util::bs_thread_pool::instance();
+    size_t cpus = thread_pool.get_thread_count();
+#ifdef DEBUG
+    cpus = 1;
+#endif
 
-    try
+    // an explicit shard count wins over the debug clamp, every shard occupies one thread of the pool for its whole life
+    if (conf.is_sharded() && conf.io_shards())
     {
-        rtmpserver->start<rtmp::rtmp_session>();
-        httpserver->start<http::http_session>();
+        cpus = conf.io_shards();
+        if (thread_pool.get_thread_count() < cpus)
+        {
+            thread_pool.reset(static_cast<BS::concurrency_t>(cpus));
+        }
     }
-    catch (std::exception &ex)
+
+    auto pool = network::io_pool::create(cpus, conf.is_sharded(), conf.timer_tick_ms());
+    if (conf.is_uring())
     {
-        spdlog::error("Failed to initialize servers, error = {}", ex.what());
-        return EXIT_FAILURE;
+        pool->enable_uring();
     }
 
-    auto &thread_pool = util::bs_thread_pool::instance();
-    auto cpus = thread_pool.get_thread_count();
-#ifdef DEBUG
-    cpus = 1;
-#endif
-    for (auto i = 0; i < cpus; ++i)
+    // one rtmp and one http listener per shard, plus rtmps and https ones when tls is configured, bound with SO_REUSEPORT when sharded
+    std::vector<std::vector<network::server::ptr>> servers(pool->size());
+    std::vector<std::vector<network::tcp_server::ptr>> shard_listeners(pool->size());
+
+    // the listening sockets of the process being upgraded, if any
+    network::upgrade_client::ptr upgrade{nullptr};
+    network::upgrade_listener::ptr upgrade_listener{nullptr};
+    rtmp::shm_ingest_listener::ptr shm_ingest{nullptr};
+
+    auto create_listener = [&pool, &upgrade, &conf](network::io_shard &shard, uint16_t port, const std::string &profile) {
+        int listen_fd = upgrade ? upgrade->take(network::tcp_server::address_of(port)) : -1;
+        auto listener = network::tcp_server::create(shard.context(), port, network::Ip_Type::ipv4, pool->is_sharded(), listen_fd);
+        if (shard.uring())
+        {
+            listener->use_uring(shard.uring());
+        }
+        listener->use_socket_profile(network::socket_profile::from_name(profile));
+        listener->use_zerocopy(conf.zerocopy_min_bytes());
+        listener->use_timers(shard.timers());
+        return listener;
+    };
+
+    // one unix socket shared by the rtmp listeners of every shard, each of them owns a dup() of it
+    int local_fd = -1;
+    auto create_local_listener = [&pool, &upgrade, &conf, &local_fd](network::io_shard &shard) {
+        int listen_fd = upgrade ? upgrade->take(network::tcp_server::address_of(conf.rtmp_unix_socket())) : -1;
+        if (listen_fd < 0)
+        {
+            listen_fd = local_fd >= 0 ? ::dup(local_fd) : network::tcp_server::listen_local(conf.rtmp_unix_socket());
+        }
+        if (local_fd < 0)
+        {
+            local_fd = listen_fd;
+        }
+
+        auto listener = network::tcp_server::create_local(shard.context(), conf.rtmp_unix_socket(), listen_fd, pool->is_sharded());
+        if (shard.uring())
+        {
+            listener->use_uring(shard.uring());
+        }
+        listener->use_timers(shard.timers());
+        return listener;
+    };
+
+    try
     {
-        thread_pool.detach_task([&]() {
-            for (;;)
+        if (!conf.upgrade_socket().empty())
+        {
+            upgrade = network::upgrade_client::connect(conf.upgrade_socket());
+        }
+
+#ifdef ENABLE_OPENSSL
+        network::tls_context::ptr tls{nullptr};
+        if (conf.is_tls())
+        {
+            tls = network::tls_context::create(conf.tls_cert_file(), conf.tls_key_file());
+        }
+#endif
+
+        for (size_t i = 0; i < pool->size(); ++i)
+        {
+            auto &shard = pool->shard(i);
+            std::vector<network::tcp_server::ptr> rtmp_listeners{create_listener(shard, 1935, conf.rtmp_socket_profile())};
+            std::vector<network::tcp_server::ptr> http_listeners{create_listener(shard, 80, conf.http_socket_profile())};
+            if (!conf.rtmp_unix_socket().empty())
+            {
+                rtmp_listeners.emplace_back(create_local_listener(shard));
+            }
+
+#ifdef ENABLE_OPENSSL
+            if (tls)
+            {
+                rtmp_listeners.emplace_back(create_listener(shard, conf.rtmps_port(), conf.rtmp_socket_profile()));
+                rtmp_listeners.back()->use_tls(tls);
+                http_listeners.emplace_back(create_listener(shard, conf.https_port(), conf.http_socket_profile()));
+                http_listeners.back()->use_tls(tls);
+            }
+#endif
+
+            for (auto &listener : rtmp_listeners)
+            {
+                listener->start<rtmp::rtmp_session>();
+                servers[i].emplace_back(listener);
+            }
+
+            for (auto &listener : http_listeners)
+            {
+                listener->start<http::http_session>();
+                servers[i].emplace_back(listener);
+            }
+
+            shard_listeners[i].insert(shard_listeners[i].end(), rtmp_listeners.begin(), rtmp_listeners.end());
+            shard_listeners[i].insert(shard_listeners[i].end(), http_listeners.begin(), http_listeners.end());
+
+            if (conf.stats_interval_ms())
+            {
+                std::vector<std::weak_ptr<network::tcp_server>> listeners(shard_listeners[i].begin(), shard_listeners[i].end());
+                shard.timers()->schedule_every(conf.stats_interval_ms(), [&shard, listeners]() {
+                    spdlog::info("io shard {}: {} timers pending", shard.index(), shard.timers()->size());
+                    for (auto &weak_listener : listeners)
+                    {
+                        if (auto listener = weak_listener.lock())
+                        {
+                            auto stats = listener->sessions()->get_stats();
+                            spdlog::info("io shard {}: {} sessions live = {}, accepted = {}, closed = {}", shard.index(), listener->info(),
+                                stats.live, stats.accepted, stats.closed);
+                        }
+                    }
+                    spdlog::info("io shard {}: rtmp packets allocated = {}", shard.index(), rtmp::rtmp_packet::pool_allocations());
+                    if (shard.uring())
+                    {
+                        auto stats = shard.uring()->get_stats();
+                        spdlog::info("io shard {}: io_uring enter calls = {}, submitted = {}, completed = {}", shard.index(),
+                            stats.enter_calls, stats.submitted, stats.completed);
+                    }
+                });
+            }
+        }
+
+        if (!conf.shm_ingest_socket().empty())
+        {
+            shm_ingest = rtmp::shm_ingest_listener::create(pool->shard(0).context(), conf.shm_ingest_socket());
+        }
+
+        auto &governor = media::egress_governor::instance();
+        if (governor.is_enabled())
+        {
+            auto &shard = pool->shard(0);
+            shard.timers()->schedule_every(media::bandwidth_governor::kUpdateIntervalMs, [&governor]() { governor.update(); });
+            if (conf.stats_interval_ms())
             {
-                try
+                shard.timers()->schedule_every(conf.stats_interval_ms(), [&governor]() {
+                    auto stats = governor.get_stats();
+                    spdlog::info("egress rate = {} bytes/s, viewers = {}, admitted = {}, rejected = {}, shed = {}", stats.total_rate,
+                        stats.viewers, stats.admitted, stats.rejected, stats.shed);
+                });
+            }
+        }
+
+        if (conf.stats_interval_ms())
+        {
+            pool->shard(0).timers()->schedule_every(conf.stats_interval_ms(), []() {
+                auto gops = media::gop_registry::instance().get_stats();
+                spdlog::info("gop caches = {}, bytes = {}, limit = {}, evicted gops = {}", gops.caches, gops.bytes, gops.limit,
+                    gops.evicted_gops);
+
+                auto dispatch = media::dispatch_stats::get_stats();
+                if (dispatch.calls)
                 {
-                    io_context.run();
-                    break;
+                    spdlog::info("distribute: calls = {}, avg = {} ns, max = {} ns", dispatch.calls, dispatch.total_ns / dispatch.calls,
+                        dispatch.max_ns);
                 }
-                catch (std::exception &ex)
+
+                for (auto &stats : util::slab_allocator::get_stats())
                 {
-                    spdlog::error("io_context received exception, error = {}", ex.what());
-                    rtmpserver->restart();
-                    httpserver->restart();
+                    if (stats.hits || stats.misses)
+                    {
+                        spdlog::info("slab class {}: hits = {}, misses = {}, cached = {}, returned = {}",
+                            stats.size ? std::to_string(stats.size) : "oversize", stats.hits, stats.misses, stats.cached, stats.returned);
+                    }
                 }
+            });
+        }
+
+        // connections queued on the shared sockets wait for the io threads, the old process can stop accepting now
+        if (upgrade)
+        {
+            if (upgrade->size())
+            {
+                spdlog::warn("{} listeners of the old process are not used and will be closed, keep the io mode and shards across upgrades",
+                    upgrade->size());
             }
-        });
+            upgrade->ready();
+            upgrade.reset();
+        }
+
+        if (!conf.upgrade_socket().empty())
+        {
+            auto &shard = pool->shard(0);
+            auto get_listeners = [&shard_listeners]() {
+                std::vector<std::pair<std::string, int>> listeners;
+                for (auto &listeners_of_shard : shard_listeners)
+                {
+                    for (auto &listener : listeners_of_shard)
+                    {
+                        listeners.emplace_back(listener->address(), listener->listen_fd());
+                    }
+                }
+                return listeners;
+            };
+
+            // hand the listeners over, stop accepting and exit once the sessions are gone or the drain time is up
+            auto on_ready = [&conf, &pool, &shard, &shard_listeners]() {
+                for (size_t i = 0; i < pool->size(); ++i)
+                {
+                    boost::asio::post(pool->shard(i).context(), [&shard_listeners, i]() {
+                        for (auto &listener : shard_listeners[i])
+                        {
+                            listener->stop_accepting();
+                        }
+                    });
+                }
+
+                auto deadline = shard.timers()->now_ms() + conf.upgrade_drain_ms();
+                shard.timers()->schedule_every(1000, [&pool, &shard, &shard_listeners, deadline]() {
+                    size_t live = 0;
+                    for (auto &listeners_of_shard : shard_listeners)
+                    {
+                        for (auto &listener : listeners_of_shard)
+                        {
+                            live += listener->sessions()->size();
+                        }
+                    }
+
+                    if (live && shard.timers()->now_ms() < deadline)
+                    {
+                        return;
+                    }
+
+                    spdlog::info("upgrade drained, {} sessions left, exit", live);
+                    pool->stop();
+                });
+            };
+
+            upgrade_listener = network::upgrade_listener::create(shard.context(), conf.upgrade_socket(), get_listeners, on_ready);
+        }
+    }
+    catch (std::exception &ex)
+    {
+        spdlog::error("Failed to initialize servers, error = {}", ex.what());
+        return EXIT_FAILURE;
     }
 
-    thread_pool.wait();
+    pool->run([&servers](network::io_shard &shard, const std::exception &) {
+        for (auto &server_ptr : servers[shard.index()])
+        {
+            server_ptr->restart();
+        }
+    });
 
     spdlog::info("io_context exited normally");
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,350 @@
+#include "bandwidth_governor.h"
+
+#include "util/config.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace media {
+
+// egress_limits
+egress_limits egress_limits::parse(const std::string &text)
+{
+    egress_limits limits;
+    std::istringstream lines(text);
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(lines, line))
+    {
+        ++line_no;
+        auto comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key))
+        {
+            continue;
+        }
+
+        std::string vhost;
+        if (key == "vhost" && !(fields >> vhost))
+        {
+            throw std::runtime_error(fmt::format("egress limits line {} has no vhost", line_no));
+        }
+
+        uint64_t rate = 0;
+        std::string rest;
+        if (!(fields >> rate) || (fields >> rest))
+        {
+            throw std::runtime_error(fmt::format("egress limits line {} is not \"{} <bytes per second>\"", line_no, key));
+        }
+
+        if (key == "total")
+        {
+            limits.total = rate;
+        }
+        else if (key == "per_vhost")
+        {
+            limits.per_vhost = rate;
+        }
+        else if (key == "vhost")
+        {
+            limits.vhosts[vhost] = rate;
+        }
+        else
+        {
+            throw std::runtime_error(fmt::format("egress limits line {} has unknown key {}", line_no, key));
+        }
+    }
+    return limits;
+}
+
+// bandwidth_governor
+bandwidth_governor::bandwidth_governor()
+{
+    auto &conf = util::server_config::instance();
+    limits_.total = conf.egress_max_rate();
+    limits_.per_vhost = conf.egress_vhost_max_rate();
+    limits_file_ = conf.egress_limits_file();
+    shed_percent_ = conf.egress_shed_percent();
+    viewer_rate_ = conf.egress_viewer_rate();
+    reload_limits_file();
+}
+
+bool bandwidth_governor::is_enabled() const
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return limits_.total || limits_.per_vhost || !limits_.vhosts.empty() || !limits_file_.empty();
+}
+
+bool bandwidth_governor::admit(const std::string &vhost, uint64_t stream_rate)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    // vhosts are only tracked while update() runs to prune them
+    if (!limits_.total && !limits_.per_vhost && limits_.vhosts.empty() && limits_file_.empty())
+    {
+        return true;
+    }
+
+    auto &entry = vhosts_[vhost];
+    auto expected = expected_rate(entry, stream_rate);
+
+    auto limit = limit_of(vhost);
+    bool is_total_full = limits_.total && total_rate_ + total_reserved_ + expected > limits_.total;
+    bool is_vhost_full = limit && entry.rate + entry.reserved + expected > limit;
+    if (is_total_full || is_vhost_full)
+    {
+        ++stats_.rejected;
+        spdlog::warn("egress is full, reject a new viewer of {}, vhost rate = {} / {} bytes/s, total rate = {} / {} bytes/s", vhost,
+            entry.rate, limit, total_rate_, limits_.total);
+        return false;
+    }
+
+    ++stats_.admitted;
+    entry.reserved += expected;
+    total_reserved_ += expected;
+    return true;
+}
+
+void bandwidth_governor::add_viewer(const std::string &vhost, const std::shared_ptr<network::session> &sess)
+{
+    if (!sess)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    vhosts_[vhost].viewers.push_back({sess, sess->serial(), sess->bytes_sent(), 0});
+}
+
+void bandwidth_governor::update()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    reload_limits_file();
+
+    auto elapsed = std::max<uint64_t>(ticker_.elapsed_time(), 1);
+    ticker_.reset_time();
+
+    total_rate_ = 0;
+    total_reserved_ = 0;
+    stats_.viewers = 0;
+    for (auto it = vhosts_.begin(); it != vhosts_.end();)
+    {
+        auto &entry = it->second;
+        entry.rate = 0;
+        entry.reserved = 0;
+        for (auto viewer_it = entry.viewers.begin(); viewer_it != entry.viewers.end();)
+        {
+            auto strong_session = viewer_it->weak_session.lock();
+            if (!strong_session)
+            {
+                viewer_it = entry.viewers.erase(viewer_it);
+                continue;
+            }
+
+            auto bytes_sent = strong_session->bytes_sent();
+            viewer_it->rate = (bytes_sent - viewer_it->last_bytes_sent) * 1000 / elapsed;
+            viewer_it->last_bytes_sent = bytes_sent;
+            entry.rate += viewer_it->rate;
+            ++viewer_it;
+        }
+
+        if (entry.viewers.empty())
+        {
+            it = vhosts_.erase(it);
+            continue;
+        }
+
+        total_rate_ += entry.rate;
+        stats_.viewers += entry.viewers.size();
+        ++it;
+    }
+    stats_.total_rate = total_rate_;
+
+    if (!shed_percent_)
+    {
+        return;
+    }
+
+    for (auto &[vhost, entry] : vhosts_)
+    {
+        shed(entry, limit_of(vhost));
+    }
+
+    // the server is over its limit even though each vhost may be within its own, shed across all of them
+    if (limits_.total && total_rate_ > limits_.total + limits_.total * shed_percent_ / 100)
+    {
+        std::vector<std::pair<uint64_t, vhost_entry *>> newest;
+        for (auto &[vhost, entry] : vhosts_)
+        {
+            for (auto &v : entry.viewers)
+            {
+                newest.emplace_back(v.serial, &entry);
+            }
+        }
+        std::sort(newest.begin(), newest.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+        for (auto &[serial, entry] : newest)
+        {
+            if (total_rate_ <= limits_.total)
+            {
+                break;
+            }
+
+            auto viewer_it = std::find_if(entry->viewers.begin(), entry->viewers.end(), [serial = serial](const viewer &v) {
+                return v.serial == serial;
+            });
+            if (viewer_it == entry->viewers.end())
+            {
+                continue;
+            }
+
+            if (auto strong_session = viewer_it->weak_session.lock())
+            {
+                spdlog::warn("{} is closed to bring egress back under {} bytes/s", strong_session->id(), limits_.total);
+                strong_session->post_shutdown();
+            }
+            total_rate_ -= std::min(total_rate_, viewer_it->rate);
+            entry->rate -= std::min(entry->rate, viewer_it->rate);
+            entry->viewers.erase(viewer_it);
+            ++stats_.shed;
+        }
+    }
+}
+
+void bandwidth_governor::shed(vhost_entry &entry, uint64_t limit)
+{
+    if (!limit || entry.rate <= limit + limit * shed_percent_ / 100)
+    {
+        return;
+    }
+
+    std::sort(entry.viewers.begin(), entry.viewers.end(), [](const viewer &a, const viewer &b) { return a.serial > b.serial; });
+    while (entry.rate > limit && !entry.viewers.empty())
+    {
+        auto &newest = entry.viewers.front();
+        if (auto strong_session = newest.weak_session.lock())
+        {
+            spdlog::warn("{} is closed to bring egress back under {} bytes/s", strong_session->id(), limit);
+            strong_session->post_shutdown();
+        }
+
+        entry.rate -= std::min(entry.rate, newest.rate);
+        total_rate_ -= std::min(total_rate_, newest.rate);
+        entry.viewers.erase(entry.viewers.begin());
+        ++stats_.shed;
+    }
+}
+
+void bandwidth_governor::set_limits(egress_limits limits)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    limits_ = std::move(limits);
+}
+
+egress_limits bandwidth_governor::limits() const
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return limits_;
+}
+
+uint64_t bandwidth_governor::vhost_rate(const std::string &vhost) const
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = vhosts_.find(vhost);
+    return it == vhosts_.end() ? 0 : it->second.rate;
+}
+
+std::vector<std::weak_ptr<network::session>> bandwidth_governor::rank(const std::string &vhost) const
+{
+    std::vector<std::pair<uint64_t, std::weak_ptr<network::session>>> viewers;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = vhosts_.find(vhost);
+        if (it == vhosts_.end())
+        {
+            return {};
+        }
+
+        for (auto &v : it->second.viewers)
+        {
+            if (!v.weak_session.expired())
+            {
+                viewers.emplace_back(v.serial, v.weak_session);
+            }
+        }
+    }
+
+    std::sort(viewers.begin(), viewers.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<std::weak_ptr<network::session>> ranked;
+    ranked.reserve(viewers.size());
+    for (auto &pr : viewers)
+    {
+        ranked.emplace_back(std::move(pr.second));
+    }
+    return ranked;
+}
+
+egress_stats bandwidth_governor::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+}
+
+uint64_t bandwidth_governor::limit_of(const std::string &vhost) const
+{
+    auto it = limits_.vhosts.find(vhost);
+    return it == limits_.vhosts.end() ? limits_.per_vhost : it->second;
+}
+
+uint64_t bandwidth_governor::expected_rate(const vhost_entry &entry, uint64_t stream_rate) const
+{
+    // viewers that have not been sampled yet count as 0 in the averages below
+    uint64_t floor = stream_rate ? stream_rate : viewer_rate_;
+    if (!entry.viewers.empty())
+    {
+        return std::max(floor, entry.rate / entry.viewers.size());
+    }
+
+    // the first viewer of a vhost is expected to cost as much as an average viewer of the server
+    return std::max(floor, stats_.viewers ? total_rate_ / stats_.viewers : 0);
+}
+
+void bandwidth_governor::reload_limits_file()
+{
+    if (limits_file_.empty())
+    {
+        return;
+    }
+
+    struct stat st;
+    if (::stat(limits_file_.c_str(), &st) < 0 || st.st_mtime == limits_file_mtime_)
+    {
+        return;
+    }
+    limits_file_mtime_ = st.st_mtime;
+
+    std::ifstream file(limits_file_);
+    std::stringstream text;
+    text << file.rdbuf();
+    try
+    {
+        limits_ = egress_limits::parse(text.str());
+        spdlog::info("egress limits loaded from {}, total = {}, per vhost = {}, {} vhosts with their own limit", limits_file_, limits_.total,
+            limits_.per_vhost, limits_.vhosts.size());
+    }
+    catch (const std::exception &ex)
+    {
+        spdlog::error("keep the current egress limits, {} is invalid, error = {}", limits_file_, ex.what());
+    }
+}
+
+} // namespace media
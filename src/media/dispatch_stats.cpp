@@ -0,0 +1,35 @@
+#include "dispatch_stats.h"
+
+#include <atomic>
+
+namespace media {
+
+namespace {
+
+std::atomic<uint64_t> calls_{0};
+std::atomic<uint64_t> total_ns_{0};
+std::atomic<uint64_t> max_ns_{0};
+
+} // namespace
+
+void dispatch_stats::record(uint64_t elapsed_ns)
+{
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(elapsed_ns, std::memory_order_relaxed);
+
+    auto max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (elapsed_ns > max_ns && !max_ns_.compare_exchange_weak(max_ns, elapsed_ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+dispatch_stats::snapshot dispatch_stats::get_stats()
+{
+    snapshot stats;
+    stats.calls = calls_.exchange(0, std::memory_order_relaxed);
+    stats.total_ns = total_ns_.exchange(0, std::memory_order_relaxed);
+    stats.max_ns = max_ns_.exchange(0, std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace media
@@ -0,0 +1,112 @@
+#include "gop_cache.h"
+
+#include "util/config.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace media {
+
+gop_budget gop_budget::from_config()
+{
+    auto &conf = util::server_config::instance();
+    gop_budget budget;
+    budget.max_gops = conf.gop_cache_gops();
+    budget.max_bytes = conf.gop_cache_max_bytes();
+    budget.max_duration_ms = conf.gop_cache_max_ms();
+    return budget;
+}
+
+gop_cache_registry::gop_cache_registry()
+    : limit_{util::server_config::instance().gop_cache_total_bytes()}
+{}
+
+void gop_cache_registry::add(std::weak_ptr<gop_cache_base> weak_cache)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    caches_.erase(std::remove_if(caches_.begin(), caches_.end(), [](const auto &weak) { return weak.expired(); }), caches_.end());
+    caches_.emplace_back(std::move(weak_cache));
+}
+
+void gop_cache_registry::set_limit(uint64_t limit)
+{
+    limit_ = limit;
+    enforce();
+}
+
+void gop_cache_registry::grow(uint64_t bytes)
+{
+    auto total = bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto limit = limit_.load(std::memory_order_relaxed);
+    if (limit && total > limit)
+    {
+        enforce();
+    }
+}
+
+void gop_cache_registry::shrink(uint64_t bytes)
+{
+    bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+gop_cache_stats gop_cache_registry::get_stats() const
+{
+    gop_cache_stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats.caches = static_cast<size_t>(
+            std::count_if(caches_.begin(), caches_.end(), [](const auto &weak) { return !weak.expired(); }));
+    }
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.limit = limit_.load(std::memory_order_relaxed);
+    stats.evicted_gops = evicted_gops_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void gop_cache_registry::enforce()
+{
+    // one publisher evicts for all of them, the others keep publishing
+    std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
+
+    auto limit = limit_.load(std::memory_order_relaxed);
+    if (!limit || bytes_.load(std::memory_order_relaxed) <= limit)
+    {
+        is_saturated_ = false;
+        return;
+    }
+
+    // the largest caches give up their oldest gops first
+    std::vector<std::pair<uint64_t, std::shared_ptr<gop_cache_base>>> caches;
+    for (auto &weak : caches_)
+    {
+        if (auto cache = weak.lock())
+        {
+            caches.emplace_back(cache->bytes(), std::move(cache));
+        }
+    }
+    std::sort(caches.begin(), caches.end(), [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+
+    for (auto &pr : caches)
+    {
+        while (bytes_.load(std::memory_order_relaxed) > limit && pr.second->evict_oldest_gop())
+        {
+            evicted_gops_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    auto bytes = bytes_.load(std::memory_order_relaxed);
+    if (bytes > limit && !is_saturated_)
+    {
+        spdlog::warn("gop caches hold {} bytes, above the limit of {}, only the gops being filled are left", bytes, limit);
+    }
+    is_saturated_ = bytes > limit;
+}
+
+} // namespace media
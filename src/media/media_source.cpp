@@ -163,4 +163,25 @@ int media_source::get_bytes_speed(codec::Track_Type type)
     return speed_[magic_enum::enum_integer(type)].get_speed();
 }
 
+uint64_t media_source::get_total_bytes_speed() const
+{
+    return total_bytes_speed_.load(std::memory_order_relaxed);
+}
+
+void media_source::update_total_bytes_speed()
+{
+    if (speed_ticker_.elapsed_time() < kSpeedUpdateIntervalMs)
+    {
+        return;
+    }
+    speed_ticker_.reset_time();
+
+    uint64_t total = 0;
+    for (auto &speed : speed_)
+    {
+        total += static_cast<uint64_t>(speed.get_speed());
+    }
+    total_bytes_speed_.store(total, std::memory_order_relaxed);
+}
+
 } // namespace media
\ No newline at end of file
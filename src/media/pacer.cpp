@@ -0,0 +1,56 @@
+#include "pacer.h"
+
+#include "util/config.h"
+
+#include <algorithm>
+
+namespace media {
+
+pacer::pacer(uint32_t headroom_percent)
+    : headroom_percent_{headroom_percent}
+{}
+
+pacer::pacer()
+    : pacer(util::server_config::instance().pacing_headroom_percent())
+{}
+
+bool pacer::is_due()
+{
+    if (!is_enabled())
+    {
+        return false;
+    }
+
+    if (!is_first_ && ticker_.elapsed_time() < kUpdateIntervalMs)
+    {
+        return false;
+    }
+
+    is_first_ = false;
+    ticker_.reset_time();
+    return true;
+}
+
+void pacer::update(network::session &sess, uint64_t stream_rate)
+{
+    stats_.stream_rate = stream_rate;
+    if (!stream_rate)
+    {
+        return;
+    }
+
+    auto rate = std::max(stream_rate * headroom_percent_ / 100, kMinRate);
+    auto diff = rate > stats_.rate ? rate - stats_.rate : stats_.rate - rate;
+    if (stats_.rate && diff <= stats_.rate / 8)
+    {
+        return;
+    }
+
+    if (sess.set_pacing_rate(rate))
+    {
+        stats_.rate = rate;
+        ++stats_.updates;
+    }
+}
+
+} // namespace media
@@ -0,0 +1,127 @@
+#include "send_budget.h"
+
+#include "util/config.h"
+
+namespace media {
+
+Overflow_Policy policy_from_string(const std::string &policy)
+{
+    if (policy == "drop_non_reference")
+    {
+        return Overflow_Policy::drop_non_reference;
+    }
+
+    if (policy == "disconnect")
+    {
+        return Overflow_Policy::disconnect;
+    }
+
+    return Overflow_Policy::drop_until_keyframe;
+}
+
+send_budget::send_budget(uint64_t max_bytes, uint32_t max_ms, Overflow_Policy policy)
+    : max_bytes_{max_bytes}
+    , max_ms_{max_ms}
+    , policy_{policy}
+{}
+
+send_budget::send_budget()
+    : send_budget(util::server_config::instance().viewer_max_lag_bytes(), util::server_config::instance().viewer_max_lag_ms(),
+          policy_from_string(util::server_config::instance().viewer_overflow_policy()))
+{}
+
+send_budget::Verdict send_budget::admit(uint64_t bytes_sent, uint64_t bytes_queued, uint32_t time_stamp, size_t size, bool is_video,
+    bool is_keyframe, bool is_non_reference)
+{
+    update_lag(bytes_sent, bytes_queued, time_stamp);
+
+    // after an overflow nothing is sent until the viewer has caught up, then audio resumes right away and video on the next
+    // keyframe, a source without video never sends one
+    if (is_dropping_)
+    {
+        if (is_over(1) || (is_video && !is_keyframe))
+        {
+            return drop(size);
+        }
+
+        if (is_video)
+        {
+            is_dropping_ = false;
+        }
+    }
+
+    if (!is_over(1))
+    {
+        is_over_ = false;
+        return Verdict::send;
+    }
+
+    if (!is_over_)
+    {
+        is_over_ = true;
+        ++stats_.overflows;
+    }
+
+    switch (policy_)
+    {
+    case Overflow_Policy::disconnect:
+        return Verdict::disconnect;
+
+    case Overflow_Policy::drop_non_reference:
+        if (is_over(2))
+        {
+            is_dropping_ = true;
+            return drop(size);
+        }
+        return is_video && is_non_reference ? drop(size) : Verdict::send;
+
+    case Overflow_Policy::drop_until_keyframe:
+    default:
+        is_dropping_ = true;
+        return drop(size);
+    }
+}
+
+void send_budget::on_queued(uint64_t stream_offset, uint32_t time_stamp)
+{
+    ++stats_.sent_packets;
+    in_flight_.emplace_back(stream_offset, time_stamp);
+}
+
+void send_budget::skip_until(uint64_t stream_offset)
+{
+    skipped_offset_ = stream_offset;
+}
+
+void send_budget::update_lag(uint64_t bytes_sent, uint64_t bytes_queued, uint32_t time_stamp)
+{
+    while (!in_flight_.empty() && in_flight_.front().first <= bytes_sent)
+    {
+        in_flight_.pop_front();
+    }
+
+    auto skipped = skipped_offset_ > bytes_sent ? skipped_offset_ - bytes_sent : 0;
+    stats_.lag_bytes = bytes_queued > skipped ? bytes_queued - skipped : 0;
+    if (in_flight_.empty() || time_stamp < in_flight_.front().second)
+    {
+        stats_.lag_ms = 0;
+    }
+    else
+    {
+        stats_.lag_ms = time_stamp - in_flight_.front().second;
+    }
+}
+
+bool send_budget::is_over(uint64_t scale) const
+{
+    return (max_bytes_ && stats_.lag_bytes > max_bytes_ * scale) || (max_ms_ && stats_.lag_ms > max_ms_ * scale);
+}
+
+send_budget::Verdict send_budget::drop(size_t size)
+{
+    ++stats_.dropped_packets;
+    stats_.dropped_bytes += size;
+    return Verdict::drop;
+}
+
+} // namespace media
@@ -0,0 +1,327 @@
+#include "hot_upgrade.h"
+
+#include <spdlog/spdlog.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace network {
+
+namespace {
+
+constexpr char kListenerTag = 'L';
+constexpr char kEndTag = 'E';
+constexpr char kReadyTag = 'R';
+
+// a running process that accepted the upgrade connection but hangs must not keep the new one from starting
+constexpr time_t kChannelTimeoutSec = 5;
+
+// "unix:" and the longest unix socket path
+constexpr size_t kMaxAddressLength = 5 + sizeof(sockaddr_un::sun_path);
+
+// tag, nul terminated listener address and at most one fd per message
+struct handoff_message
+{
+    char tag;
+    char address[kMaxAddressLength + 1];
+};
+
+handoff_message make_message(char tag, const std::string &address = {})
+{
+    handoff_message msg{};
+    msg.tag = tag;
+    std::memcpy(msg.address, address.data(), std::min(address.size(), kMaxAddressLength));
+    return msg;
+}
+
+bool send_message(int channel, const handoff_message &msg, int fd)
+{
+    iovec iov{const_cast<handoff_message *>(&msg), sizeof(msg)};
+    msghdr hdr{};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    if (fd >= 0)
+    {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        auto *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return ::sendmsg(channel, &hdr, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(msg));
+}
+
+bool receive_message(int channel, handoff_message &msg, int &fd)
+{
+    iovec iov{&msg, sizeof(msg)};
+    msghdr hdr{};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    fd = -1;
+    if (::recvmsg(channel, &hdr, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(msg)))
+    {
+        return false;
+    }
+
+    for (auto *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+// upgrade_listener
+upgrade_listener::ptr upgrade_listener::create(
+    boost::asio::io_context &io_context, const std::string &path, listeners_getter get_listeners, std::function<void()> on_ready)
+{
+    auto listener = std::shared_ptr<upgrade_listener>(new upgrade_listener(io_context, path, std::move(get_listeners), std::move(on_ready)));
+    listener->do_accept();
+    return listener;
+}
+
+upgrade_listener::upgrade_listener(
+    boost::asio::io_context &io_context, const std::string &path, listeners_getter get_listeners, std::function<void()> on_ready)
+    : acceptor_{io_context}
+    , path_{path}
+    , get_listeners_{std::move(get_listeners)}
+    , on_ready_{std::move(on_ready)}
+{
+    // the previous process keeps its own socket open until it has drained, only the path is taken over
+    ::unlink(path_.c_str());
+
+    boost::asio::local::stream_protocol::endpoint endpoint(path_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+
+    spdlog::info("upgrade listener is waiting on {}", path_);
+}
+
+upgrade_listener::~upgrade_listener()
+{
+    close();
+}
+
+void upgrade_listener::close()
+{
+    if (acceptor_.is_open())
+    {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+    }
+}
+
+void upgrade_listener::do_accept()
+{
+    std::weak_ptr<upgrade_listener> weak_self = shared_from_this();
+    acceptor_.async_accept([this, weak_self](boost::system::error_code ec, boost::asio::local::stream_protocol::socket sock) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self || !acceptor_.is_open())
+        {
+            return;
+        }
+
+        if (ec)
+        {
+            spdlog::error("upgrade listener received error {}, msg = {}", ec.value(), ec.message());
+        }
+        else
+        {
+            hand_over(std::move(sock));
+        }
+
+        do_accept();
+    });
+}
+
+void upgrade_listener::hand_over(boost::asio::local::stream_protocol::socket sock)
+{
+    auto channel = sock.native_handle();
+    auto listeners = get_listeners_();
+    for (auto &[address, fd] : listeners)
+    {
+        if (!send_message(channel, make_message(kListenerTag, address), fd))
+        {
+            spdlog::error("cannot hand listener {} over, error = {}", address, std::strerror(errno));
+            return;
+        }
+    }
+
+    if (!send_message(channel, make_message(kEndTag), -1))
+    {
+        spdlog::error("cannot finish the listener handover, error = {}", std::strerror(errno));
+        return;
+    }
+
+    spdlog::info("handed {} listeners over, waiting for the new process to accept", listeners.size());
+
+    // the socket is kept by the handler until the new process answers or goes away
+    auto channel_ptr = std::make_shared<boost::asio::local::stream_protocol::socket>(std::move(sock));
+    auto reply = std::make_shared<handoff_message>();
+    std::weak_ptr<upgrade_listener> weak_self = shared_from_this();
+    boost::asio::async_read(*channel_ptr, boost::asio::buffer(reply.get(), sizeof(handoff_message)),
+        [this, weak_self, channel_ptr, reply](boost::system::error_code ec, size_t) {
+            auto strong_self = weak_self.lock();
+            if (!strong_self)
+            {
+                return;
+            }
+
+            if (ec || reply->tag != kReadyTag)
+            {
+                spdlog::warn("the new process gave up the upgrade, keep serving");
+                return;
+            }
+
+            spdlog::info("the new process is accepting, stop accepting and drain");
+            close();
+            if (on_ready_)
+            {
+                on_ready_();
+            }
+        });
+}
+
+// upgrade_client
+upgrade_client::ptr upgrade_client::connect(const std::string &path)
+{
+    int channel = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (channel < 0)
+    {
+        throw std::runtime_error(fmt::format("cannot create upgrade socket, error = {}", std::strerror(errno)));
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        ::close(channel);
+        throw std::runtime_error(fmt::format("upgrade socket path {} is too long", path));
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    // bounds connect, every message of the handover and ready()
+    timeval timeout{kChannelTimeoutSec, 0};
+    if (::setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        ::setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+    {
+        ::close(channel);
+        throw std::runtime_error(fmt::format("cannot set the timeouts of the upgrade socket, error = {}", std::strerror(errno)));
+    }
+
+    // nobody listening is a fresh start, not an error
+    if (::connect(channel, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        ::close(channel);
+        return nullptr;
+    }
+
+    auto client = std::shared_ptr<upgrade_client>(new upgrade_client(channel));
+    try
+    {
+        client->receive();
+    }
+    catch (const std::exception &ex)
+    {
+        // the sockets received so far are closed with the client
+        spdlog::error("cannot take the listeners of the running process on {}, start fresh, error = {}", path, ex.what());
+        return nullptr;
+    }
+
+    spdlog::info("received {} listeners from the running process on {}", client->size(), path);
+    return client;
+}
+
+upgrade_client::upgrade_client(int channel)
+    : channel_{channel}
+{}
+
+upgrade_client::~upgrade_client()
+{
+    for (auto &[address, fd] : listeners_)
+    {
+        ::close(fd);
+    }
+
+    if (channel_ >= 0)
+    {
+        ::close(channel_);
+    }
+}
+
+void upgrade_client::receive()
+{
+    while (true)
+    {
+        handoff_message msg{};
+        int fd = -1;
+        if (!receive_message(channel_, msg, fd))
+        {
+            throw std::runtime_error(fmt::format("listener handover broke off, error = {}", std::strerror(errno)));
+        }
+
+        if (msg.tag == kEndTag)
+        {
+            return;
+        }
+
+        if (msg.tag == kListenerTag && fd >= 0)
+        {
+            msg.address[kMaxAddressLength] = '\0';
+            listeners_.emplace(msg.address, fd);
+        }
+    }
+}
+
+int upgrade_client::take(const std::string &address)
+{
+    auto it = listeners_.find(address);
+    if (it == listeners_.end())
+    {
+        return -1;
+    }
+
+    int fd = it->second;
+    listeners_.erase(it);
+    return fd;
+}
+
+void upgrade_client::ready()
+{
+    if (channel_ < 0)
+    {
+        return;
+    }
+
+    if (!send_message(channel_, make_message(kReadyTag), -1))
+    {
+        spdlog::error("cannot tell the old process to stop accepting, error = {}", std::strerror(errno));
+    }
+
+    ::close(channel_);
+    channel_ = -1;
+}
+
+} // namespace network
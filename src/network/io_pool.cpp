@@ -0,0 +1,119 @@
+#include "io_pool.h"
+
+#include "util/singleton.h"
+
+#include <spdlog/spdlog.h>
+
+namespace network {
+
+static thread_local io_shard *current_shard_{nullptr};
+
+io_shard *io_shard::current()
+{
+    return current_shard_;
+}
+
+io_pool::ptr io_pool::create(size_t thread_count, bool is_sharded, uint32_t timer_tick_ms)
+{
+    return std::shared_ptr<io_pool>(new io_pool(thread_count, is_sharded, timer_tick_ms));
+}
+
+io_pool::io_pool(size_t thread_count, bool is_sharded, uint32_t timer_tick_ms)
+    : is_sharded_{is_sharded}
+{
+    if (!thread_count)
+    {
+        thread_count = 1;
+    }
+
+    if (is_sharded_)
+    {
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            shards_.emplace_back(std::make_shared<io_shard>(i, 1));
+        }
+    }
+    else
+    {
+        shards_.emplace_back(std::make_shared<io_shard>(0, thread_count));
+    }
+
+    for (auto &shard_ptr : shards_)
+    {
+        shard_ptr->timers_ = util::timer_wheel::create(shard_ptr->context(), timer_tick_ms);
+    }
+
+    spdlog::info("io pool created, mode = {}, shards = {}, threads = {}", is_sharded_ ? "sharded" : "shared", shards_.size(), thread_count);
+}
+
+bool io_pool::enable_uring()
+{
+    if (!uring_loop::is_supported())
+    {
+        spdlog::warn("io_uring backend is not supported by this kernel, fall back to asio");
+        return false;
+    }
+
+    // completions of a loop are reaped on whichever thread runs the shard, sessions rely on that being a single thread
+    for (auto &shard_ptr : shards_)
+    {
+        if (!shard_ptr->is_pinned())
+        {
+            spdlog::warn("io_uring backend needs one thread per shard, use sharded io mode, fall back to asio");
+            return false;
+        }
+    }
+
+    for (auto &shard_ptr : shards_)
+    {
+        shard_ptr->uring_ = uring_loop::create(shard_ptr->context());
+    }
+
+    spdlog::info("io_uring backend enabled on {} shards", shards_.size());
+    return true;
+}
+
+void io_pool::run(const std::function<void(io_shard &, const std::exception &)> &on_exception)
+{
+    auto &thread_pool = util::bs_thread_pool::instance();
+
+    for (auto &shard_ptr : shards_)
+    {
+        for (size_t i = 0; i < shard_ptr->thread_count(); ++i)
+        {
+            thread_pool.detach_task([shard = shard_ptr.get(), &on_exception]() {
+                current_shard_ = shard;
+                for (;;)
+                {
+                    try
+                    {
+                        shard->context().run();
+                        break;
+                    }
+                    catch (std::exception &ex)
+                    {
+                        spdlog::error("io_context of shard {} received exception, error = {}", shard->index(), ex.what());
+                        if (on_exception)
+                        {
+                            on_exception(*shard, ex);
+                        }
+                    }
+                }
+                current_shard_ = nullptr;
+            });
+        }
+    }
+
+    thread_pool.wait();
+}
+
+void io_pool::stop()
+{
+    for (auto &shard_ptr : shards_)
+    {
+        shard_ptr->timers()->stop();
+        shard_ptr->context().stop();
+    }
+}
+
+} // namespace network
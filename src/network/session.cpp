@@ -1,5 +1,16 @@
 #include "session.h"
 
+#include "util/magic_enum.hpp"
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
 namespace network {
 
 // session
@@ -7,9 +18,10 @@ session::session(SESSION_CONSTRUCTOR_PARAMS)
     : socket_{std::move(sock)}
     , session_prefix_{session_prefix}
     , raw_fd_{socket_.native_handle()}
+    , serial_{session_manager::next_serial()}
     , session_manager_{manager}
 {
-    id_ = fmt::format("{}-client_socket({})", session_prefix_, raw_fd_);
+    id_ = fmt::format("{}-session_count({})-client_socket({})", session_prefix_, serial_, raw_fd_);
 }
 
 const std::string &session::id()
@@ -22,6 +34,152 @@ session::~session()
     shutdown();
 }
 
+void session::use_uring(uring_loop::ptr loop)
+{
+    uring_ = std::move(loop);
+}
+
+void session::use_timers(util::timer_wheel::ptr timers)
+{
+    timers_ = std::move(timers);
+}
+
+#ifdef ENABLE_OPENSSL
+void session::use_tls(const tls_context::ptr &context)
+{
+    tls_ = tls_stream::create(context, raw_fd_);
+}
+#endif
+
+void session::use_zerocopy(size_t min_bytes)
+{
+    if (!min_bytes)
+    {
+        return;
+    }
+
+#ifdef ENABLE_OPENSSL
+    // kTLS and userspace records are not sent from the buffers of the session
+    if (tls_)
+    {
+        return;
+    }
+#endif
+
+    int on = 1;
+    if (::setsockopt(raw_fd_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0)
+    {
+        spdlog::debug("{} cannot enable SO_ZEROCOPY, error = {}", id(), std::strerror(errno));
+        return;
+    }
+    zerocopy_min_bytes_ = min_bytes;
+}
+
+void session::use_quick_ack()
+{
+    int on = 1;
+    if (::setsockopt(raw_fd_, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) < 0)
+    {
+        spdlog::debug("{} cannot enable TCP_QUICKACK, error = {}", id(), std::strerror(errno));
+        return;
+    }
+    is_quick_ack_ = true;
+}
+
+bool session::set_pacing_rate(uint64_t bytes_per_second)
+{
+    // paced by the fq qdisc when it is installed, by the tcp stack itself otherwise
+    uint64_t rate = bytes_per_second ? bytes_per_second : ~0ULL;
+    if (::setsockopt(raw_fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) < 0)
+    {
+        spdlog::debug("{} cannot set SO_MAX_PACING_RATE to {}, error = {}", id(), bytes_per_second, std::strerror(errno));
+        return false;
+    }
+
+    pacing_rate_ = bytes_per_second;
+    return true;
+}
+
+void session::set_idle_timeout(uint32_t timeout_ms, Idle_Policy policy)
+{
+    if (!timers_ || is_closed_)
+    {
+        return;
+    }
+
+    if (idle_timer_)
+    {
+        timers_->cancel(idle_timer_);
+        idle_timer_ = 0;
+    }
+
+    // a check already collected by the wheel sees a stale epoch and does nothing
+    ++idle_epoch_;
+    idle_timeout_ms_ = timeout_ms;
+    idle_policy_ = policy;
+    idle_since_ms_ = timers_->now_ms();
+    last_recv_ms_ = idle_since_ms_;
+    last_send_ms_ = idle_since_ms_;
+
+    if (timeout_ms)
+    {
+        schedule_idle_check(timeout_ms);
+    }
+}
+
+void session::schedule_idle_check(uint64_t delay_ms)
+{
+    std::weak_ptr<session> weak_self = shared_from_this();
+    auto epoch = idle_epoch_;
+    idle_timer_ = timers_->schedule(delay_ms, [this, weak_self, epoch]() {
+        auto strong_self = weak_self.lock();
+        if (!strong_self)
+        {
+            return;
+        }
+
+        // the wheel runs on the io_context, the session may live on a strand of it
+        boost::asio::dispatch(socket_.get_executor(), [this, strong_self, epoch]() { on_idle_check(epoch); });
+    });
+}
+
+void session::on_idle_check(uint64_t epoch)
+{
+    if (epoch != idle_epoch_ || is_closed_)
+    {
+        return;
+    }
+
+    idle_timer_ = 0;
+    auto now = timers_->now_ms();
+    uint64_t last_active = idle_since_ms_;
+    switch (idle_policy_)
+    {
+    case Idle_Policy::recv:
+        last_active = last_recv_ms_;
+        break;
+
+    case Idle_Policy::send:
+        // nothing to send is not a stall
+        last_active = bytes_queued_ ? last_send_ms_.load() : now;
+        break;
+
+    case Idle_Policy::deadline:
+    default:
+        break;
+    }
+
+    auto idle = now > last_active ? now - last_active : 0;
+    if (idle >= idle_timeout_ms_)
+    {
+        spdlog::warn("{} has been idle for {} ms, policy = {}, stop it", id(), idle, magic_enum::enum_name(idle_policy_));
+        session_manager_->stop(shared_from_this());
+        return;
+    }
+
+    schedule_idle_check(idle_timeout_ms_ - idle);
+}
+
 void session::do_read()
 {
     if (!socket_.is_open())
@@ -30,43 +188,59 @@ void session::do_read()
         return;
     }
 
+#ifdef ENABLE_OPENSSL
+    if (tls_ && !tls_->is_established())
+    {
+        do_tls_handshake();
+        return;
+    }
+#endif
+
     std::weak_ptr<session> weak_self = shared_from_this();
-    socket_.async_read_some(boost::asio::buffer(buffer_.write_begin(), buffer_.socket_read_length(kSocketReadSize)),
-        [this, weak_self](boost::system::error_code ec, size_t bytes_transferred) {
+
+    if (uring_)
+    {
+        // one multishot recv keeps delivering data until the socket is closed
+        if (recv_token_)
+        {
+            return;
+        }
+
+        recv_token_ = uring_->recv(raw_fd_, [this, weak_self](int res, const char *data) {
             auto strong_self = weak_self.lock();
             if (!strong_self)
             {
                 return;
             }
 
-            if (ec)
+            if (res <= 0)
             {
+                recv_token_ = 0;
+                if (res < 0)
+                {
+                    spdlog::debug("{} uring recv received error {}", id(), -res);
+                }
                 session_manager_->stop(strong_self);
                 return;
             }
 
-            buffer_.socket_consume(bytes_transferred);
-
-            // if no error, then send to derived session class
+            on_read(static_cast<size_t>(res));
+            if (!on_received(data, static_cast<size_t>(res)))
+            {
+                session_manager_->stop(strong_self);
+                return;
+            }
             on_recv(buffer_);
-
-            do_read();
         });
-}
-
-void session::do_write(const char *data, size_t size, bool is_async, bool is_close)
-{
-    if (!socket_.is_open())
-    {
-        spdlog::debug("{} socket has been closed, return from do_write()", id());
         return;
     }
 
-    std::weak_ptr<session> weak_self = shared_from_this();
-    if (is_async)
+#ifdef ENABLE_OPENSSL
+    if (tls_ && !tls_->is_ktls_recv())
     {
-        boost::asio::async_write(
-            socket_, boost::asio::buffer(data, size), [this, is_close, weak_self](boost::system::error_code ec, std::size_t bytes_sent) {
+        tls_read_buffer_.resize(read_size_);
+        socket_.async_read_some(
+            boost::asio::buffer(tls_read_buffer_), [this, weak_self](boost::system::error_code ec, size_t bytes_transferred) {
                 auto strong_self = weak_self.lock();
                 if (!strong_self)
                 {
@@ -75,46 +249,591 @@ void session::do_write(const char *data, size_t size, bool is_async, bool is_clo
 
                 if (ec)
                 {
-                    spdlog::error("{} do_write() received error {}, msg = {}", id(), ec.value(), ec.message());
                     session_manager_->stop(strong_self);
+                    return;
                 }
-                else if (is_close)
+
+                on_read(bytes_transferred);
+                if (!on_received(tls_read_buffer_.data(), bytes_transferred))
                 {
                     session_manager_->stop(strong_self);
+                    return;
                 }
+                on_recv(buffer_);
+
+                do_read();
             });
+        return;
+    }
+#endif
+
+    socket_.async_read_some(boost::asio::buffer(buffer_.write_begin(), buffer_.socket_read_length(read_size_)),
+        [this, weak_self](boost::system::error_code ec, size_t bytes_transferred) {
+            auto strong_self = weak_self.lock();
+            if (!strong_self)
+            {
+                return;
+            }
+
+            if (ec)
+            {
+                session_manager_->stop(strong_self);
+                return;
+            }
+
+            buffer_.socket_consume(bytes_transferred);
+            on_read(bytes_transferred);
+
+            // if no error, then send to derived session class
+            on_recv(buffer_);
+
+            do_read();
+        });
+}
+
+void session::on_read(size_t bytes_read)
+{
+    ++read_calls_;
+    bytes_received_ += bytes_read;
+    if (is_quick_ack_)
+    {
+        int on = 1;
+        ::setsockopt(raw_fd_, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+    if (timers_)
+    {
+        last_recv_ms_ = timers_->now_ms();
+    }
+
+    // a full read means more is waiting in the kernel, grow at once, shrink only after a run of short reads
+    if (bytes_read >= read_size_)
+    {
+        short_reads_ = 0;
+        read_size_ = std::min(read_size_ * 2, kMaxSocketReadSize);
+    }
+    else if (bytes_read < read_size_ / 4 && read_size_ > kSocketReadSize)
+    {
+        if (++short_reads_ >= kShortReadsToShrink)
+        {
+            short_reads_ = 0;
+            read_size_ = std::max(read_size_ / 2, kSocketReadSize);
+        }
     }
     else
     {
-        boost::system::error_code ec;
-        size_t bytes_sent = boost::asio::write(socket_, boost::asio::buffer(data, size), ec);
+        short_reads_ = 0;
+    }
+}
+
+bool session::on_received(const char *data, size_t size)
+{
+#ifdef ENABLE_OPENSSL
+    if (tls_ && !tls_->is_ktls_recv())
+    {
+        try
+        {
+            return tls_->decrypt(data, size, buffer_);
+        }
+        catch (const std::exception &ex)
+        {
+            spdlog::warn("{} {}", id(), ex.what());
+            return false;
+        }
+    }
+#endif
+
+    buffer_.write(data, size);
+    return true;
+}
+
+#ifdef ENABLE_OPENSSL
+void session::do_tls_handshake()
+{
+    tls_stream::Want want;
+    try
+    {
+        // OpenSSL reads and writes the socket itself until the handshake is done
+        socket_.native_non_blocking(true);
+        want = tls_->handshake();
+    }
+    catch (const std::exception &ex)
+    {
+        spdlog::warn("{} {}", id(), ex.what());
+        session_manager_->stop(shared_from_this());
+        return;
+    }
+
+    if (want == tls_stream::Want::done)
+    {
+        // io_uring sends expect a blocking socket
+        if (uring_)
+        {
+            socket_.native_non_blocking(false);
+        }
+
+        spdlog::info("{} tls established, {}, ktls send = {}, ktls recv = {}", id(), tls_->description(), tls_->is_ktls_send(),
+            tls_->is_ktls_recv());
+        do_read();
+        return;
+    }
+
+    std::weak_ptr<session> weak_self = shared_from_this();
+    socket_.async_wait(want == tls_stream::Want::read ? socket_type::wait_read : socket_type::wait_write,
+        [this, weak_self](boost::system::error_code ec) {
+            auto strong_self = weak_self.lock();
+            if (!strong_self)
+            {
+                return;
+            }
+
+            if (ec)
+            {
+                session_manager_->stop(strong_self);
+                return;
+            }
+
+            do_tls_handshake();
+        });
+}
+
+void session::encrypt_writing()
+{
+    size_t plain_size = 0;
+    for (auto &buf : writing_)
+    {
+        plain_size += buf->size();
+    }
+
+    auto records = tls_->encrypt(writing_);
+    writing_.clear();
+    writing_.emplace_back(records);
+
+    // bytes_queued_ counts what is still to be written, the record overhead included
+    bytes_queued_ += records->size();
+    bytes_queued_ -= std::min(bytes_queued_.load(), plain_size);
+}
+#endif
+
+void session::do_write(const char *data, size_t size, bool is_close)
+{
+    if (!data || !size)
+    {
+        return;
+    }
+
+    do_write(std::make_shared<buffer_raw>(data, size), is_close);
+}
+
+void session::do_write(buffer::ptr buf, bool is_close)
+{
+    std::vector<buffer::ptr> bufs;
+    bufs.emplace_back(std::move(buf));
+    do_write(std::move(bufs), is_close);
+}
+
+void session::do_write(std::vector<buffer::ptr> bufs, bool is_close)
+{
+    if (!socket_.is_open())
+    {
+        spdlog::debug("{} socket has been closed, return from do_write()", id());
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        for (auto &buf : bufs)
+        {
+            if (!buf || !buf->size())
+            {
+                continue;
+            }
+
+            bytes_queued_ += buf->size();
+            write_queue_.emplace_back(std::move(buf));
+        }
+
+        if (is_close)
+        {
+            close_after_write_ = true;
+        }
+
+        // the running flush picks up the new buffers once the current write completes
+        if (is_writing_)
+        {
+            return;
+        }
 
+        is_writing_ = true;
+    }
+
+    std::weak_ptr<session> weak_self = shared_from_this();
+    boost::asio::dispatch(socket_.get_executor(), [this, weak_self]() {
+        if (auto strong_self = weak_self.lock())
+        {
+            flush();
+        }
+    });
+}
+
+void session::flush()
+{
+    bool should_close = false;
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        if (write_queue_.empty())
+        {
+            is_writing_ = false;
+            should_close = close_after_write_;
+        }
+        else
+        {
+            while (!write_queue_.empty() && writing_.size() < kMaxWriteBatch)
+            {
+                writing_.emplace_back(std::move(write_queue_.front()));
+                write_queue_.pop_front();
+            }
+        }
+    }
+
+    if (should_close)
+    {
+        session_manager_->stop(shared_from_this());
+        return;
+    }
+
+    if (writing_.empty())
+    {
+        return;
+    }
+
+#ifdef ENABLE_OPENSSL
+    if (tls_ && !tls_->is_ktls_send())
+    {
+        try
+        {
+            encrypt_writing();
+        }
+        catch (const std::exception &ex)
+        {
+            writing_.clear();
+            on_write_error(EPROTO, ex.what());
+            return;
+        }
+    }
+#endif
+
+    writing_size_ = 0;
+    write_offset_ = 0;
+    for (auto &buf : writing_)
+    {
+        writing_size_ += buf->size();
+    }
+
+    if (uring_)
+    {
+        uring_send();
+        return;
+    }
+
+    if (zerocopy_min_bytes_ && writing_size_ >= zerocopy_min_bytes_)
+    {
+        zerocopy_batch_calls_ = 0;
+        zerocopy_send();
+        return;
+    }
+
+    std::vector<boost::asio::const_buffer> gathered;
+    gathered.reserve(writing_.size());
+    for (auto &buf : writing_)
+    {
+        gathered.emplace_back(buf->data(), buf->size());
+    }
+
+    ++write_calls_;
+
+    std::weak_ptr<session> weak_self = shared_from_this();
+    boost::asio::async_write(socket_, gathered, [this, weak_self](boost::system::error_code ec, std::size_t bytes_sent) {
         auto strong_self = weak_self.lock();
         if (!strong_self)
         {
             return;
         }
 
+        on_written(bytes_sent);
+        writing_.clear();
+
         if (ec)
         {
-            spdlog::error("{} do_write() received error {}, msg = {}", id(), ec.value(), ec.message());
+            on_write_error(ec.value(), ec.message());
+            return;
+        }
 
-            if (ec != boost::asio::error::operation_aborted)
+        flush();
+    });
+}
+
+void session::uring_send()
+{
+    // skip what a previous partial send has already written
+    iovecs_.clear();
+    size_t skip = write_offset_;
+    for (auto &buf : writing_)
+    {
+        if (skip >= buf->size())
+        {
+            skip -= buf->size();
+            continue;
+        }
+
+        iovecs_.push_back(iovec{buf->data() + skip, buf->size() - skip});
+        skip = 0;
+    }
+
+    ++write_calls_;
+
+    // the kernel reads iovecs_ and writing_ until the send completes, keep the session alive until then
+    is_uring_sending_ = true;
+    uring_->send(raw_fd_, iovecs_.data(), iovecs_.size(), [this, strong_self = shared_from_this()](int res) {
+        is_uring_sending_ = false;
+        if (is_closed_)
+        {
+            // stop() left the fd open for this send, its number must not be reused before the send was submitted
+            close_socket();
+            writing_.clear();
+            return;
+        }
+
+        if (res < 0)
+        {
+            writing_.clear();
+            on_write_error(-res, std::strerror(-res));
+            return;
+        }
+
+        if (!on_written(static_cast<size_t>(res)))
+        {
+            uring_send();
+            return;
+        }
+
+        writing_.clear();
+        flush();
+    });
+}
+
+void session::zerocopy_send()
+{
+    reap_zerocopy();
+
+    while (true)
+    {
+        iovecs_.clear();
+        size_t skip = write_offset_;
+        for (auto &buf : writing_)
+        {
+            if (skip >= buf->size())
             {
-                session_manager_->stop(strong_self);
+                skip -= buf->size();
+                continue;
+            }
+
+            iovecs_.push_back(iovec{buf->data() + skip, buf->size() - skip});
+            skip = 0;
+        }
+
+        msghdr hdr{};
+        hdr.msg_iov = iovecs_.data();
+        hdr.msg_iovlen = iovecs_.size();
+
+        ++write_calls_;
+        bool is_zerocopy = true;
+        auto sent = ::sendmsg(raw_fd_, &hdr, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno == ENOBUFS)
+        {
+            // out of optmem for the notifications, this call copies
+            is_zerocopy = false;
+            sent = ::sendmsg(raw_fd_, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                std::weak_ptr<session> weak_self = shared_from_this();
+                socket_.async_wait(socket_type::wait_write, [this, weak_self](boost::system::error_code ec) {
+                    auto strong_self = weak_self.lock();
+                    if (!strong_self)
+                    {
+                        return;
+                    }
+
+                    if (ec)
+                    {
+                        retire_zerocopy_batch();
+                        on_write_error(ec.value(), ec.message());
+                        return;
+                    }
+
+                    zerocopy_send();
+                });
                 return;
             }
+
+            auto err = errno;
+            retire_zerocopy_batch();
+            on_write_error(err, std::strerror(err));
+            return;
         }
-        else
+
+        if (is_zerocopy)
         {
-            if (is_close)
+            if (!zerocopy_batch_calls_)
             {
-                session_manager_->stop(strong_self);
+                zerocopy_batch_first_ = zerocopy_next_;
+            }
+            ++zerocopy_batch_calls_;
+            ++zerocopy_next_;
+            ++zerocopy_sends_;
+        }
+
+        if (on_written(static_cast<size_t>(sent)))
+        {
+            break;
+        }
+    }
+
+    retire_zerocopy_batch();
+    flush();
+}
+
+void session::retire_zerocopy_batch()
+{
+    // the kernel may still read the pages of writing_, even when the socket has failed
+    if (zerocopy_batch_calls_)
+    {
+        zerocopy_inflight_.push_back(
+            {zerocopy_batch_first_, zerocopy_batch_first_ + zerocopy_batch_calls_ - 1, zerocopy_batch_calls_, std::move(writing_)});
+        zerocopy_batch_calls_ = 0;
+        wait_zerocopy();
+    }
+    writing_.clear();
+}
+
+void session::reap_zerocopy()
+{
+    while (!zerocopy_inflight_.empty())
+    {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(raw_fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return;
+        }
+
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            bool is_recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                              (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr)
+            {
+                continue;
+            }
+
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            // [ee_info, ee_data] is a range of sendmsg() calls the kernel is done with
+            uint32_t lo = err.ee_info;
+            uint32_t hi = err.ee_data;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zerocopy_copied_ += hi - lo + 1;
+            }
+
+            for (auto &batch : zerocopy_inflight_)
+            {
+                auto from = std::max(lo, batch.first);
+                auto to = std::min(hi, batch.last);
+                if (from <= to)
+                {
+                    batch.remaining -= std::min(batch.remaining, to - from + 1);
+                }
+            }
+
+            while (!zerocopy_inflight_.empty() && !zerocopy_inflight_.front().remaining)
+            {
+                zerocopy_inflight_.pop_front();
             }
         }
     }
 }
 
+void session::wait_zerocopy()
+{
+    if (is_zerocopy_waiting_ || zerocopy_inflight_.empty())
+    {
+        return;
+    }
+
+    // notifications are also reaped by every zerocopy send, this wait covers a session that has stopped sending
+    is_zerocopy_waiting_ = true;
+    std::weak_ptr<session> weak_self = shared_from_this();
+    socket_.async_wait(socket_type::wait_error, [this, weak_self](boost::system::error_code ec) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self)
+        {
+            return;
+        }
+
+        is_zerocopy_waiting_ = false;
+        if (ec)
+        {
+            return;
+        }
+
+        reap_zerocopy();
+        wait_zerocopy();
+    });
+}
+
+bool session::on_written(size_t bytes_sent)
+{
+    if (timers_ && bytes_sent)
+    {
+        last_send_ms_ = timers_->now_ms();
+    }
+
+    bytes_sent_ += bytes_sent;
+    bytes_queued_ -= std::min(bytes_queued_.load(), bytes_sent);
+    write_offset_ += bytes_sent;
+    return write_offset_ >= writing_size_;
+}
+
+void session::on_write_error(int err, const std::string &msg)
+{
+    // a write still in flight when the session was stopped fails on the closed socket
+    if (is_closed_)
+    {
+        spdlog::debug("{} do_write() received error {} after close, msg = {}", id(), err, msg);
+    }
+    else
+    {
+        spdlog::error("{} do_write() received error {}, msg = {}", id(), err, msg);
+    }
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        write_queue_.clear();
+        is_writing_ = false;
+    }
+    session_manager_->stop(shared_from_this());
+}
+
 // called by other classes
 void session::shutdown()
 {
@@ -122,10 +841,15 @@ void session::shutdown()
 
     if (session_manager_)
     {
-        session_manager_->erase(id());
+        session_manager_->erase(serial_);
     }
 }
 
+void session::post_shutdown()
+{
+    boost::asio::post(socket_.get_executor(), [strong_self = shared_from_this()]() { strong_self->shutdown(); });
+}
+
 // called by session_manager
 void session::stop()
 {
@@ -134,16 +858,52 @@ void session::stop()
         return;
     }
 
+    if (timers_ && idle_timer_)
+    {
+        timers_->cancel(idle_timer_);
+        idle_timer_ = 0;
+    }
+
+    if (uring_)
+    {
+        // wake the multishot recv and fail a pending send, the send completion then closes the socket
+        if (recv_token_)
+        {
+            uring_->cancel(recv_token_);
+            recv_token_ = 0;
+        }
+        ::shutdown(raw_fd_, SHUT_RDWR);
+    }
+
+    is_closed_ = true;
+
+    // a queued send still refers to raw_fd_, the send completion closes the socket
+    if (!is_uring_sending_)
+    {
+        close_socket();
+    }
+}
+
+void session::close_socket()
+{
     if (socket_.is_open())
     {
         socket_.close();
+        if (zerocopy_sends_)
+        {
+            spdlog::info("{} zerocopy sends = {}, copied by the kernel = {}, still in flight = {}", id(), zerocopy_sends_.load(),
+                zerocopy_copied_.load(), zerocopy_inflight_.size());
+        }
+        if (read_calls_)
+        {
+            spdlog::info("{} closed, bytes received = {}, reads = {}, average read = {}, last read size = {}", id(), bytes_received_.load(),
+                read_calls_.load(), bytes_received_ / read_calls_, read_size_);
+        }
         // Initiate graceful connection closure.
         // boost::system::error_code ignored_ec;
         // socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
         // ignored_ec);
     }
-
-    is_closed_ = true;
 }
 
 // session_manager impl
@@ -161,10 +921,10 @@ session_manager::~session_manager()
     stop_all();
 }
 
-std::string session_manager::generate_session_prefix()
+uint64_t session_manager::next_serial()
 {
-    static std::atomic_int64_t session_index{0};
-    return fmt::format("{}-session_count({})", session_prefix_, ++session_index);
+    static std::atomic_uint64_t serial{0};
+    return ++serial;
 }
 
 void session_manager::add(session::ptr session_ptr)
@@ -174,8 +934,17 @@ void session_manager::add(session::ptr session_ptr)
         return;
     }
 
-    std::lock_guard<std::recursive_mutex> lock(mtx_);
-    session_map_.emplace(session_ptr->id(), std::move(session_ptr));
+    auto &b = bucket_of(session_ptr->serial());
+    {
+        std::lock_guard<std::mutex> lock(b.mtx);
+        if (!b.sessions.emplace(session_ptr->serial(), std::move(session_ptr)).second)
+        {
+            return;
+        }
+    }
+
+    ++live_;
+    ++accepted_;
 }
 
 void session_manager::stop(const session::ptr &session_ptr)
@@ -185,39 +954,88 @@ void session_manager::stop(const session::ptr &session_ptr)
         return;
     }
 
-    auto it = session_map_.find(session_ptr->id());
-    if (it == session_map_.end())
+    session::ptr removed;
     {
-        return;
+        auto &b = bucket_of(session_ptr->serial());
+        std::lock_guard<std::mutex> lock(b.mtx);
+        auto it = b.sessions.find(session_ptr->serial());
+        if (it == b.sessions.end())
+        {
+            return;
+        }
+
+        // keep the last reference alive until the session has been stopped outside of the lock
+        removed = std::move(it->second);
+        b.sessions.erase(it);
     }
 
-    session_ptr->stop();
-    session_map_.erase(it);
+    --live_;
+    ++closed_;
+    removed->stop();
 }
 
-void session_manager::erase(const std::string &session_id)
+void session_manager::erase(uint64_t serial)
 {
-    if (!session_id.empty())
+    if (!serial)
     {
         return;
     }
 
-    session_map_.erase(session_id);
+    auto &b = bucket_of(serial);
+    std::lock_guard<std::mutex> lock(b.mtx);
+    if (b.sessions.erase(serial))
+    {
+        --live_;
+        ++closed_;
+    }
 }
 
 void session_manager::stop_all()
 {
-    std::lock_guard<std::recursive_mutex> lock(mtx_);
+    size_t stopped = 0;
+    for (auto &b : buckets_)
+    {
+        std::unordered_map<uint64_t, session::ptr> sessions;
+        {
+            std::lock_guard<std::mutex> lock(b.mtx);
+            sessions.swap(b.sessions);
+        }
+
+        for (auto &[serial, session_ptr] : sessions)
+        {
+            if (session_ptr)
+            {
+                session_ptr->stop();
+            }
+        }
+
+        stopped += sessions.size();
+    }
+
+    live_ -= stopped;
+    closed_ += stopped;
+}
+
+std::vector<session::ptr> session_manager::snapshot() const
+{
+    std::vector<session::ptr> sessions;
+    sessions.reserve(live_);
 
-    for (auto it = session_map_.begin(); it != session_map_.end();)
+    for (auto &b : buckets_)
     {
-        auto &session_ptr = it->second;
-        if (session_ptr)
+        std::lock_guard<std::mutex> lock(b.mtx);
+        for (auto &[serial, session_ptr] : b.sessions)
         {
-            session_ptr->stop();
+            sessions.emplace_back(session_ptr);
         }
-        it = session_map_.erase(it);
     }
+
+    return sessions;
+}
+
+session_manager::stats session_manager::get_stats() const
+{
+    return {live_, accepted_, closed_};
 }
 
-} // namespace network
\ No newline at end of file
+} // namespace network
@@ -0,0 +1,120 @@
+#include "socket_profile.h"
+
+#include <spdlog/spdlog.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace network {
+
+namespace {
+
+void set_option(int fd, int level, int option, int value, const char *option_name)
+{
+    if (::setsockopt(fd, level, option, &value, sizeof(value)) < 0)
+    {
+        spdlog::warn("socket {} failed to set {} to {}, error = {}", fd, option_name, value, std::strerror(errno));
+    }
+}
+
+} // namespace
+
+socket_profile socket_profile::ingest()
+{
+    socket_profile profile;
+    profile.name = "ingest";
+    profile.no_delay = true;
+    profile.recv_buffer = 4 * 1024 * 1024;
+    profile.quick_ack = true;
+    profile.keepalive = true;
+    profile.keepalive_idle_s = 30;
+    profile.keepalive_interval_s = 10;
+    profile.keepalive_count = 3;
+    return profile;
+}
+
+socket_profile socket_profile::play()
+{
+    socket_profile profile;
+    profile.name = "play";
+    profile.no_delay = true;
+    profile.notsent_lowat = 128 * 1024;
+    profile.keepalive = true;
+    profile.keepalive_idle_s = 30;
+    profile.keepalive_interval_s = 10;
+    profile.keepalive_count = 3;
+    return profile;
+}
+
+socket_profile socket_profile::from_name(const std::string &name)
+{
+    if (name == "ingest")
+    {
+        return ingest();
+    }
+
+    if (name == "play")
+    {
+        return play();
+    }
+
+    if (name != "none")
+    {
+        spdlog::warn("unknown socket profile {}, fall back to none", name);
+    }
+    return {};
+}
+
+void socket_profile::apply_to_listener(int fd) const
+{
+    if (send_buffer)
+    {
+        set_option(fd, SOL_SOCKET, SO_SNDBUF, send_buffer, "SO_SNDBUF");
+    }
+
+    if (recv_buffer)
+    {
+        set_option(fd, SOL_SOCKET, SO_RCVBUF, recv_buffer, "SO_RCVBUF");
+    }
+}
+
+void socket_profile::apply(int fd) const
+{
+    if (no_delay)
+    {
+        set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+
+    if (notsent_lowat)
+    {
+        set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, static_cast<int>(notsent_lowat), "TCP_NOTSENT_LOWAT");
+    }
+
+    if (quick_ack)
+    {
+        set_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    }
+
+    if (keepalive)
+    {
+        set_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+        if (keepalive_idle_s)
+        {
+            set_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepalive_idle_s, "TCP_KEEPIDLE");
+        }
+        if (keepalive_interval_s)
+        {
+            set_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, keepalive_interval_s, "TCP_KEEPINTVL");
+        }
+        if (keepalive_count)
+        {
+            set_option(fd, IPPROTO_TCP, TCP_KEEPCNT, keepalive_count, "TCP_KEEPCNT");
+        }
+    }
+}
+
+} // namespace network
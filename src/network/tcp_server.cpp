@@ -1,19 +1,62 @@
 #include "tcp_server.h"
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include <csignal>
+#include <cstring>
 
 namespace network {
 
 tcp_server::ptr tcp_server::create(TCP_SERVER_PARAMS)
 {
-    return std::shared_ptr<tcp_server>(new tcp_server(io_context, port, ip_type));
+    return std::shared_ptr<tcp_server>(new tcp_server(io_context, port, ip_type, is_sharded, listen_fd, {}));
+}
+
+tcp_server::ptr tcp_server::create_local(boost::asio::io_context &io_context, const std::string &path, int listen_fd, bool is_sharded)
+{
+    if (listen_fd < 0)
+    {
+        throw std::invalid_argument(fmt::format("unix socket listener {} needs a listening socket", path));
+    }
+
+    return std::shared_ptr<tcp_server>(new tcp_server(io_context, 0, Ip_Type::ipv4, is_sharded, listen_fd, path));
+}
+
+int tcp_server::listen_local(const std::string &path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::invalid_argument(fmt::format("invalid unix socket path {}", path));
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error(fmt::format("cannot create unix socket, error = {}", std::strerror(errno)));
+    }
+
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0)
+    {
+        auto err = errno;
+        ::close(fd);
+        throw std::runtime_error(fmt::format("cannot listen on unix socket {}, error = {}", path, std::strerror(err)));
+    }
+    return fd;
 }
 
-tcp_server::tcp_server(TCP_SERVER_PARAMS)
+tcp_server::tcp_server(TCP_SERVER_PARAMS, const std::string &local_path)
     : server(port, Sock_Type::tcp, ip_type)
     , io_context_{io_context}
     , signals_{io_context_}
     , acceptor_{io_context_}
+    , is_sharded_{is_sharded}
+    , local_path_{local_path}
 {
 
     // Register to handle the signals that indicate when the server should exit.
@@ -24,6 +67,17 @@ tcp_server::tcp_server(TCP_SERVER_PARAMS)
     signals_.add(SIGTERM);
     start_signal_listener();
 
+    if (!local_path_.empty())
+    {
+        protocol_ = boost::asio::generic::stream_protocol(AF_UNIX, 0);
+        acceptor_.assign(protocol_, listen_fd);
+        acceptor_.non_blocking(true);
+        raw_fd_ = acceptor_.native_handle();
+        session_manager_ = session_manager::create(info());
+        spdlog::info("Server {} listens on {}", info(), local_path_);
+        return;
+    }
+
     tcp::resolver resolver(io_context_);
     auto result = resolver.resolve(ip_type_ == network::Ip_Type::ipv4 ? kDefaultLocalIpv4 : kDefaultLocalIpv6, std::to_string(port));
     if (result.empty())
@@ -32,16 +86,29 @@ tcp_server::tcp_server(TCP_SERVER_PARAMS)
     }
 
     auto endpoint = result.begin()->endpoint();
-    acceptor_.open(endpoint.protocol());
-    acceptor_.set_option(tcp::acceptor::reuse_address(true));
-    acceptor_.non_blocking(true);
-    acceptor_.bind(endpoint);
-    acceptor_.listen();
+    protocol_ = boost::asio::generic::stream_protocol(endpoint.protocol());
+    if (listen_fd >= 0)
+    {
+        // an inherited socket is already bound and listening, connections queued on it are accepted here
+        acceptor_.assign(protocol_, listen_fd);
+        acceptor_.non_blocking(true);
+    }
+    else
+    {
+        acceptor_.open(protocol_);
+        acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
+        if (is_sharded_)
+        {
+            acceptor_.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        }
+        acceptor_.non_blocking(true);
+        acceptor_.bind(boost::asio::generic::stream_protocol::endpoint(endpoint));
+        acceptor_.listen();
+    }
 
     raw_fd_ = acceptor_.native_handle();
     session_manager_ = session_manager::create(info());
-
-    spdlog::info("Server {} created", info());
+    spdlog::info("Server {} {}", info(), listen_fd >= 0 ? "taken over" : "created");
 }
 
 tcp_server::~tcp_server()
@@ -49,6 +116,30 @@ tcp_server::~tcp_server()
     spdlog::info("Server {} destroyed", info());
 }
 
+void tcp_server::use_uring(uring_loop::ptr loop)
+{
+    uring_ = std::move(loop);
+}
+
+void tcp_server::use_socket_profile(socket_profile profile)
+{
+    profile_ = std::move(profile);
+    profile_.apply_to_listener(raw_fd_);
+    spdlog::info("Server {} uses socket profile {}", info(), profile_.name);
+}
+
+#ifdef ENABLE_OPENSSL
+void tcp_server::use_tls(tls_context::ptr context)
+{
+    tls_ = std::move(context);
+}
+#endif
+
+void tcp_server::use_timers(util::timer_wheel::ptr timers)
+{
+    timers_ = std::move(timers);
+}
+
 void tcp_server::do_accept()
 {
     if (!acceptor_.is_open())
@@ -56,7 +147,14 @@ void tcp_server::do_accept()
         return;
     }
 
-    acceptor_.async_accept(boost::asio::make_strand(io_context_), [this](boost::system::error_code ec, tcp::socket sock) {
+    if (uring_)
+    {
+        do_uring_accept();
+        return;
+    }
+
+    // a sharded listener is run by a single thread, sessions accepted here are pinned to it and need no strand
+    auto on_accept = [this](boost::system::error_code ec, session::socket_type sock) {
         // Check whether the server was stopped by a signal before this
         // completion handler had a chance to run.
         if (!acceptor_.is_open())
@@ -76,6 +174,46 @@ void tcp_server::do_accept()
         }
 
         do_accept();
+    };
+
+    if (is_sharded_)
+    {
+        acceptor_.async_accept(io_context_, std::move(on_accept));
+    }
+    else
+    {
+        acceptor_.async_accept(boost::asio::make_strand(io_context_), std::move(on_accept));
+    }
+}
+
+void tcp_server::do_uring_accept()
+{
+    // the multishot accept stays armed across connections
+    if (accept_token_)
+    {
+        return;
+    }
+
+    accept_token_ = uring_->accept(raw_fd_, [this](int res) {
+        if (!acceptor_.is_open())
+        {
+            if (res >= 0)
+            {
+                ::close(res);
+            }
+            return;
+        }
+
+        if (res < 0)
+        {
+            spdlog::error("uring acceptor received error {}", -res);
+            return;
+        }
+
+        // the socket is only used to own the fd, every read and write goes through the loop
+        auto new_session = session_alloc_(session::socket_type(io_context_, protocol_, res));
+        new_session->use_uring(uring_);
+        new_session->start();
     });
 }
 
@@ -84,9 +222,41 @@ void tcp_server::restart()
     do_accept();
 }
 
+void tcp_server::stop_accepting()
+{
+    if (uring_ && accept_token_)
+    {
+        uring_->cancel(accept_token_);
+        accept_token_ = 0;
+    }
+
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+    spdlog::info("Server {} stopped accepting, {} sessions left", info(), session_manager_->size());
+}
+
+std::string tcp_server::address() const
+{
+    return local_path_.empty() ? address_of(port_) : address_of(local_path_);
+}
+
+std::string tcp_server::address_of(uint16_t port)
+{
+    return fmt::format("tcp:{}", port);
+}
+
+std::string tcp_server::address_of(const std::string &local_path)
+{
+    return fmt::format("unix:{}", local_path);
+}
+
 const std::string &tcp_server::info()
 {
-    if (server_name_.empty())
+    if (server_name_.empty() && !local_path_.empty())
+    {
+        server_name_ = fmt::format("UNIX[{}]", raw_fd_);
+    }
+    else if (server_name_.empty())
     {
         server_name_ = fmt::format("TCP[{}|{}|{}]", port_, ip_type_ == Ip_Type::ipv4 ? "ipv4" : "ipv6", raw_fd_);
     }
@@ -98,6 +268,11 @@ void tcp_server::start_signal_listener()
     signals_.async_wait([this](boost::system::error_code, int signo) {
         spdlog::info("{} received signal {}", info(), signo);
         // close the acceptor
+        if (uring_ && accept_token_)
+        {
+            uring_->cancel(accept_token_);
+            accept_token_ = 0;
+        }
         acceptor_.close();
 
         // close io_context
@@ -0,0 +1,202 @@
+#ifdef ENABLE_OPENSSL
+
+#include "tls_stream.h"
+
+#include <openssl/err.h>
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+namespace network {
+
+namespace {
+
+std::string last_ssl_error()
+{
+    auto code = ERR_get_error();
+    if (!code)
+    {
+        return "unknown error";
+    }
+
+    char msg[256];
+    ERR_error_string_n(code, msg, sizeof(msg));
+    ERR_clear_error();
+    return msg;
+}
+
+} // namespace
+
+// tls_context
+tls_context::ptr tls_context::create(const std::string &cert_file, const std::string &key_file)
+{
+    return std::shared_ptr<tls_context>(new tls_context(cert_file, key_file));
+}
+
+tls_context::tls_context(const std::string &cert_file, const std::string &key_file)
+{
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (!ctx_)
+    {
+        throw std::runtime_error(fmt::format("cannot create ssl context, error = {}", last_ssl_error()));
+    }
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    // let OpenSSL move the record layer into the kernel after the handshake
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx_, cert_file.c_str()) != 1)
+    {
+        auto error = last_ssl_error();
+        SSL_CTX_free(ctx_);
+        throw std::runtime_error(fmt::format("cannot load certificate {}, error = {}", cert_file, error));
+    }
+
+    if (SSL_CTX_use_PrivateKey_file(ctx_, key_file.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx_) != 1)
+    {
+        auto error = last_ssl_error();
+        SSL_CTX_free(ctx_);
+        throw std::runtime_error(fmt::format("cannot load private key {}, error = {}", key_file, error));
+    }
+}
+
+tls_context::~tls_context()
+{
+    SSL_CTX_free(ctx_);
+}
+
+// tls_stream
+tls_stream::ptr tls_stream::create(const tls_context::ptr &context, int fd)
+{
+    return std::shared_ptr<tls_stream>(new tls_stream(context, fd));
+}
+
+tls_stream::tls_stream(const tls_context::ptr &context, int fd)
+    : context_{context}
+{
+    ssl_ = SSL_new(context_->native_handle());
+    if (!ssl_ || SSL_set_fd(ssl_, fd) != 1)
+    {
+        SSL_free(ssl_);
+        throw std::runtime_error(fmt::format("cannot create ssl session, error = {}", last_ssl_error()));
+    }
+    SSL_set_accept_state(ssl_);
+}
+
+tls_stream::~tls_stream()
+{
+    SSL_free(ssl_);
+}
+
+tls_stream::Want tls_stream::handshake()
+{
+    if (is_established_)
+    {
+        return Want::done;
+    }
+
+    auto ret = SSL_do_handshake(ssl_);
+    if (ret == 1)
+    {
+        on_established();
+        return Want::done;
+    }
+
+    switch (SSL_get_error(ssl_, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        return Want::read;
+
+    case SSL_ERROR_WANT_WRITE:
+        return Want::write;
+
+    default:
+        throw std::runtime_error(fmt::format("tls handshake failed, error = {}", last_ssl_error()));
+    }
+}
+
+void tls_stream::on_established()
+{
+    is_established_ = true;
+#ifndef OPENSSL_NO_KTLS
+    is_ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    is_ktls_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+#endif
+
+    // the socket BIO does not read ahead, nothing past the handshake is lost when it is replaced
+    if (!is_ktls_recv_)
+    {
+        rbio_ = BIO_new(BIO_s_mem());
+        SSL_set0_rbio(ssl_, rbio_);
+    }
+
+    if (!is_ktls_send_)
+    {
+        wbio_ = BIO_new(BIO_s_mem());
+        SSL_set0_wbio(ssl_, wbio_);
+    }
+}
+
+bool tls_stream::decrypt(const char *data, size_t size, flat_buffer &buf)
+{
+    if (size && BIO_write(rbio_, data, static_cast<int>(size)) != static_cast<int>(size))
+    {
+        throw std::runtime_error("cannot queue tls records");
+    }
+
+    static constexpr size_t kRecordSize = 16 * 1024;
+    while (true)
+    {
+        auto len = buf.socket_read_length(kRecordSize);
+        auto ret = SSL_read(ssl_, buf.write_begin(), static_cast<int>(len));
+        if (ret > 0)
+        {
+            buf.socket_consume(static_cast<size_t>(ret));
+            continue;
+        }
+
+        switch (SSL_get_error(ssl_, ret))
+        {
+        case SSL_ERROR_WANT_READ:
+            return true;
+
+        case SSL_ERROR_ZERO_RETURN:
+            return false;
+
+        default:
+            throw std::runtime_error(fmt::format("cannot decrypt tls record, error = {}", last_ssl_error()));
+        }
+    }
+}
+
+buffer::ptr tls_stream::encrypt(const std::vector<buffer::ptr> &bufs)
+{
+    for (auto &buf : bufs)
+    {
+        // a memory BIO never pushes back, every byte is taken in one call
+        if (SSL_write(ssl_, buf->data(), static_cast<int>(buf->size())) <= 0)
+        {
+            throw std::runtime_error(fmt::format("cannot encrypt tls record, error = {}", last_ssl_error()));
+        }
+    }
+
+    auto pending = BIO_ctrl_pending(wbio_);
+    auto records = std::make_shared<buffer_raw>(pending);
+    if (pending)
+    {
+        BIO_read(wbio_, records->data(), static_cast<int>(pending));
+    }
+    records->set_size(pending);
+    return records;
+}
+
+std::string tls_stream::description() const
+{
+    return fmt::format("{} {}", SSL_get_version(ssl_), SSL_get_cipher_name(ssl_));
+}
+
+} // namespace network
+
+#endif
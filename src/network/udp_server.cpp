@@ -0,0 +1,499 @@
+#include "udp_server.h"
+
+#include <spdlog/spdlog.h>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace network {
+
+// udp_peer
+udp_peer::udp_peer(UDP_PEER_CONSTRUCTOR_PARAMS)
+    : server_{server}
+    , endpoint_{endpoint}
+{
+    std::ostringstream oss;
+    oss << endpoint_;
+    auto server_ptr = server_.lock();
+    id_ = fmt::format("{}-peer({})", server_ptr ? server_ptr->info() : "UDP", oss.str());
+}
+
+void udp_peer::send(buffer::ptr buf)
+{
+    std::vector<buffer::ptr> bufs;
+    bufs.emplace_back(std::move(buf));
+    send(std::move(bufs));
+}
+
+void udp_peer::send(std::vector<buffer::ptr> bufs)
+{
+    if (auto server_ptr = server_.lock())
+    {
+        server_ptr->send_to(endpoint_, std::move(bufs));
+    }
+}
+
+// udp_server
+udp_server::ptr udp_server::create(boost::asio::io_context &io_context, uint16_t port, Ip_Type ip_type, bool is_sharded)
+{
+    return std::shared_ptr<udp_server>(new udp_server(io_context, port, ip_type, is_sharded));
+}
+
+udp_server::udp_server(boost::asio::io_context &io_context, uint16_t port, Ip_Type ip_type, bool is_sharded)
+    : server(port, Sock_Type::udp, ip_type)
+    , io_context_{io_context}
+    , strand_{boost::asio::make_strand(io_context)}
+    , signals_{io_context_}
+    , socket_{io_context_}
+    , is_sharded_{is_sharded}
+{
+    signals_.add(SIGINT);
+    signals_.add(SIGTERM);
+    start_signal_listener();
+
+    udp::endpoint endpoint(ip_type_ == Ip_Type::ipv4 ? udp::v4() : udp::v6(), port);
+    socket_.open(endpoint.protocol());
+    socket_.set_option(udp::socket::reuse_address(true));
+    if (is_sharded_)
+    {
+        socket_.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+    }
+    socket_.non_blocking(true);
+    socket_.bind(endpoint);
+    raw_fd_ = socket_.native_handle();
+
+    // a burst of datagrams must not overflow the socket before the next read batch
+    socket_.set_option(boost::asio::socket_base::receive_buffer_size(kSocketBufferSize));
+    socket_.set_option(boost::asio::socket_base::send_buffer_size(kSocketBufferSize));
+
+    int on = 1;
+    is_gro_ = ::setsockopt(raw_fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+
+    // a kernel without GSO rejects the option
+    int segment = 0;
+    socklen_t segment_len = sizeof(segment);
+    is_gso_ = ::getsockopt(raw_fd_, SOL_UDP, UDP_SEGMENT, &segment, &segment_len) == 0;
+
+    recv_buffers_.resize(kRecvBatch * kRecvBufferSize);
+
+    spdlog::info("Server {} created, gro = {}, gso = {}", info(), is_gro_, is_gso_);
+}
+
+udp_server::~udp_server()
+{
+    spdlog::info("Server {} destroyed", info());
+}
+
+const std::string &udp_server::info()
+{
+    if (server_name_.empty())
+    {
+        server_name_ = fmt::format("UDP[{}|{}|{}]", port_, ip_type_ == Ip_Type::ipv4 ? "ipv4" : "ipv6", raw_fd_);
+    }
+    return server_name_;
+}
+
+void udp_server::restart()
+{
+    boost::asio::post(strand_, [this]() { do_read(); });
+}
+
+void udp_server::use_timers(util::timer_wheel::ptr timers)
+{
+    timers_ = std::move(timers);
+    if (!timers_)
+    {
+        return;
+    }
+
+    std::weak_ptr<server> weak_self = shared_from_this();
+    expire_timer_ = timers_->schedule_every(kPeerIdleMs / 2, [this, weak_self]() {
+        auto strong_self = weak_self.lock();
+        if (!strong_self)
+        {
+            return;
+        }
+
+        boost::asio::post(strand_, [this, strong_self]() { expire_peers(); });
+    });
+}
+
+void udp_server::do_read()
+{
+    if (!socket_.is_open() || is_reading_)
+    {
+        return;
+    }
+
+    is_reading_ = true;
+    std::weak_ptr<server> weak_self = shared_from_this();
+    socket_.async_wait(udp::socket::wait_read, boost::asio::bind_executor(strand_, [this, weak_self](boost::system::error_code ec) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self)
+        {
+            return;
+        }
+
+        is_reading_ = false;
+        if (ec)
+        {
+            if (ec != boost::asio::error::operation_aborted)
+            {
+                spdlog::error("{} wait read received error {}, msg = {}", info(), ec.value(), ec.message());
+            }
+            return;
+        }
+
+        for (size_t round = 0; round < kMaxReadRounds && read_batch(); ++round)
+        {
+        }
+
+        do_read();
+    }));
+}
+
+bool udp_server::read_batch()
+{
+    for (size_t i = 0; i < kRecvBatch; ++i)
+    {
+        recv_iovecs_[i].iov_base = recv_buffers_.data() + i * kRecvBufferSize;
+        recv_iovecs_[i].iov_len = kRecvBufferSize;
+
+        auto &hdr = recv_msgs_[i].msg_hdr;
+        hdr.msg_name = &recv_addrs_[i];
+        hdr.msg_namelen = sizeof(sockaddr_storage);
+        hdr.msg_iov = &recv_iovecs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = recv_controls_[i].data();
+        hdr.msg_controllen = recv_controls_[i].size();
+        hdr.msg_flags = 0;
+        recv_msgs_[i].msg_len = 0;
+    }
+
+    int count = ::recvmmsg(raw_fd_, recv_msgs_.data(), kRecvBatch, MSG_DONTWAIT, nullptr);
+    if (count < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            spdlog::error("{} recvmmsg received error {}, msg = {}", info(), errno, std::strerror(errno));
+        }
+        return false;
+    }
+
+    ++recv_calls_;
+    for (int i = 0; i < count; ++i)
+    {
+        auto &msg = recv_msgs_[static_cast<size_t>(i)];
+        const char *data = static_cast<const char *>(msg.msg_hdr.msg_iov->iov_base);
+        size_t size = msg.msg_len;
+
+        // a GRO coalesced message carries the size of its segments, only the last one can be shorter
+        size_t segment = size;
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg.msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msg.msg_hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int gso_size = 0;
+                std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                if (gso_size > 0)
+                {
+                    segment = static_cast<size_t>(gso_size);
+                }
+            }
+        }
+
+        udp::endpoint endpoint;
+        std::memcpy(endpoint.data(), msg.msg_hdr.msg_name, msg.msg_hdr.msg_namelen);
+        endpoint.resize(msg.msg_hdr.msg_namelen);
+
+        for (size_t offset = 0; offset < size; offset += segment)
+        {
+            dispatch(endpoint, data + offset, std::min(segment, size - offset));
+        }
+    }
+
+    return static_cast<size_t>(count) == kRecvBatch;
+}
+
+void udp_server::dispatch(const udp::endpoint &endpoint, const char *data, size_t size)
+{
+    ++datagrams_received_;
+    bytes_received_ += size;
+
+    auto it = peers_.find(endpoint);
+    if (it == peers_.end())
+    {
+        if (!peer_alloc_)
+        {
+            return;
+        }
+
+        auto peer = peer_alloc_(endpoint);
+        if (!peer)
+        {
+            return;
+        }
+        it = peers_.emplace(endpoint, std::move(peer)).first;
+        ++peer_count_;
+    }
+
+    auto peer = it->second;
+    if (timers_)
+    {
+        peer->last_recv_ms_ = timers_->now_ms();
+    }
+
+    try
+    {
+        peer->on_recv(data, size);
+    }
+    catch (const std::exception &ex)
+    {
+        spdlog::error("{} received exception, error = {}, drop the peer", peer->id(), ex.what());
+        peers_.erase(endpoint);
+        --peer_count_;
+        peer->on_close();
+    }
+}
+
+void udp_server::send_to(const udp::endpoint &endpoint, std::vector<buffer::ptr> bufs)
+{
+    std::weak_ptr<server> weak_self = shared_from_this();
+    boost::asio::dispatch(strand_, [this, weak_self, endpoint, bufs = std::move(bufs)]() mutable {
+        auto strong_self = weak_self.lock();
+        if (!strong_self || !socket_.is_open())
+        {
+            return;
+        }
+
+        for (auto &buf : bufs)
+        {
+            if (!buf || !buf->size())
+            {
+                continue;
+            }
+
+            if (pending_.size() >= kMaxPendingDatagrams)
+            {
+                ++datagrams_dropped_;
+                continue;
+            }
+            pending_.push_back({endpoint, std::move(buf)});
+        }
+
+        // datagrams queued by the handlers of one read batch leave with one sendmmsg
+        if (!is_writing_)
+        {
+            is_writing_ = true;
+            boost::asio::post(strand_, [this, strong_self]() {
+                is_writing_ = false;
+                flush();
+            });
+        }
+    });
+}
+
+void udp_server::do_write()
+{
+    is_writing_ = true;
+    std::weak_ptr<server> weak_self = shared_from_this();
+    socket_.async_wait(udp::socket::wait_write, boost::asio::bind_executor(strand_, [this, weak_self](boost::system::error_code ec) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self)
+        {
+            return;
+        }
+
+        is_writing_ = false;
+        if (ec)
+        {
+            pending_.clear();
+            return;
+        }
+
+        flush();
+    }));
+}
+
+void udp_server::flush()
+{
+    std::array<mmsghdr, kSendBatch> msgs{};
+    std::array<size_t, kSendBatch> datagrams{};
+    std::array<std::array<char, CMSG_SPACE(sizeof(uint16_t))>, kSendBatch> controls{};
+    std::vector<iovec> iovecs;
+
+    while (!pending_.empty())
+    {
+        // every datagram may need its own iovec, they must not move once msgs point at them
+        iovecs.clear();
+        iovecs.reserve(std::min(pending_.size(), kSendBatch * kMaxGsoSegments));
+
+        size_t count = 0;
+        auto it = pending_.begin();
+        while (it != pending_.end() && count < kSendBatch && iovecs.size() < iovecs.capacity())
+        {
+            auto first = iovecs.size();
+            auto segment = it->buf->size();
+            size_t total = 0;
+            auto &endpoint = it->endpoint;
+
+            // same peer and same size, only the last segment of a GSO message may be shorter
+            do
+            {
+                iovecs.push_back({it->buf->data(), it->buf->size()});
+                total += it->buf->size();
+                auto size = it->buf->size();
+                ++it;
+                if (!is_gso_ || size != segment || segment > kMaxGsoSegmentSize)
+                {
+                    break;
+                }
+            } while (it != pending_.end() && it->endpoint == endpoint && iovecs.size() - first < kMaxGsoSegments &&
+                     iovecs.size() < iovecs.capacity() && total + it->buf->size() <= kMaxGsoBytes && it->buf->size() <= segment);
+
+            auto &hdr = msgs[count].msg_hdr;
+            hdr = {};
+            hdr.msg_name = const_cast<void *>(static_cast<const void *>(endpoint.data()));
+            hdr.msg_namelen = static_cast<socklen_t>(endpoint.size());
+            hdr.msg_iov = &iovecs[first];
+            hdr.msg_iovlen = iovecs.size() - first;
+
+            if (hdr.msg_iovlen > 1)
+            {
+                hdr.msg_control = controls[count].data();
+                hdr.msg_controllen = controls[count].size();
+                auto *cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                auto gso_size = static_cast<uint16_t>(segment);
+                std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+            }
+
+            datagrams[count] = hdr.msg_iovlen;
+            ++count;
+        }
+
+        int sent = ::sendmmsg(raw_fd_, msgs.data(), static_cast<unsigned>(count), MSG_DONTWAIT);
+        ++send_calls_;
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                do_write();
+                return;
+            }
+
+            if (errno == EIO && datagrams[0] > 1)
+            {
+                // the device cannot offload the segmentation, send every datagram on its own from now on
+                spdlog::warn("{} sendmmsg with UDP_SEGMENT failed, disable gso", info());
+                is_gso_ = false;
+                continue;
+            }
+
+            // the first message is rejected, e.g. too large or a refused peer, drop it and go on
+            spdlog::debug("{} sendmmsg received error {}, msg = {}", info(), errno, std::strerror(errno));
+            datagrams_dropped_ += datagrams[0];
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(datagrams[0]));
+            continue;
+        }
+
+        size_t sent_datagrams = 0;
+        for (size_t i = 0; i < static_cast<size_t>(sent); ++i)
+        {
+            sent_datagrams += datagrams[i];
+            bytes_sent_ += msgs[i].msg_len;
+        }
+        datagrams_sent_ += sent_datagrams;
+        pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(sent_datagrams));
+    }
+}
+
+void udp_server::expire_peers()
+{
+    if (!timers_)
+    {
+        return;
+    }
+
+    auto now = timers_->now_ms();
+    for (auto it = peers_.begin(); it != peers_.end();)
+    {
+        auto peer = it->second;
+        if (now - peer->last_recv_ms_ < kPeerIdleMs)
+        {
+            ++it;
+            continue;
+        }
+
+        spdlog::debug("{} has been idle for {} ms, drop it", peer->id(), now - peer->last_recv_ms_);
+        it = peers_.erase(it);
+        --peer_count_;
+        peer->on_close();
+    }
+}
+
+void udp_server::close()
+{
+    if (timers_ && expire_timer_)
+    {
+        timers_->cancel(expire_timer_);
+        expire_timer_ = 0;
+    }
+
+    boost::system::error_code ec;
+    socket_.close(ec);
+    pending_.clear();
+
+    auto peers = std::move(peers_);
+    peers_.clear();
+    peer_count_ = 0;
+    for (auto &[endpoint, peer] : peers)
+    {
+        peer->on_close();
+    }
+}
+
+udp_server::stats udp_server::get_stats() const
+{
+    stats s;
+    s.recv_calls = recv_calls_;
+    s.datagrams_received = datagrams_received_;
+    s.bytes_received = bytes_received_;
+    s.send_calls = send_calls_;
+    s.datagrams_sent = datagrams_sent_;
+    s.bytes_sent = bytes_sent_;
+    s.datagrams_dropped = datagrams_dropped_;
+    s.peers = peer_count_;
+    return s;
+}
+
+void udp_server::start_signal_listener()
+{
+    signals_.async_wait([this](boost::system::error_code, int signo) {
+        spdlog::info("{} received signal {}", info(), signo);
+        boost::asio::post(strand_, [this]() { close(); });
+        io_context_.stop();
+    });
+}
+
+} // namespace network
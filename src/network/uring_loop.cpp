@@ -0,0 +1,555 @@
+#include "uring_loop.h"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace network {
+
+static int io_uring_setup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// the group id of the provided buffers used by every multishot recv of a loop
+static constexpr uint16_t kRecvBufferGroup = 0;
+
+bool uring_loop::is_supported()
+{
+    static const bool supported = []() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int fd = io_uring_setup(4, &params);
+        if (fd < 0)
+        {
+            spdlog::warn("io_uring is not available, errno = {}", errno);
+            return false;
+        }
+
+        // provided buffer rings arrived in 5.19 together with multishot accept/recv (6.0)
+        io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        auto ring_size = sizeof(io_uring_buf) * 1;
+        void *ring = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        bool ok = (params.features & IORING_FEAT_NODROP) && (params.features & IORING_FEAT_FAST_POLL) && ring != MAP_FAILED;
+        if (ok)
+        {
+            reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+            reg.ring_entries = 1;
+            reg.bgid = kRecvBufferGroup;
+            ok = io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+        }
+
+        if (ring != MAP_FAILED)
+        {
+            ::munmap(ring, ring_size);
+        }
+        ::close(fd);
+
+        if (!ok)
+        {
+            spdlog::warn("io_uring lacks provided buffer rings or fast poll, kernel 6.0+ is required");
+        }
+        return ok;
+    }();
+
+    return supported;
+}
+
+uring_loop::ptr uring_loop::create(boost::asio::io_context &io_context, unsigned entries)
+{
+    auto loop = std::shared_ptr<uring_loop>(new uring_loop(io_context, entries));
+    loop->wait_completions();
+    return loop;
+}
+
+uring_loop::uring_loop(boost::asio::io_context &io_context, unsigned entries)
+    : io_context_{io_context}
+    , event_fd_{io_context}
+{
+    setup(entries);
+    setup_buffer_ring();
+
+    int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0)
+    {
+        throw std::runtime_error(fmt::format("cannot create eventfd for io_uring, errno = {}", errno));
+    }
+
+    if (io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+    {
+        ::close(efd);
+        throw std::runtime_error(fmt::format("cannot register eventfd to io_uring, errno = {}", errno));
+    }
+    event_fd_.assign(efd);
+
+    spdlog::info("io_uring loop created, ring fd = {}, entries = {}", ring_fd_, entries);
+}
+
+uring_loop::~uring_loop()
+{
+    if (buf_ring_)
+    {
+        ::munmap(buf_ring_, buf_ring_size_);
+    }
+    delete[] buf_base_;
+
+    if (sqes_)
+    {
+        ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+    {
+        ::munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_)
+    {
+        ::munmap(sq_ptr_, sq_size_);
+    }
+    if (ring_fd_ >= 0)
+    {
+        ::close(ring_fd_);
+    }
+}
+
+void uring_loop::setup(unsigned entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // multishot operations produce many completions per submission
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ring_fd_ = io_uring_setup(entries, &params);
+    if (ring_fd_ < 0)
+    {
+        throw std::runtime_error(fmt::format("io_uring_setup failed, errno = {}", errno));
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+
+    sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED)
+    {
+        sq_ptr_ = nullptr;
+        throw std::runtime_error("cannot map io_uring submission queue");
+    }
+
+    if (single_mmap)
+    {
+        cq_ptr_ = sq_ptr_;
+    }
+    else
+    {
+        cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED)
+        {
+            cq_ptr_ = nullptr;
+            throw std::runtime_error("cannot map io_uring completion queue");
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot map io_uring sqes");
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq_base = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+
+    auto cq_base = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.ring_mask);
+    cqes_ = cq_base + params.cq_off.cqes;
+}
+
+void uring_loop::setup_buffer_ring()
+{
+    buf_ring_size_ = sizeof(io_uring_buf) * kRecvBufferCount;
+    void *ring = ::mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot map io_uring buffer ring");
+    }
+    buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = kRecvBufferCount;
+    reg.bgid = kRecvBufferGroup;
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        throw std::runtime_error(fmt::format("cannot register io_uring buffer ring, errno = {}", errno));
+    }
+
+    buf_base_ = new char[static_cast<size_t>(kRecvBufferCount) * kRecvBufferSize];
+    for (unsigned i = 0; i < kRecvBufferCount; ++i)
+    {
+        recycle_buffer(static_cast<uint16_t>(i));
+    }
+}
+
+void uring_loop::recycle_buffer(uint16_t bid)
+{
+    // index the ring as a plain array, in C++ the flex array of io_uring_buf_ring is not placed at offset 0
+    auto &buf = reinterpret_cast<io_uring_buf *>(buf_ring_)[buf_tail_ & (kRecvBufferCount - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buf_base_ + static_cast<size_t>(bid) * kRecvBufferSize);
+    buf.len = kRecvBufferSize;
+    buf.bid = bid;
+    ++buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe *uring_loop::get_sqe()
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= *sq_mask_ + 1)
+    {
+        // the submission queue is full, hand it to the kernel now
+        submit();
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= *sq_mask_ + 1)
+        {
+            throw std::runtime_error("io_uring submission queue overflow");
+        }
+    }
+
+    unsigned index = sq_local_tail_ & *sq_mask_;
+    auto sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_local_tail_;
+    ++sq_pending_;
+    return sqe;
+}
+
+void uring_loop::prepare_accept(uint64_t token, int fd)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // keep the fd blocking, io_uring polls it internally while a nonblocking fd would surface -EAGAIN
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = token;
+    schedule_submit();
+}
+
+void uring_loop::prepare_recv(uint64_t token, int fd)
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kRecvBufferGroup;
+    sqe->user_data = token;
+    schedule_submit();
+}
+
+uint64_t uring_loop::accept(int listen_fd, accept_cb cb)
+{
+    std::lock_guard<std::recursive_mutex> lock(mtx_);
+    auto token = next_token_++;
+    auto op = std::make_unique<operation>();
+    op->type = Op_Type::accept;
+    op->fd = listen_fd;
+    op->on_accept = std::move(cb);
+    ops_.emplace(token, std::move(op));
+    prepare_accept(token, listen_fd);
+    return token;
+}
+
+uint64_t uring_loop::recv(int fd, recv_cb cb)
+{
+    std::lock_guard<std::recursive_mutex> lock(mtx_);
+    auto token = next_token_++;
+    auto op = std::make_unique<operation>();
+    op->type = Op_Type::recv;
+    op->fd = fd;
+    op->on_recv = std::move(cb);
+    ops_.emplace(token, std::move(op));
+    prepare_recv(token, fd);
+    return token;
+}
+
+uint64_t uring_loop::send(int fd, const iovec *iov, size_t count, send_cb cb)
+{
+    std::lock_guard<std::recursive_mutex> lock(mtx_);
+    auto token = next_token_++;
+    auto op = std::make_unique<operation>();
+    op->type = Op_Type::send;
+    op->fd = fd;
+    op->on_send = std::move(cb);
+    op->msg.msg_iov = const_cast<iovec *>(iov);
+    op->msg.msg_iovlen = count;
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&op->msg);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = token;
+
+    ops_.emplace(token, std::move(op));
+    schedule_submit();
+    return token;
+}
+
+void uring_loop::cancel(uint64_t token)
+{
+    std::lock_guard<std::recursive_mutex> lock(mtx_);
+    auto it = ops_.find(token);
+    if (it == ops_.end())
+    {
+        return;
+    }
+
+    // keep the operation until its last completion, the kernel may still use its msghdr
+    auto &op = it->second;
+    op->on_accept = nullptr;
+    op->on_recv = nullptr;
+    op->on_send = nullptr;
+
+    auto cancel_token = next_token_++;
+    auto cancel_op = std::make_unique<operation>();
+    cancel_op->type = Op_Type::cancel;
+    cancel_op->fd = -1;
+    ops_.emplace(cancel_token, std::move(cancel_op));
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = token;
+    sqe->user_data = cancel_token;
+    schedule_submit();
+}
+
+void uring_loop::schedule_submit()
+{
+    if (is_submit_scheduled_)
+    {
+        return;
+    }
+
+    is_submit_scheduled_ = true;
+    std::weak_ptr<uring_loop> weak_self = shared_from_this();
+    boost::asio::post(io_context_, [weak_self]() {
+        if (auto strong_self = weak_self.lock())
+        {
+            std::lock_guard<std::recursive_mutex> lock(strong_self->mtx_);
+            strong_self->is_submit_scheduled_ = false;
+            strong_self->submit();
+        }
+    });
+}
+
+void uring_loop::submit()
+{
+    if (!sq_pending_)
+    {
+        return;
+    }
+
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    auto to_submit = sq_pending_;
+
+    int ret = 0;
+    do
+    {
+        ret = io_uring_enter(ring_fd_, to_submit, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    ++enter_calls_;
+    if (ret < 0)
+    {
+        spdlog::error("io_uring_enter failed, errno = {}", errno);
+        return;
+    }
+
+    submitted_ += static_cast<unsigned>(ret);
+    sq_pending_ -= std::min(sq_pending_, static_cast<unsigned>(ret));
+}
+
+void uring_loop::wait_completions()
+{
+    std::weak_ptr<uring_loop> weak_self = shared_from_this();
+    event_fd_.async_wait(boost::asio::posix::stream_descriptor::wait_read, [weak_self](boost::system::error_code ec) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self || ec)
+        {
+            return;
+        }
+
+        uint64_t value = 0;
+        while (::read(strong_self->event_fd_.native_handle(), &value, sizeof(value)) > 0)
+        {}
+
+        strong_self->reap();
+        strong_self->wait_completions();
+    });
+}
+
+void uring_loop::reap()
+{
+    std::lock_guard<std::recursive_mutex> lock(mtx_);
+
+    unsigned head = *cq_head_;
+    for (;;)
+    {
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            break;
+        }
+
+        auto cqe = static_cast<io_uring_cqe *>(cqes_) + (head & *cq_mask_);
+        auto token = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        ++head;
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        ++completed_;
+
+        auto it = ops_.find(token);
+        if (it == ops_.end())
+        {
+            if (flags & IORING_CQE_F_BUFFER)
+            {
+                recycle_buffer(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            continue;
+        }
+
+        auto &op = *it->second;
+        bool has_more = flags & IORING_CQE_F_MORE;
+
+        switch (op.type)
+        {
+        case Op_Type::accept: {
+            if (!op.on_accept)
+            {
+                if (res >= 0)
+                {
+                    ::close(res);
+                }
+                break;
+            }
+
+            auto cb = op.on_accept;
+            cb(res);
+
+            // the callback starts a session whose recv() may rehash ops_, look the accept up again
+            auto current = ops_.find(token);
+            if (current == ops_.end())
+            {
+                continue;
+            }
+
+            if (!has_more && res != -ECANCELED && current->second->on_accept)
+            {
+                // the multishot accept ended, e.g. because of -ENFILE, arm it again
+                prepare_accept(token, current->second->fd);
+                continue;
+            }
+            break;
+        }
+
+        case Op_Type::recv: {
+            const char *data = nullptr;
+            uint16_t bid = 0;
+            bool has_buffer = flags & IORING_CQE_F_BUFFER;
+            if (has_buffer)
+            {
+                bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                data = buf_base_ + static_cast<size_t>(bid) * kRecvBufferSize;
+            }
+
+            // out of provided buffers, the kernel stopped this multishot recv, arm it again
+            bool rearm = res == -ENOBUFS && op.on_recv;
+
+            if (op.on_recv && res != -ENOBUFS)
+            {
+                auto cb = op.on_recv;
+                cb(res, data);
+            }
+
+            if (has_buffer)
+            {
+                recycle_buffer(bid);
+            }
+
+            auto current = ops_.find(token);
+            if (current == ops_.end())
+            {
+                continue;
+            }
+
+            if (!has_more && (rearm || (res > 0 && current->second->on_recv)))
+            {
+                prepare_recv(token, current->second->fd);
+                continue;
+            }
+            break;
+        }
+
+        case Op_Type::send: {
+            if (op.on_send)
+            {
+                auto cb = std::move(op.on_send);
+                cb(res);
+            }
+            break;
+        }
+
+        case Op_Type::cancel:
+        default:
+            break;
+        }
+
+        if (!has_more)
+        {
+            ops_.erase(token);
+        }
+    }
+}
+
+uring_loop::stats uring_loop::get_stats() const
+{
+    return stats{enter_calls_, submitted_, completed_};
+}
+
+} // namespace network
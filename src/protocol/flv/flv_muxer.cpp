@@ -16,6 +16,19 @@ flv_muxer::ptr flv_muxer::create()
 
 flv_muxer::~flv_muxer()
 {
+    if (!id_.empty())
+    {
+        auto &st = budget_.stats();
+        spdlog::info("{} stopped, sent packets = {}, dropped packets = {}, dropped bytes = {}, overflows = {}", id_, st.sent_packets,
+            st.dropped_packets, st.dropped_bytes, st.overflows);
+        if (pacer_.is_enabled())
+        {
+            auto &pacing = pacer_.stats();
+            spdlog::info("{} pacing rate = {} bytes/s, stream rate = {} bytes/s, rate updates = {}", id_, pacing.rate, pacing.stream_rate,
+                pacing.updates);
+        }
+    }
+
     if (auto strong_client_reader = weak_client_reader_.lock())
     {
         strong_client_reader->leave();
@@ -30,17 +43,14 @@ void flv_muxer::start_muxing(network::socket_sender *sender, std::weak_ptr<netwo
         throw std::runtime_error("flv cannot mux with invalid sources");
     }
 
-    // 1. send flv header
-    auto header_ptr = prepare_flv_header();
-    sender->send(header_ptr->data(), header_ptr->size(), true);
-    char first_tag_size[4] = {0};
-    sender->send(first_tag_size, sizeof(first_tag_size), true);
+    // 1. send flv header, followed by the first previous tag size which is always 0
+    sender->send(prepare_flv_header());
 
     // 2. send metadata
     auto &metadata = *rtmp_src_ptr->get_metadata();
     rtmp::AMFEncoder encoder;
     encoder << "onMetaData" << metadata;
-    write_flv(sender, tag_type::Script_Data, encoder.c_str(), encoder.size());
+    write_flv(sender, tag_type::Script_Data, std::make_shared<network::buffer_string>(encoder.data()));
 
     // 3. send config frame
     rtmp_src_ptr->loop_config_frame([this, sender](const rtmp::rtmp_packet::ptr &ptr) {
@@ -49,8 +59,7 @@ void flv_muxer::start_muxing(network::socket_sender *sender, std::weak_ptr<netwo
             return;
         }
 
-        write_flv(sender, ptr->is_audio_pkt() ? tag_type::Audio_Data : tag_type::Video_data, ptr->buf()->data(),
-            ptr->buf()->unread_length(), ptr->time_stamp);
+        write_flv(sender, ptr);
     });
 
     auto pkt_dispatcher = rtmp_src_ptr->get_dispatcher();
@@ -61,38 +70,55 @@ void flv_muxer::start_muxing(network::socket_sender *sender, std::weak_ptr<netwo
     // 5. set read_cb
     std::weak_ptr<flv_muxer> weak_self = shared_from_this();
 
-    client_reader_ptr->set_read_cb([sender, start_pts, weak_self](const rtmp::rtmp_packet::ptr &pkt) {
+    client_reader_ptr->set_read_cb([sender, start_pts, weak_self, weak_session](const rtmp::rtmp_packet::ptr &pkt) {
         if (start_pts > 0 && pkt->time_stamp < start_pts)
         {
             return;
         }
 
         auto strong_self = weak_self.lock();
-        if (!strong_self)
+        auto strong_session = weak_session.lock();
+        if (!strong_self || !strong_session)
+        {
+            return;
+        }
+
+        strong_self->write_live(sender, *strong_session, pkt);
+    });
+
+    // the whole replay is queued at once, it is not lag of the viewer
+    client_reader_ptr->set_replayed_cb([weak_self, weak_session]() {
+        auto strong_self = weak_self.lock();
+        auto strong_session = weak_session.lock();
+        if (!strong_self || !strong_session)
         {
             return;
         }
 
-        strong_self->write_flv(sender, tag_type(pkt->msg_type_id), pkt->buf()->data(), pkt->buf()->unread_length(), pkt->time_stamp);
+        strong_self->is_live_ = true;
+        strong_self->budget_.skip_until(strong_session->bytes_sent() + strong_session->bytes_queued());
     });
 
     client_reader_ptr->set_detach([weak_session](bool is_normal) {
         if (auto strong_session = weak_session.lock())
         {
-            strong_session->shutdown();
+            strong_session->post_shutdown();
         }
     });
 
+    weak_src_ = rtmp_src_ptr;
     pkt_dispatcher->regist_reader(client_reader_ptr);
 
     weak_client_reader_ = client_reader_ptr;
+    id_ = client_reader_ptr->id();
 }
 
 network::buffer_raw::ptr flv_muxer::prepare_flv_header()
 {
     auto buffer_ptr = pool_->obtain();
-    buffer_ptr->set_capacity(sizeof(flv_header));
-    buffer_ptr->set_size(sizeof(flv_header));
+    buffer_ptr->set_capacity(sizeof(flv_header) + sizeof(uint32_t));
+    buffer_ptr->set_size(sizeof(flv_header) + sizeof(uint32_t));
+    std::memset(buffer_ptr->data(), 0, buffer_ptr->size());
 
     flv_header *header = reinterpret_cast<flv_header *>(buffer_ptr->data());
     std::memset(header, 0, sizeof(flv_header));
@@ -125,23 +151,85 @@ network::buffer_raw::ptr flv_muxer::prepare_flv_tag_header(tag_type t, size_t bo
     return buffer_ptr;
 }
 
-void flv_muxer::write_flv(network::socket_sender *sender, tag_type t, const char *data, size_t size, uint32_t time_stamp)
+network::buffer_raw::ptr flv_muxer::prepare_previous_tag_size(size_t tag_size)
 {
-    if (!sender || !data || !size)
+    auto buffer_ptr = pool_->obtain();
+    buffer_ptr->set_capacity(sizeof(uint32_t));
+    buffer_ptr->set_size(sizeof(uint32_t));
+    util::set_be32(buffer_ptr->data(), static_cast<uint32_t>(tag_size));
+    return buffer_ptr;
+}
+
+void flv_muxer::write_flv(network::socket_sender *sender, tag_type t, network::buffer::ptr body, uint32_t time_stamp)
+{
+    if (!sender || !body || !body->size())
     {
         throw std::runtime_error("cannot write flv with invalid source or data");
     }
 
+    auto size = body->size();
     auto tag_header_ptr = prepare_flv_tag_header(t, size, time_stamp);
-    // send header
-    sender->send(tag_header_ptr->data(), tag_header_ptr->size(), true);
-    // send body
-    sender->send(data, size, true);
-    // send tag
-    uint32_t total_size = htonl(static_cast<uint32_t>(tag_header_ptr->size() + size));
-    char size_arr[4];
-    std::memcpy(size_arr, &total_size, sizeof(total_size));
-    sender->send(size_arr, sizeof(size_arr), true);
+    auto tag_size_ptr = prepare_previous_tag_size(tag_header_ptr->size() + size);
+    sender->send({std::move(tag_header_ptr), std::move(body), std::move(tag_size_ptr)});
+}
+
+void flv_muxer::write_flv(network::socket_sender *sender, const rtmp::rtmp_packet::ptr &pkt)
+{
+    if (!pkt || (!pkt->is_audio_pkt() && !pkt->is_video_pkt()))
+    {
+        return;
+    }
+
+    // the block of the payload stays alive until the socket has written it, the tag body is never copied
+    write_flv(sender, pkt->is_audio_pkt() ? tag_type::Audio_Data : tag_type::Video_data, network::buffer_slice::create(pkt->payload()),
+        pkt->time_stamp);
+}
+
+void flv_muxer::write_live(network::socket_sender *sender, network::session &sess, const rtmp::rtmp_packet::ptr &pkt)
+{
+    if (!is_live_)
+    {
+        write_flv(sender, pkt);
+        return;
+    }
+
+    // sequence headers are never dropped, the decoder cannot recover without them
+    if (!pkt->is_config_frame())
+    {
+        auto overflows = budget_.stats().overflows;
+        auto verdict = budget_.admit(sess.bytes_sent(), sess.bytes_queued(), pkt->time_stamp, pkt->payload().size(),
+            pkt->is_video_pkt(), pkt->is_video_keyframe(), pkt->is_non_reference_frame());
+
+        auto &st = budget_.stats();
+        if (st.overflows != overflows)
+        {
+            spdlog::warn("{} is lagging behind, lag = {} bytes / {} ms, policy = {}", id_, st.lag_bytes, st.lag_ms,
+                magic_enum::enum_name(budget_.policy()));
+        }
+
+        if (verdict == media::send_budget::Verdict::drop)
+        {
+            return;
+        }
+
+        if (verdict == media::send_budget::Verdict::disconnect)
+        {
+            sess.post_shutdown();
+            return;
+        }
+    }
+
+    // the replay leaves at line rate, pacing it would hold the viewer behind for about twice its duration
+    if (budget_.is_skip_drained(sess.bytes_sent()) && pacer_.is_due())
+    {
+        if (auto strong_src = weak_src_.lock())
+        {
+            pacer_.update(sess, strong_src->get_total_bytes_speed());
+        }
+    }
+
+    write_flv(sender, pkt);
+    budget_.on_queued(sess.bytes_sent() + sess.bytes_queued(), pkt->time_stamp);
 }
 
 } // namespace flv
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "http_protocol.h"
 
+#include "media/bandwidth_governor.h"
 #include "media/media_source.h"
+#include "util/config.h"
 #include "util/util.h"
 
 namespace http {
@@ -13,7 +15,11 @@ http_protocol::http_protocol()
 
 http_protocol::~http_protocol()
 {
-    spdlog::info("Client {} stopped pulling from {}", header_->token(), header_->info());
+    // the connection may be closed before a request has been parsed
+    if (header_)
+    {
+        spdlog::info("Client {} stopped pulling from {}", header_->token(), header_->info());
+    }
 }
 
 void http_protocol::on_parse_http(network::flat_buffer &buf)
@@ -113,6 +119,14 @@ void http_protocol::start_flv_muxing(std::weak_ptr<network::session> session_ptr
         return;
     }
 
+    // viewers already playing keep their bandwidth, a new one comes back later or goes to another edge
+    auto &governor = media::egress_governor::instance();
+    if (!governor.admit(header_->vhost(), media_src_ptr->get_total_bytes_speed()))
+    {
+        send_response(Status::Service_Unavailable, true, nullptr, 0, nullptr, {{"Retry-After", "5"}});
+        return;
+    }
+
     // send flv response header
     std::multimap<std::string, std::string> res_header{{"Cache-Control", "no-store"}};
     send_response(Status::OK, false, nullptr, 0, "video/x-flv", res_header);
@@ -120,6 +134,16 @@ void http_protocol::start_flv_muxing(std::weak_ptr<network::session> session_ptr
     // lazy initialization
     flv_muxer_ = flv::flv_muxer::create();
     auto rtmp_src_ptr = std::dynamic_pointer_cast<rtmp::rtmp_media_source>(media_src_ptr);
+    // a player sends nothing after its request, it is only alive as long as it drains what is queued for it
+    if (auto strong_session = session_ptr.lock())
+    {
+        strong_session->set_idle_timeout(util::server_config::instance().play_idle_timeout_ms(), network::Idle_Policy::send);
+        if (governor.is_enabled())
+        {
+            governor.add_viewer(header_->vhost(), strong_session);
+        }
+    }
+
     flv_muxer_->start_muxing(this, std::move(session_ptr), std::move(rtmp_src_ptr), header_, header_->start_pts());
 }
 
@@ -172,13 +196,14 @@ void http_protocol::send_response(Status status, bool is_close, const char *http
 
     res += kHttpLineBreak;
 
-    // if no http body, just close
-    send(res.c_str(), res.size(), true, is_close);
-
+    // header and body are queued together, the session closes after both have been written
+    socket_sender::buffer_list bufs{std::make_shared<network::buffer_string>(std::move(res))};
     if (has_response_body)
     {
-        send(http_body, body_size, true, close);
+        bufs.emplace_back(std::make_shared<network::buffer_raw>(http_body, body_size));
     }
+
+    send(std::move(bufs), is_close);
 }
 
 } // namespace http
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "http_session.h"
 
+#include "util/config.h"
+
 namespace http {
 
 http_session::ptr http_session::create(SESSION_CONSTRUCTOR_PARAMS)
@@ -9,6 +11,8 @@ http_session::ptr http_session::create(SESSION_CONSTRUCTOR_PARAMS)
 
 void http_session::start()
 {
+    // the request has to arrive before the deadline
+    set_idle_timeout(util::server_config::instance().handshake_timeout_ms(), network::Idle_Policy::deadline);
     do_read();
 }
 
@@ -21,15 +25,23 @@ std::weak_ptr<network::session> http_session::get_session()
     return shared_from_this();
 }
 
-void http_session::send(const char *data, size_t size, bool is_async, bool is_close)
+void http_session::send(const char *data, size_t size, bool, bool is_close)
 {
-    network::session::do_write(data, size, is_async, is_close);
+    network::session::do_write(data, size, is_close);
 }
 
-void http_session::on_recv(network::flat_buffer &buf)
+void http_session::send(network::buffer::ptr buf, bool is_close)
+{
+    network::session::do_write(std::move(buf), is_close);
+}
+
+void http_session::send(buffer_list bufs, bool is_close)
 {
-    ticker_.reset_time();
+    network::session::do_write(std::move(bufs), is_close);
+}
 
+void http_session::on_recv(network::flat_buffer &buf)
+{
     try
     {
         // send the packet to the http parser
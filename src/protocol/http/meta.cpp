@@ -18,6 +18,8 @@ const char *code_to_msg(Status status)
         return "Not Found";
     case Status::Internal_Server_Error:
         return "Internal Server Error";
+    case Status::Service_Unavailable:
+        return "Service Unavailable";
     default:
         return "";
     }
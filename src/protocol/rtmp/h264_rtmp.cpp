@@ -1,6 +1,7 @@
 #include "h264_rtmp.h"
 #include "codec/h264/h264_frame.h"
 #include "codec/h264/h264_track.h"
+#include "util/util.h"
 
 namespace rtmp {
 
@@ -16,13 +17,12 @@ void h264_rtmp_decoder::input_rtmp(rtmp_packet::ptr pkt)
     }
 
     // tag header(1 byte) + packet type(1 byte) + composition time(3 bytes)
-    const auto &buf = pkt->buf();
-    buf->require_length_or_fail(5);
+    const auto &payload = pkt->payload();
+    payload.require_length_or_fail(5);
 
     // if the frame is sps/pps
     if (pkt->is_config_frame())
     {
-        buf->consume_or_fail(5);
         const auto track_ptr = get_track();
         if (!track_ptr)
         {
@@ -36,54 +36,43 @@ void h264_rtmp_decoder::input_rtmp(rtmp_packet::ptr pkt)
             throw std::runtime_error("The video track cannot be cast to h264 track in h264_rtmp_decoder");
         }
 
-        h264_track_ptr->parse_config(*buf);
+        h264_track_ptr->parse_config(payload.sub(5));
         return;
     }
 
-    // if not pps/sps, skip tag header(1 byte) and packet type(1 byte)
-    buf->consume_or_fail(2);
-
     // https://github.com/FFmpeg/FFmpeg/blob/master/libavformat/flvdec.c 1293
-    uint8_t *cts_ptr = reinterpret_cast<uint8_t *>(buf->data());
-    int32_t cts = (((cts_ptr[0] << 16) | (cts_ptr[1] << 8) | (cts_ptr[2])) + 0xff800000) ^ 0xff800000;
+    int32_t cts = (((payload[2] << 16) | (payload[3] << 8) | (payload[4])) + 0xff800000) ^ 0xff800000;
     uint32_t pts = pkt->time_stamp + cts;
-    buf->consume_or_fail(3);
-    split_nal_frame(buf, pkt->time_stamp, pts);
+    split_nal_frame(payload.sub(5), pkt->time_stamp, pts);
 }
 
-/// @brief split rtmp frame by frame length, not prefix
-void h264_rtmp_decoder::split_nal_frame(const network::flat_buffer::ptr &buf, uint32_t dts, uint32_t pts)
+/// @brief split rtmp frame by frame length, not prefix, each frame is a slice of the packet starting at its avcc length
+void h264_rtmp_decoder::split_nal_frame(const network::slice &buf, uint32_t dts, uint32_t pts)
 {
-    static_assert(sizeof(codec::kH264HeaderPrefix) == 5);
-
     const auto track_ptr = get_track();
 
-    while (buf->unread_length() >= 4)
+    size_t offset = 0;
+    while (buf.size() - offset >= 4)
     {
-        auto frame_len = buf->read_uint32();
-        if (frame_len > buf->unread_length())
+        size_t frame_len = util::load_be32(buf.data() + offset);
+        if (frame_len > buf.size() - offset - 4)
         {
             break;
         }
 
-        auto h264_frame_len = sizeof(codec::kH264HeaderPrefix) - 1 + frame_len;
-        auto ptr = network::flat_buffer::create(h264_frame_len);
-        ptr->write(codec::kH264HeaderPrefix, sizeof(codec::kH264HeaderPrefix) - 1);
-        ptr->write(buf->data(), frame_len);
-        buf->consume_or_fail(frame_len);
-
         codec::h264_frame hr;
         hr.set_prefix_size(4);
         hr.set_dts(dts);
         hr.set_pts(pts);
-        hr.set_data(ptr);
+        hr.set_data(buf.sub(offset, 4 + frame_len));
+        offset += 4 + frame_len;
 
         track_ptr->input_frame(hr);
     }
 
-    if (buf->unread_length())
+    if (offset != buf.size())
     {
-        spdlog::error("Error while splitting H.264 frames\n {}", buf->dump());
+        spdlog::error("Error while splitting H.264 frames at {} of {} bytes", offset, buf.size());
         throw std::runtime_error("H.264 frames are encoded incorrectly");
     }
 }
@@ -91,8 +91,6 @@ void rtmp_demuxer::input_rtmp(rtmp_packet::ptr pkt)
         return;
     }
 
-    pkt->buf()->capture_snapshot();
-
     if (pkt->msg_type_id == MSG_VIDEO && video_rtmp_decoder_)
     {
         video_rtmp_decoder_->input_rtmp(pkt);
@@ -101,8 +99,6 @@ void rtmp_demuxer::input_rtmp(rtmp_packet::ptr pkt)
     {
         audio_rtmp_decoder_->input_rtmp(pkt);
     }
-
-    pkt->buf()->restore_snapshot();
 }
 
 } // namespace rtmp
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "rtmp_media_source.h"
 
+#include "util/config.h"
+
 namespace rtmp {
 
 rtmp_media_source::ptr rtmp_media_source::create(media::media_info::ptr info)
@@ -12,6 +14,70 @@ rtmp_media_source::ptr rtmp_media_source::create(media::media_info::ptr info)
     return std::shared_ptr<rtmp_media_source>(new rtmp_media_source(info));
 }
 
+void rtmp_media_source::load_metadata(AMFDecoder &dec, metadata_map &meta_data)
+{
+    std::string type = dec.load<std::string>();
+    // for obs
+    if (type == "@setDataFrame")
+    {
+        // the first one is string
+        type = dec.load<std::string>();
+    }
+
+    // flv files and the shared memory ingest carry the onMetaData alone
+    if (type != "onMetaData")
+    {
+        return;
+    }
+
+    // an ecma array with its count from encoders, a plain object from some muxers
+    if (AMF0Type::AMF_ECMA_ARRAY == dec.peek_front())
+    {
+        dec.data()->consume_or_fail(5);
+    }
+    else if (AMF0Type::AMF_OBJECT == dec.peek_front())
+    {
+        dec.data()->consume_or_fail(1);
+    }
+    else
+    {
+        throw std::runtime_error("onMetaData carries neither an ecma array nor an object");
+    }
+
+    std::string key;
+    std::any value;
+
+    while (true)
+    {
+        key = std::move(dec.load_key());
+        if (key.empty())
+        {
+            break;
+        }
+
+        uint8_t value_type = dec.peek_front();
+        if (AMF0Type::AMF_NUMBER == value_type)
+        {
+            value = dec.load<double>();
+        }
+        else if (AMF0Type::AMF_BOOLEAN == value_type)
+        {
+            value = dec.load<bool>();
+        }
+        else if (AMF0Type::AMF_STRING == value_type)
+        {
+            value = dec.load<std::string>();
+        }
+
+        meta_data.emplace(key, value);
+    }
+
+    if (AMF0Type::AMF_OBJECT_END != dec.pop_front())
+    {
+        throw std::runtime_error("expected an object end");
+    }
+}
+
 rtmp_media_source::rtmp_media_source(media::media_info::ptr info)
     : media_source(std::move(info))
 {
@@ -25,7 +91,17 @@ void rtmp_media_source::init_tracks(std::unordered_map<std::string, std::any> *m
     meta_data_ = meta_data;
 
     // init dispatcher after tracks have been initialized
-    dispatcher_ = rtmp_dispatcher::create();
+    auto &conf = util::server_config::instance();
+    auto mode = media::Dispatch_Mode::list;
+    if (conf.is_ring_dispatcher())
+    {
+        mode = media::Dispatch_Mode::ring;
+    }
+    else if (conf.is_affinity_dispatcher())
+    {
+        mode = media::Dispatch_Mode::affinity;
+    }
+    dispatcher_ = rtmp_dispatcher::create(rtmp_dispatcher::kMaxPacketCacheSize, mode, demuxer_->has_video());
 }
 
 rtmp_media_source::metadata_map *rtmp_media_source::get_metadata()
@@ -67,6 +143,7 @@ void rtmp_media_source::process_av_packet(rtmp_packet::ptr pkt)
     bool is_video = pkt->msg_type_id == MSG_VIDEO;
     auto track_index = magic_enum::enum_integer(is_video ? codec::Track_Type::Video : codec::Track_Type::Audio);
     speed_[track_index] += pkt->size();
+    update_total_bytes_speed();
 
     // update timestamp for audio/video tracks
     track_stamps_[track_index] = pkt->time_stamp;
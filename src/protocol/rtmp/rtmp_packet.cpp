@@ -1,4 +1,5 @@
 #include "rtmp_packet.h"
+#include "util/util.h"
 
 #include <array>
 #include <stdexcept>
@@ -18,27 +19,70 @@ rtmp_handshake::rtmp_handshake()
 }
 
 // rtmp_packet
+const util::resource_pool<rtmp_packet>::ptr &rtmp_packet::local_pool()
+{
+    static thread_local auto pool = util::resource_pool<rtmp_packet>::create(
+        kPoolSize, []() { return new rtmp_packet; }, [](rtmp_packet &pkt) { pkt.reset(); });
+    return pool;
+}
+
 rtmp_packet::ptr rtmp_packet::create()
 {
-    return std::shared_ptr<rtmp_packet>(new rtmp_packet);
+    return local_pool()->obtain();
+}
+
+size_t rtmp_packet::pool_allocations()
+{
+    return local_pool()->allocations();
 }
 
-rtmp_packet::rtmp_packet()
+rtmp_packet::rtmp_packet() = default;
+
+void rtmp_packet::reset()
 {
-    buf_ = std::make_shared<network::flat_buffer>();
+    is_abs_stamp = false;
+    chunk_stream_id = 0;
+    msg_stream_id = 0;
+    msg_length = 0;
+    msg_type_id = 0;
+    ts_delta = 0;
+    time_stamp = 0;
+    writer_ = network::block_writer();
+    payload_ = network::slice();
+    pkt_header_length_ = 0;
 }
 
-const network::flat_buffer::ptr rtmp_packet::buf()
+void rtmp_packet::append(const char *data, size_t size)
 {
-    if (!buf_)
+    if (!writer_.is_allocated())
     {
-        throw std::runtime_error("rtmp_packet has empty buffer");
+        writer_ = network::block_writer(msg_length);
     }
 
-    return buf_;
+    writer_.write(data, size);
+}
+
+size_t rtmp_packet::received() const
+{
+    return writer_.is_allocated() ? writer_.size() : payload_.size();
+}
+
+void rtmp_packet::seal()
+{
+    payload_ = writer_.seal();
+}
+
+void rtmp_packet::set_payload(network::slice payload)
+{
+    payload_ = std::move(payload);
+}
+
+const network::slice &rtmp_packet::payload() const
+{
+    return payload_;
 }
 
-// restore everything except buf_ data
+// restore everything except the payload
 rtmp_packet &rtmp_packet::restore_context(const rtmp_packet &other)
 {
     is_abs_stamp = other.is_abs_stamp;
@@ -61,7 +105,7 @@ bool rtmp_packet::is_video_keyframe() const
     }
 
     // enhanced-rtmp.pdf P7 parse flv video tagheader
-    uint8_t flv_tag_header = buf_->peek_uint8();
+    uint8_t flv_tag_header = peek_tag_header();
     rtmp_av_frame_type frame_type;
     if ((flv_tag_header >> 4) & 0b1000)
     {
@@ -88,7 +132,7 @@ bool rtmp_packet::is_config_frame() const
         }
 
         // if the frame is keyframe
-        uint8_t flv_tag_header = buf_->peek_uint8();
+        uint8_t flv_tag_header = peek_tag_header();
         if ((flv_tag_header >> 4) & 0b1000)
         {
             // isExtHeader = true
@@ -104,9 +148,9 @@ bool rtmp_packet::is_config_frame() const
         auto av_codec_id = static_cast<rtmp_video_codec>(codec_id);
         if (av_codec_id == rtmp_video_codec::h264 || av_codec_id == rtmp_video_codec::h265)
         {
-            buf_->require_length_or_fail(2);
+            payload_.require_length_or_fail(2);
             // check if the frame is sps/pps
-            return (rtmp_h264_packet_type)(buf_->data()[1]) == rtmp_h264_packet_type::h264_config_header;
+            return (rtmp_h264_packet_type)(payload_[1]) == rtmp_h264_packet_type::h264_config_header;
         }
 
         return false;
@@ -114,7 +158,7 @@ bool rtmp_packet::is_config_frame() const
 
     if (msg_type_id == MSG_AUDIO)
     {
-        buf_->require_length_or_fail(2);
+        payload_.require_length_or_fail(2);
         auto codec_id = get_av_codec_id();
 
         /**
@@ -122,7 +166,52 @@ bool rtmp_packet::is_config_frame() const
          If the second packet is 01, it is a raw AAC audio packet.
          */
         return static_cast<rtmp_audio_codec>(codec_id) == rtmp_audio_codec::aac &&
-               (rtmp_aac_packet_type)(buf_->data()[1]) == rtmp_aac_packet_type::aac_config_header;
+               (rtmp_aac_packet_type)(payload_[1]) == rtmp_aac_packet_type::aac_config_header;
+    }
+
+    return false;
+}
+
+/// a video frame no other frame refers to, it can be dropped without breaking the decoder
+bool rtmp_packet::is_non_reference_frame() const
+{
+    if (msg_type_id != MSG_VIDEO || is_video_keyframe())
+    {
+        return false;
+    }
+
+    uint8_t flv_tag_header = peek_tag_header();
+    if (!((flv_tag_header >> 4) & 0b1000) && (rtmp_av_frame_type)(flv_tag_header >> 4) == rtmp_av_frame_type::disposable_inter_frame)
+    {
+        return true;
+    }
+
+    // tag header(1 byte) + packet type(1 byte) + composition time(3 bytes), then length prefixed nal units
+    if (get_av_codec_id() != rtmp_flv_codec_id::h264 || payload_.size() < 5 ||
+        (rtmp_h264_packet_type)(payload_[1]) != rtmp_h264_packet_type::h264_nalu)
+    {
+        return false;
+    }
+
+    auto ptr = reinterpret_cast<const uint8_t *>(payload_.data()) + 5;
+    auto remain = payload_.size() - 5;
+    while (remain > 4)
+    {
+        auto nal_len = util::load_be32(ptr);
+        if (!nal_len || nal_len > remain - 4)
+        {
+            return false;
+        }
+
+        // the first slice decides, nal_ref_idc == 0 means nothing refers to this picture
+        uint8_t nal_type = ptr[4] & 0x1F;
+        if (nal_type >= 1 && nal_type <= 5)
+        {
+            return ((ptr[4] >> 5) & 0x03) == 0;
+        }
+
+        ptr += 4 + nal_len;
+        remain -= 4 + nal_len;
     }
 
     return false;
@@ -130,7 +219,7 @@ bool rtmp_packet::is_config_frame() const
 
 rtmp_flv_codec_id rtmp_packet::get_av_codec_id() const
 {
-    uint8_t flv_tag_header = buf_->peek_uint8();
+    uint8_t flv_tag_header = peek_tag_header();
     switch (this->msg_type_id)
     {
     case MSG_VIDEO:
@@ -152,9 +241,15 @@ void rtmp_packet::set_pkt_header_length(size_t header_len)
     }
 }
 
-size_t rtmp_packet::size()
+size_t rtmp_packet::size() const
+{
+    return pkt_header_length_ + received();
+}
+
+uint8_t rtmp_packet::peek_tag_header() const
 {
-    return pkt_header_length_ += buf_->unread_length();
+    payload_.require_length_or_fail(1);
+    return payload_[0];
 }
 
 bool rtmp_packet::is_video_pkt() const
@@ -2,6 +2,7 @@
 
 #include "media/media_source.h"
 #include "flv/flv_muxer.h"
+#include "util/config.h"
 #include "util/util.h"
 #include <algorithm>
 
@@ -44,9 +45,7 @@ const char *rtmp_protocol::handle_C0C1(const char *data, size_t size)
         throw std::runtime_error("only version 3 is supported!");
     }
 
-#ifdef ENABLE_OPENSSL
-    // TODO add ssl support
-#else
+    // rtmps runs the same handshake, tls is terminated by the session before any rtmp byte arrives
     // send S0
     char s0 = 0x03;
     send(&s0, 1);
@@ -57,7 +56,6 @@ const char *rtmp_protocol::handle_C0C1(const char *data, size_t size)
 
     // send S2
     send(data + 1, kC1HandshakeSize);
-#endif
 
     next_step_func_ = [this](const char *data, size_t size) { return handle_C2(data, size); };
 
@@ -77,7 +75,7 @@ const char *rtmp_protocol::handle_C2(const char *data, size_t size)
 
     // send cmd
     set_chunk_size(4 * 1024);
-    send_acknowledgement(100 * 1024);
+    set_window_ack_size(100 * 1024);
     set_peer_bandwidth(100 * 1024);
 
     return split_rtmp(data + kC1HandshakeSize, size - kC1HandshakeSize);
@@ -219,9 +217,7 @@ const char *rtmp_protocol::split_rtmp(const char *data, size_t size)
             offset += 4;
         }
 
-        const auto &buf = chunk_data.buf();
-
-        auto remain_msg_len = chunk_data.msg_length - buf->unread_length();
+        auto remain_msg_len = chunk_data.msg_length - chunk_data.received();
         auto more = std::min(chunk_size_in_, (size_t)(remain_msg_len));
 
         if (size < header_length + offset + more)
@@ -229,26 +225,23 @@ const char *rtmp_protocol::split_rtmp(const char *data, size_t size)
             return ptr;
         }
 
+        // the only copy of the payload, from the read buffer of the session into the block of the message
         if (more)
         {
-            buf->write(ptr + header_length + offset, more);
+            chunk_data.append(ptr + header_length + offset, more);
         }
 
         ptr += header_length + offset + more;
         size -= header_length + offset + more;
         chunk_data.set_pkt_header_length(header_length + offset);
 
-        // check if meets the received threshold
+        // acknowledged by check_acknowledgement()
         bytes_recv_ += static_cast<uint32_t>(chunk_data.size());
-        if (windows_size_ > 0 && bytes_recv_ - bytes_recv_last_ >= windows_size_)
-        {
-            send_acknowledgement(bytes_recv_ - bytes_recv_last_);
-            bytes_recv_last_ = bytes_recv_;
-        }
 
         // if the frame is ready, then sent to handle chunk
-        if (chunk_data.msg_length == buf->unread_length())
+        if (chunk_data.msg_length == chunk_data.received())
         {
+            chunk_data.seal();
             msg_stream_id_ = chunk_data.msg_stream_id;
             chunk_data.time_stamp = time_stamp + (chunk_data.is_abs_stamp ? 0 : chunk_data.time_stamp);
 
@@ -268,6 +261,14 @@ const char *rtmp_protocol::split_rtmp(const char *data, size_t size)
     return ptr;
 }
 
+// the amf decoder consumes what it reads, commands and metadata are small and rare enough to be copied for it
+static network::flat_buffer::ptr to_flat_buffer(const network::slice &payload)
+{
+    auto buf = network::flat_buffer::create(payload.size());
+    buf->write(payload.data(), payload.size());
+    return buf;
+}
+
 /// after the packet has been splited, pass here to process
 void rtmp_protocol::handle_chunk(rtmp_packet::ptr ptr)
 {
@@ -276,16 +277,16 @@ void rtmp_protocol::handle_chunk(rtmp_packet::ptr ptr)
         return;
     }
 
-    const auto &buf = ptr->buf();
+    const auto &payload = ptr->payload();
 
     switch (ptr->msg_type_id)
     {
     case MSG_SET_CHUNK: {
-        if (buf->unread_length() < 4)
+        if (payload.size() < 4)
         {
             throw std::runtime_error("MSG_SET_CHUNK not enough data");
         }
-        chunk_size_in_ = util::load_be32(buf->data());
+        chunk_size_in_ = util::load_be32(payload.data());
         spdlog::debug("received MSG_SET_CHUNK {}", chunk_size_in_);
         break;
     }
@@ -295,7 +296,7 @@ void rtmp_protocol::handle_chunk(rtmp_packet::ptr ptr)
         // receiving bytes equal to the window size. The window size is the maximum
         // number of bytes that the sender sends without receiving acknowledgment
         // from the receiver
-        if (buf->unread_length() < 4)
+        if (payload.size() < 4)
         {
             throw std::runtime_error("MSG_ACK not enough data");
         }
@@ -303,16 +304,26 @@ void rtmp_protocol::handle_chunk(rtmp_packet::ptr ptr)
         break;
     }
 
+    case MSG_WIN_SIZE: {
+        if (payload.size() < 4)
+        {
+            throw std::runtime_error("MSG_WIN_SIZE not enough data");
+        }
+        windows_size_ = util::load_be32(payload.data());
+        spdlog::debug("received MSG_WIN_SIZE {}", windows_size_);
+        break;
+    }
+
     case MSG_CMD:
     case MSG_CMD3: {
-        AMFDecoder dec(buf, ptr->msg_type_id == MSG_CMD ? 0 : 3);
+        AMFDecoder dec(to_flat_buffer(payload), ptr->msg_type_id == MSG_CMD ? 0 : 3);
         on_process_cmd(dec);
         break;
     }
 
     case MSG_DATA:
     case MSG_DATA3: {
-        AMFDecoder dec(buf, ptr->msg_type_id == MSG_DATA ? 0 : 3);
+        AMFDecoder dec(to_flat_buffer(payload), ptr->msg_type_id == MSG_DATA ? 0 : 3);
         on_process_metadata(dec);
         break;
     }
@@ -502,6 +513,12 @@ void rtmp_protocol::on_amf_publish(AMFDecoder &dec)
     AMFEncoder encoder;
     encoder << "onStatus" << transaction_id_ << nullptr << status;
     send_rtmp(MSG_CMD, msg_stream_id_, encoder.data(), 0, CHUNK_CLIENT_REQUEST_BEFORE);
+
+    // the handshake deadline is over, from now on the publisher only has to keep sending
+    if (auto session_ptr = get_session().lock())
+    {
+        session_ptr->set_idle_timeout(util::server_config::instance().publish_idle_timeout_ms(), network::Idle_Policy::recv);
+    }
 }
 
 void rtmp_protocol::send_rtmp(
@@ -514,38 +531,35 @@ void rtmp_protocol::send_rtmp(
         throw std::runtime_error("only support type 1 chunk header");
     }
 
-    auto chunk_header = pool_->obtain();
-    chunk_header->set_capacity(sizeof(rtmp_header));
-    chunk_header->set_size(sizeof(rtmp_header));
+    bool has_extended_timestamp = time_stamp >= 0xFFFFFF;
+    size_t extended_length = has_extended_timestamp ? 4 : 0;
+    size_t chunk_count = (data.size() + chunk_size_out_ - 1) / chunk_size_out_;
+
+    // the whole message, type 0 header + chunks separated by type 3 headers, is written with a single send
+    size_t total_size = sizeof(rtmp_header) + data.size() + chunk_count * extended_length + (chunk_count ? chunk_count - 1 : 0);
+
+    auto chunk_buf = pool_->obtain();
+    chunk_buf->set_capacity(total_size);
+    chunk_buf->set_size(total_size);
+
     // convert to rtmp_header
-    rtmp_header *header = reinterpret_cast<rtmp_header *>(chunk_header->data());
+    rtmp_header *header = reinterpret_cast<rtmp_header *>(chunk_buf->data());
     header->fmt = 0;
     header->chunk_id = chunk_stream_id;
     header->msg_type_id = msg_type_id;
 
-    bool has_extended_timestamp = time_stamp >= 0xFFFFFF;
     util::set_be24(header->time_stamp, has_extended_timestamp ? 0xFFFFFF : time_stamp);
     util::set_be24(header->msg_length, static_cast<uint32_t>(data.size()));
     util::set_le32(header->msg_stream_id, msg_stream_id);
 
-    // send rtmp header
-    send(chunk_header->data(), chunk_header->size());
-
-    // for extended timestamp
-    char extended_timestamp[4] = {0};
-    if (has_extended_timestamp)
-    {
-        util::set_be32(extended_timestamp, time_stamp);
-    }
-
     // type 3 header for sending remaining bytes
     char header_pkt = 0;
     header_pkt |= chunk_stream_id;
     header_pkt |= 3 << 6;
 
+    char *out = chunk_buf->data() + sizeof(rtmp_header);
     auto ptr = data.data();
     size_t offset = 0;
-    size_t total_size = sizeof(rtmp_header);
 
     while (offset < data.size())
     {
@@ -553,28 +567,35 @@ void rtmp_protocol::send_rtmp(
         // header
         if (offset)
         {
-            send(&header_pkt, 1);
-            total_size += 1;
+            *out++ = header_pkt;
         }
 
         if (has_extended_timestamp)
         {
-            send(extended_timestamp, sizeof(extended_timestamp));
-            total_size += 4;
+            util::set_be32(out, time_stamp);
+            out += 4;
         }
 
         size_t chunk_size = std::min(chunk_size_out_, data.size() - offset);
-        send(ptr, chunk_size);
-        total_size += chunk_size;
+        std::memcpy(out, ptr, chunk_size);
+        out += chunk_size;
         offset += chunk_size;
         ptr += chunk_size;
     }
 
+    send(std::move(chunk_buf));
+
+    // the window is about received bytes, the peer acknowledges what is sent here
     bytes_sent_ += static_cast<uint32_t>(total_size);
-    if (windows_size_ > 0 && bytes_sent_ - bytes_sent_last_ >= windows_size_)
+}
+
+void rtmp_protocol::check_acknowledgement()
+{
+    if (windows_size_ > 0 && bytes_recv_ - bytes_recv_last_ >= windows_size_)
     {
-        send_acknowledgement(bytes_sent_ - bytes_sent_last_);
-        bytes_sent_last_ = bytes_sent_;
+        // the sequence number is the number of bytes received so far, it wraps at 4 GB
+        send_acknowledgement(static_cast<uint32_t>(bytes_recv_));
+        bytes_recv_last_ = bytes_recv_;
     }
 }
 
@@ -585,6 +606,13 @@ void rtmp_protocol::send_acknowledgement(uint32_t size)
     send_rtmp(MSG_ACK, msg_stream_id_, ack, 0, CHUNK_NETWORK);
 }
 
+void rtmp_protocol::set_window_ack_size(uint32_t size)
+{
+    size = htonl(size);
+    std::string win_size(reinterpret_cast<char *>(&size), sizeof(uint32_t));
+    send_rtmp(MSG_WIN_SIZE, msg_stream_id_, win_size, 0, CHUNK_NETWORK);
+}
+
 void rtmp_protocol::set_chunk_size(uint32_t size)
 {
     uint32_t len = htonl(size);
@@ -626,49 +654,7 @@ encoder "obs-output"
 */
 void rtmp_protocol::on_process_metadata(AMFDecoder &dec)
 {
-    std::string type = dec.load<std::string>();
-    // for obs
-    if (type == "@setDataFrame")
-    {
-        // the first one is string
-        type = dec.load<std::string>();
-        if (type == "onMetaData")
-        {
-            dec.data()->consume_or_fail(5);
-            std::string key;
-            std::any value;
-
-            while (true)
-            {
-                key = std::move(dec.load_key());
-                if (key.empty())
-                {
-                    break;
-                }
-
-                uint8_t value_type = dec.peek_front();
-                if (AMF0Type::AMF_NUMBER == value_type)
-                {
-                    value = dec.load<double>();
-                }
-                else if (AMF0Type::AMF_BOOLEAN == value_type)
-                {
-                    value = dec.load<bool>();
-                }
-                else if (AMF0Type::AMF_STRING == value_type)
-                {
-                    value = dec.load<std::string>();
-                }
-
-                meta_data_.emplace(key, value);
-            }
-
-            if (AMF0Type::AMF_OBJECT_END != dec.pop_front())
-            {
-                throw std::runtime_error("expected an object end");
-            }
-        }
-    }
+    rtmp_media_source::load_metadata(dec, meta_data_);
 
     if (!rtmp_source_)
     {
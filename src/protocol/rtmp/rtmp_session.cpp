@@ -1,5 +1,7 @@
 #include "rtmp_session.h"
 
+#include "util/config.h"
+
 namespace rtmp {
 
 rtmp_session::ptr rtmp_session::create(RTMP_CONSTRUCTOR_PARAMS)
@@ -11,24 +13,67 @@ rtmp_session::rtmp_session(RTMP_CONSTRUCTOR_PARAMS)
     : session(std::move(sock), session_prefix, manager)
 {}
 
+rtmp_session::~rtmp_session()
+{
+    if (ack_timer_ && timers())
+    {
+        timers()->cancel(ack_timer_);
+    }
+}
+
 void rtmp_session::start()
 {
+    // handshake, connect and publish have to be done before the deadline
+    set_idle_timeout(util::server_config::instance().handshake_timeout_ms(), network::Idle_Policy::deadline);
+
+    if (timers())
+    {
+        std::weak_ptr<rtmp_session> weak_self = std::static_pointer_cast<rtmp_session>(shared_from_this());
+        ack_timer_ = timers()->schedule_every(kAckCheckMs, [weak_self]() {
+            auto strong_self = weak_self.lock();
+            if (!strong_self)
+            {
+                return;
+            }
+
+            boost::asio::dispatch(strong_self->socket_.get_executor(), [strong_self]() { strong_self->check_acknowledgement(); });
+        });
+    }
+
     do_read();
 }
 
-void rtmp_session::send(const char *data, size_t size, bool is_async, bool is_close)
+std::weak_ptr<network::session> rtmp_session::get_session()
 {
-    network::session::do_write(data, size, is_async, is_close);
+    return shared_from_this();
 }
 
-void rtmp_session::on_recv(network::flat_buffer &buf)
+void rtmp_session::send(const char *data, size_t size, bool, bool is_close)
 {
-    ticker_.reset_time();
+    network::session::do_write(data, size, is_close);
+}
 
+void rtmp_session::send(network::buffer::ptr buf, bool is_close)
+{
+    network::session::do_write(std::move(buf), is_close);
+}
+
+void rtmp_session::send(buffer_list bufs, bool is_close)
+{
+    network::session::do_write(std::move(bufs), is_close);
+}
+
+void rtmp_session::on_recv(network::flat_buffer &buf)
+{
     try
     {
         // send the packet to the rtmp parser
         on_parse_rtmp(buf);
+
+        if (!is_buffer_switched_ && is_publishing())
+        {
+            switch_to_mirrored(buf);
+        }
     }
     catch (const std::exception &ex)
     {
@@ -39,4 +84,14 @@ void rtmp_session::on_recv(network::flat_buffer &buf)
     }
 }
 
+void rtmp_session::switch_to_mirrored(network::flat_buffer &buf)
+{
+    // ingest keeps a partial chunk in the read buffer after almost every read, a mirrored buffer wraps instead of moving it.
+    // Only publishers get one, each costs a memfd and two mappings counted against vm.max_map_count.
+    is_buffer_switched_ = true;
+    network::flat_buffer mirrored(kMaxBufferCacheSize, network::flat_buffer::Mode::mirrored);
+    mirrored.write(buf.data(), buf.unread_length());
+    buf = std::move(mirrored);
+}
+
 } // namespace rtmp
\ No newline at end of file
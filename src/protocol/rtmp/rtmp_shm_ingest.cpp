@@ -0,0 +1,385 @@
+#include "rtmp_shm_ingest.h"
+
+#include <spdlog/spdlog.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace rtmp {
+
+// shm_publisher
+shm_publisher::ptr shm_publisher::create(const executor_type &executor, int ring_fd, int event_fd, const std::string &url)
+{
+    // the eventfd is owned by the descriptor from here on, the ring fd is closed once it is mapped
+    auto publisher = std::shared_ptr<shm_publisher>(new shm_publisher(executor, ring_fd, event_fd));
+    publisher->publish(url);
+    return publisher;
+}
+
+shm_publisher::shm_publisher(const executor_type &executor, int ring_fd, int event_fd)
+    : control_{executor}
+    , event_{executor, event_fd}
+{
+    try
+    {
+        map_ring(ring_fd);
+    }
+    catch (...)
+    {
+        ::close(ring_fd);
+        throw;
+    }
+    ::close(ring_fd);
+}
+
+shm_publisher::~shm_publisher()
+{
+    if (mapped_)
+    {
+        ::munmap(mapped_, mapped_size_);
+    }
+}
+
+void shm_publisher::map_ring(int ring_fd)
+{
+    // a producer that shrinks the memfd after the handshake would fault the server on its next read
+    auto seals = ::fcntl(ring_fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK))
+    {
+        throw std::runtime_error("the ring is not sealed against shrinking");
+    }
+
+    struct stat st;
+    if (::fstat(ring_fd, &st) < 0 || st.st_size <= 0)
+    {
+        throw std::runtime_error(fmt::format("cannot read the size of the ring, error = {}", std::strerror(errno)));
+    }
+
+    mapped_size_ = static_cast<size_t>(st.st_size);
+    auto *mapped = ::mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        throw std::runtime_error(fmt::format("cannot map the ring, error = {}", std::strerror(errno)));
+    }
+    mapped_ = mapped;
+
+    if (!ring_.attach(mapped_, mapped_size_))
+    {
+        throw std::runtime_error("the shared memory does not hold a ring of this version");
+    }
+}
+
+void shm_publisher::publish(const std::string &url)
+{
+    // app/stream?vhost=...&token=..., the same as the tcUrl app and the publish name of rtmp
+    auto slash = url.find('/');
+    if (slash == std::string::npos)
+    {
+        throw std::invalid_argument(fmt::format("shm ingest url {} has no app", url));
+    }
+
+    media_info_ = media::media_info::create(media::kRTMP_SCHEMA);
+    media_info_->set_app(url.substr(0, slash));
+    media_info_->parse_stream(url.substr(slash + 1));
+    if (!media_info_->is_complete())
+    {
+        throw std::invalid_argument(fmt::format("shm ingest url {} needs an app, a stream and a vhost", url));
+    }
+
+    auto [media_ptr, has_created] =
+        media::media_source::find(media_info_->schema(), media_info_->vhost(), media_info_->app(), media_info_->stream_id());
+    if (media_ptr)
+    {
+        rtmp_source_ = std::dynamic_pointer_cast<rtmp_media_source>(media_ptr);
+        if (!rtmp_source_)
+        {
+            throw std::runtime_error(fmt::format("{} is not rtmp source", media_info_->info()));
+        }
+    }
+    else
+    {
+        rtmp_source_ = rtmp_media_source::create(media_info_);
+    }
+
+    src_ownership_ = rtmp_source_->get_ownership();
+    if (!src_ownership_)
+    {
+        throw std::runtime_error(fmt::format("cannot get ownership of {}", media_info_->info()));
+    }
+
+    id_ = fmt::format("SHM[{}]", media_info_->info());
+}
+
+void shm_publisher::start(boost::asio::local::stream_protocol::socket control)
+{
+    control_ = std::move(control);
+
+    // a few bytes into the empty buffer of a new socket, this never blocks
+    network::shm::hello_reply reply;
+    ::send(control_.native_handle(), &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    spdlog::info("{} started, ring of {} bytes", id_, ring_.capacity());
+    wait_close();
+    wait_event();
+}
+
+void shm_publisher::wait_event()
+{
+    auto self = shared_from_this();
+    event_.async_read_some(boost::asio::buffer(&event_value_, sizeof(event_value_)), [this, self](boost::system::error_code ec, size_t) {
+        if (is_stopped_)
+        {
+            return;
+        }
+
+        if (ec)
+        {
+            stop(fmt::format("eventfd error {}", ec.message()));
+            return;
+        }
+
+        drain();
+    });
+}
+
+void shm_publisher::wait_close()
+{
+    // the producer sends nothing after its hello, anything readable is the end of the stream
+    auto self = shared_from_this();
+    control_.async_read_some(boost::asio::buffer(&close_byte_, 1), [this, self](boost::system::error_code ec, size_t) {
+        if (is_stopped_)
+        {
+            return;
+        }
+
+        stop(ec ? "the producer closed the stream" : "the producer wrote to the control socket");
+    });
+}
+
+void shm_publisher::drain()
+{
+    network::shm::record_header record;
+    const char *payload = nullptr;
+    size_t handled = 0;
+    while (handled < kMaxRecordsPerWake && ring_.front(record, payload))
+    {
+        try
+        {
+            on_record(record, payload);
+        }
+        catch (const std::exception &ex)
+        {
+            stop(ex.what());
+            return;
+        }
+
+        ring_.pop(record);
+        ++handled;
+    }
+
+    if (ring_.is_corrupt())
+    {
+        stop("the ring is corrupt");
+        return;
+    }
+
+    if (handled == kMaxRecordsPerWake)
+    {
+        boost::asio::post(control_.get_executor(), [this, self = shared_from_this()]() {
+            if (!is_stopped_)
+            {
+                drain();
+            }
+        });
+        return;
+    }
+
+    wait_event();
+}
+
+void shm_publisher::on_record(const network::shm::record_header &record, const char *payload)
+{
+    ++records_;
+    bytes_ += record.size;
+
+    auto type = static_cast<network::shm::Record_Type>(record.type);
+    if (type == network::shm::Record_Type::script)
+    {
+        auto buf = std::make_shared<network::flat_buffer>();
+        buf->write(payload, record.size);
+        AMFDecoder dec(buf, 0);
+        rtmp_media_source::load_metadata(dec, meta_data_);
+        rtmp_source_->init_tracks(&meta_data_);
+        return;
+    }
+
+    if (type != network::shm::Record_Type::audio && type != network::shm::Record_Type::video)
+    {
+        spdlog::debug("{} skips record type {}", id_, record.type);
+        return;
+    }
+
+    // the packet owns the only copy, the ring slot is handed back to the producer right after this
+    auto pkt = rtmp_packet::create();
+    pkt->is_abs_stamp = true;
+    pkt->chunk_stream_id = type == network::shm::Record_Type::video ? CHUNK_VIDEO : CHUNK_AUDIO;
+    pkt->msg_stream_id = 1;
+    pkt->msg_length = record.size;
+    pkt->msg_type_id = record.type;
+    pkt->ts_delta = 0;
+    pkt->time_stamp = record.time_stamp;
+    pkt->set_payload(network::slice::copy_of(payload, record.size));
+    rtmp_source_->process_av_packet(std::move(pkt));
+}
+
+void shm_publisher::stop(const std::string &reason)
+{
+    if (is_stopped_)
+    {
+        return;
+    }
+    is_stopped_ = true;
+
+    spdlog::info("{} stopped, {}, records = {}, bytes = {}", id_, reason, records_, bytes_);
+
+    boost::system::error_code ec;
+    event_.close(ec);
+    control_.close(ec);
+
+    // the source and its viewers go once the last handler holding the publisher has run
+    src_ownership_.reset();
+}
+
+// shm_ingest_listener
+shm_ingest_listener::ptr shm_ingest_listener::create(boost::asio::io_context &io_context, const std::string &path)
+{
+    auto listener = std::shared_ptr<shm_ingest_listener>(new shm_ingest_listener(io_context, path));
+    listener->do_accept();
+    return listener;
+}
+
+shm_ingest_listener::shm_ingest_listener(boost::asio::io_context &io_context, const std::string &path)
+    : io_context_{io_context}
+    , acceptor_{io_context}
+    , path_{path}
+{
+    ::unlink(path_.c_str());
+
+    boost::asio::local::stream_protocol::endpoint endpoint(path_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+
+    spdlog::info("shared memory ingest is waiting on {}", path_);
+}
+
+shm_ingest_listener::~shm_ingest_listener()
+{
+    close();
+}
+
+void shm_ingest_listener::close()
+{
+    if (acceptor_.is_open())
+    {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+    }
+}
+
+void shm_ingest_listener::do_accept()
+{
+    std::weak_ptr<shm_ingest_listener> weak_self = shared_from_this();
+    acceptor_.async_accept(boost::asio::make_strand(io_context_),
+        [this, weak_self](boost::system::error_code ec, boost::asio::local::stream_protocol::socket sock) {
+            auto strong_self = weak_self.lock();
+            if (!strong_self || !acceptor_.is_open())
+            {
+                return;
+            }
+
+            if (ec)
+            {
+                spdlog::error("shared memory ingest received error {}, msg = {}", ec.value(), ec.message());
+            }
+            else
+            {
+                on_hello(std::move(sock));
+            }
+
+            do_accept();
+        });
+}
+
+void shm_ingest_listener::on_hello(boost::asio::local::stream_protocol::socket sock)
+{
+    // the hello is a single message, wait for it without holding the acceptor up
+    auto sock_ptr = std::make_shared<boost::asio::local::stream_protocol::socket>(std::move(sock));
+    sock_ptr->async_wait(boost::asio::socket_base::wait_read, [sock_ptr](boost::system::error_code ec) {
+        if (ec)
+        {
+            return;
+        }
+
+        network::shm::hello msg;
+        iovec iov{&msg, sizeof(msg)};
+        msghdr hdr{};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))]{};
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        auto received = ::recvmsg(sock_ptr->native_handle(), &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+        int fds[2] = {-1, -1};
+        size_t fd_count = 0;
+        for (auto *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                std::memcpy(fds, CMSG_DATA(cmsg), std::min<size_t>(fd_count, 2) * sizeof(int));
+            }
+        }
+
+        try
+        {
+            if (received != static_cast<ssize_t>(sizeof(msg)) || fd_count != 2 || msg.magic != network::shm::kMagic ||
+                msg.version != network::shm::kVersion || !std::memchr(msg.url, '\0', sizeof(msg.url)))
+            {
+                throw std::invalid_argument("invalid shared memory ingest hello");
+            }
+
+            auto ring_fd = fds[0];
+            auto event_fd = fds[1];
+            fds[0] = fds[1] = -1;
+            shm_publisher::create(sock_ptr->get_executor(), ring_fd, event_fd, msg.url)->start(std::move(*sock_ptr));
+        }
+        catch (const std::exception &ex)
+        {
+            spdlog::error("rejected a shared memory publisher, error = {}", ex.what());
+            for (auto fd : fds)
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+
+            network::shm::hello_reply reply;
+            reply.error = EINVAL;
+            ::send(sock_ptr->native_handle(), &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    });
+}
+
+} // namespace rtmp
@@ -0,0 +1,111 @@
+#include "config.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+
+namespace util {
+
+std::string env_or(const char *name, const std::string &default_value)
+{
+    const char *value = std::getenv(name);
+    if (!value || !*value)
+    {
+        return default_value;
+    }
+    return value;
+}
+
+uint64_t env_or(const char *name, uint64_t default_value)
+{
+    const char *value = std::getenv(name);
+    if (!value || !*value)
+    {
+        return default_value;
+    }
+
+    char *end = nullptr;
+    auto parsed = std::strtoull(value, &end, 10);
+    if (end == value || *end != '\0')
+    {
+        spdlog::warn("ignore invalid value {} of {}, use default {}", value, name, default_value);
+        return default_value;
+    }
+    return parsed;
+}
+
+config::config()
+{
+    io_mode_ = env_or(kIoMode, io_mode_);
+    if (io_mode_ != "shared" && io_mode_ != "sharded")
+    {
+        spdlog::warn("unknown {} {}, fall back to shared", kIoMode, io_mode_);
+        io_mode_ = "shared";
+    }
+
+    io_shards_ = static_cast<size_t>(env_or(kIoShards, static_cast<uint64_t>(io_shards_)));
+
+    io_backend_ = env_or(kIoBackend, io_backend_);
+    if (io_backend_ != "asio" && io_backend_ != "uring")
+    {
+        spdlog::warn("unknown {} {}, fall back to asio", kIoBackend, io_backend_);
+        io_backend_ = "asio";
+    }
+
+    timer_tick_ms_ = static_cast<uint32_t>(env_or(kTimerTickMs, static_cast<uint64_t>(timer_tick_ms_)));
+    if (!timer_tick_ms_)
+    {
+        spdlog::warn("{} cannot be 0, fall back to 10", kTimerTickMs);
+        timer_tick_ms_ = 10;
+    }
+
+    handshake_timeout_ms_ = static_cast<uint32_t>(env_or(kHandshakeTimeoutMs, static_cast<uint64_t>(handshake_timeout_ms_)));
+    publish_idle_timeout_ms_ = static_cast<uint32_t>(env_or(kPublishIdleTimeoutMs, static_cast<uint64_t>(publish_idle_timeout_ms_)));
+    play_idle_timeout_ms_ = static_cast<uint32_t>(env_or(kPlayIdleTimeoutMs, static_cast<uint64_t>(play_idle_timeout_ms_)));
+    stats_interval_ms_ = static_cast<uint32_t>(env_or(kStatsIntervalMs, static_cast<uint64_t>(stats_interval_ms_)));
+
+    rtmp_socket_profile_ = env_or(kRtmpSocketProfile, rtmp_socket_profile_);
+    http_socket_profile_ = env_or(kHttpSocketProfile, http_socket_profile_);
+    rtmp_unix_socket_ = env_or(kRtmpUnixSocket, rtmp_unix_socket_);
+    shm_ingest_socket_ = env_or(kShmIngestSocket, shm_ingest_socket_);
+    zerocopy_min_bytes_ = env_or(kZerocopyMinBytes, zerocopy_min_bytes_);
+    pacing_headroom_percent_ = static_cast<uint32_t>(env_or(kPacingHeadroomPercent, static_cast<uint64_t>(pacing_headroom_percent_)));
+
+    egress_max_rate_ = env_or(kEgressMaxRate, egress_max_rate_);
+    egress_vhost_max_rate_ = env_or(kEgressVhostMaxRate, egress_vhost_max_rate_);
+    egress_limits_file_ = env_or(kEgressLimitsFile, egress_limits_file_);
+    egress_shed_percent_ = static_cast<uint32_t>(env_or(kEgressShedPercent, static_cast<uint64_t>(egress_shed_percent_)));
+    egress_viewer_rate_ = env_or(kEgressViewerRate, egress_viewer_rate_);
+
+    tls_cert_file_ = env_or(kTlsCertFile, tls_cert_file_);
+    tls_key_file_ = env_or(kTlsKeyFile, tls_key_file_);
+    rtmps_port_ = static_cast<uint16_t>(env_or(kRtmpsPort, static_cast<uint64_t>(rtmps_port_)));
+    https_port_ = static_cast<uint16_t>(env_or(kHttpsPort, static_cast<uint64_t>(https_port_)));
+
+    upgrade_socket_ = env_or(kUpgradeSocket, upgrade_socket_);
+    upgrade_drain_ms_ = static_cast<uint32_t>(env_or(kUpgradeDrainMs, static_cast<uint64_t>(upgrade_drain_ms_)));
+
+    viewer_max_lag_bytes_ = env_or(kViewerMaxLagBytes, viewer_max_lag_bytes_);
+    viewer_max_lag_ms_ = static_cast<uint32_t>(env_or(kViewerMaxLagMs, static_cast<uint64_t>(viewer_max_lag_ms_)));
+    viewer_overflow_policy_ = env_or(kViewerOverflowPolicy, viewer_overflow_policy_);
+
+    dispatcher_mode_ = env_or(kDispatcherMode, dispatcher_mode_);
+    if (dispatcher_mode_ != "list" && dispatcher_mode_ != "ring" && dispatcher_mode_ != "affinity")
+    {
+        spdlog::warn("unknown {} {}, fall back to list", kDispatcherMode, dispatcher_mode_);
+        dispatcher_mode_ = "list";
+    }
+    else if (dispatcher_mode_ != "list" && !is_sharded())
+    {
+        // with a strand per session, readers would be grouped one per session
+        spdlog::warn("{} {} needs {} sharded, fall back to list", kDispatcherMode, dispatcher_mode_, kIoMode);
+        dispatcher_mode_ = "list";
+    }
+
+    gop_cache_gops_ = static_cast<size_t>(env_or(kGopCacheGops, static_cast<uint64_t>(gop_cache_gops_)));
+    gop_cache_max_bytes_ = env_or(kGopCacheMaxBytes, gop_cache_max_bytes_);
+    gop_cache_max_ms_ = static_cast<uint32_t>(env_or(kGopCacheMaxMs, static_cast<uint64_t>(gop_cache_max_ms_)));
+    gop_cache_total_bytes_ = env_or(kGopCacheTotalBytes, gop_cache_total_bytes_);
+}
+
+} // namespace util
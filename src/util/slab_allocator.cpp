@@ -0,0 +1,282 @@
+#include "slab_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace util {
+
+namespace {
+
+struct class_counters
+{
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> cached{0};
+    std::atomic<uint64_t> returned{0};
+};
+
+// the last entry counts the sizes above kMaxClassSize
+std::array<class_counters, slab_allocator::kClassCount + 1> counters_;
+
+size_t class_size(size_t index)
+{
+    return slab_allocator::kMinClassSize << index;
+}
+
+size_t max_cached_blocks(size_t index)
+{
+    return std::max<size_t>(2, slab_allocator::kMaxCachedBytes / class_size(index));
+}
+
+// written into a returned block itself, every class is large enough to hold it
+struct remote_node
+{
+    remote_node *next;
+    size_t index;
+};
+
+static_assert(sizeof(remote_node) <= slab_allocator::kMinClassSize);
+
+/**
+Blocks freed by other threads for the cache of one thread, pushed by any thread and taken over as a whole by the owner only,
+so a node is never popped while someone pushes on it. Once the owner has exited the list is closed and pushes fail.
+*/
+class remote_list
+{
+public:
+    /// false once the list is closed, the block is left to the caller
+    bool push(char *ptr, size_t index)
+    {
+        auto *node = new (ptr) remote_node{nullptr, index};
+        auto *head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            if (head == closed())
+            {
+                return false;
+            }
+            node->next = head;
+        } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return true;
+    }
+
+    remote_node *take()
+    {
+        return head_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    /// the blocks still in the list, nothing can be pushed afterwards
+    remote_node *close()
+    {
+        return head_.exchange(closed(), std::memory_order_acquire);
+    }
+
+private:
+    static remote_node *closed()
+    {
+        return reinterpret_cast<remote_node *>(uintptr_t{1});
+    }
+
+private:
+    std::atomic<remote_node *> head_{nullptr};
+};
+
+struct thread_cache
+{
+    std::array<std::vector<char *>, slab_allocator::kClassCount> free_blocks;
+    // held by the deleters of the blocks this thread handed out by make_block(), it outlives the thread if they do
+    std::shared_ptr<remote_list> remote{std::make_shared<remote_list>()};
+
+    thread_cache();
+    ~thread_cache();
+
+    /// move the blocks returned by other threads into free_blocks, up to the limit of each class
+    void take_returned();
+};
+
+enum class Cache_State : uint8_t
+{
+    unborn = 0,
+    alive = 1,
+    dead = 2,
+};
+
+// trivially destructible, still readable while the cache of an exiting thread is torn down
+thread_local Cache_State cache_state_{Cache_State::unborn};
+
+thread_cache::thread_cache()
+{
+    cache_state_ = Cache_State::alive;
+}
+
+thread_cache::~thread_cache()
+{
+    cache_state_ = Cache_State::dead;
+    for (size_t i = 0; i < free_blocks.size(); ++i)
+    {
+        counters_[i].cached.fetch_sub(free_blocks[i].size(), std::memory_order_relaxed);
+        for (auto *ptr : free_blocks[i])
+        {
+            delete[] ptr;
+        }
+    }
+
+    for (auto *node = remote->close(); node;)
+    {
+        auto *next = node->next;
+        counters_[node->index].cached.fetch_sub(1, std::memory_order_relaxed);
+        delete[] reinterpret_cast<char *>(node);
+        node = next;
+    }
+}
+
+void thread_cache::take_returned()
+{
+    for (auto *node = remote->take(); node;)
+    {
+        auto *next = node->next;
+        auto index = node->index;
+        auto *ptr = reinterpret_cast<char *>(node);
+        if (free_blocks[index].size() < max_cached_blocks(index))
+        {
+            free_blocks[index].push_back(ptr);
+        }
+        else
+        {
+            counters_[index].cached.fetch_sub(1, std::memory_order_relaxed);
+            delete[] ptr;
+        }
+        node = next;
+    }
+}
+
+/// nullptr once the thread is exiting, blocks released by late destructors go straight to the heap
+thread_cache *local_cache()
+{
+    if (cache_state_ == Cache_State::dead)
+    {
+        return nullptr;
+    }
+
+    static thread_local thread_cache cache;
+    return &cache;
+}
+
+/// the deleter of make_block(), the block goes back to the thread that allocated it
+void release_block(char *ptr, size_t size, const std::shared_ptr<remote_list> &owner)
+{
+    auto *cache = local_cache();
+    if (cache && cache->remote == owner)
+    {
+        slab_allocator::deallocate(ptr, size);
+        return;
+    }
+
+    auto index = slab_allocator::class_of(size);
+    if (!owner->push(ptr, index))
+    {
+        delete[] ptr;
+        return;
+    }
+
+    counters_[index].cached.fetch_add(1, std::memory_order_relaxed);
+    counters_[index].returned.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+size_t slab_allocator::class_of(size_t size)
+{
+    size_t index = 0;
+    while (index < kClassCount && class_size(index) < size)
+    {
+        ++index;
+    }
+    return index;
+}
+
+char *slab_allocator::allocate(size_t &size)
+{
+    auto index = class_of(size);
+    if (index == kClassCount)
+    {
+        counters_[index].misses.fetch_add(1, std::memory_order_relaxed);
+        return new char[size ? size : 1];
+    }
+
+    size = class_size(index);
+    auto *cache = local_cache();
+    if (cache && cache->free_blocks[index].empty())
+    {
+        cache->take_returned();
+    }
+
+    if (cache && !cache->free_blocks[index].empty())
+    {
+        auto *ptr = cache->free_blocks[index].back();
+        cache->free_blocks[index].pop_back();
+        counters_[index].hits.fetch_add(1, std::memory_order_relaxed);
+        counters_[index].cached.fetch_sub(1, std::memory_order_relaxed);
+        return ptr;
+    }
+
+    counters_[index].misses.fetch_add(1, std::memory_order_relaxed);
+    return new char[size];
+}
+
+void slab_allocator::deallocate(char *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    auto index = class_of(size);
+    auto *cache = index < kClassCount ? local_cache() : nullptr;
+    if (!cache)
+    {
+        delete[] ptr;
+        return;
+    }
+
+    auto &free_blocks = cache->free_blocks[index];
+    if (free_blocks.size() >= max_cached_blocks(index))
+    {
+        delete[] ptr;
+        return;
+    }
+
+    free_blocks.push_back(ptr);
+    counters_[index].cached.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<char[]> slab_allocator::make_block(size_t size)
+{
+    auto *ptr = allocate(size);
+    auto *cache = class_of(size) < kClassCount ? local_cache() : nullptr;
+    if (!cache)
+    {
+        return std::shared_ptr<char[]>(ptr, [size](char *p) { deallocate(p, size); });
+    }
+
+    return std::shared_ptr<char[]>(ptr, [size, owner = cache->remote](char *p) { release_block(p, size, owner); });
+}
+
+std::vector<slab_allocator::class_stats> slab_allocator::get_stats()
+{
+    std::vector<class_stats> stats(kClassCount + 1);
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        stats[i].size = i < kClassCount ? class_size(i) : 0;
+        stats[i].hits = counters_[i].hits.load(std::memory_order_relaxed);
+        stats[i].misses = counters_[i].misses.load(std::memory_order_relaxed);
+        stats[i].cached = counters_[i].cached.load(std::memory_order_relaxed);
+        stats[i].returned = counters_[i].returned.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+} // namespace util
@@ -0,0 +1,268 @@
+#include "timer_wheel.h"
+
+#include <spdlog/spdlog.h>
+
+namespace util {
+
+timer_wheel::ptr timer_wheel::create(boost::asio::io_context &io_context, uint32_t tick_ms)
+{
+    auto wheel = std::shared_ptr<timer_wheel>(new timer_wheel(io_context, tick_ms));
+    wheel->wait_tick();
+    return wheel;
+}
+
+timer_wheel::timer_wheel(boost::asio::io_context &io_context, uint32_t tick_ms)
+    : timer_{io_context}
+    , tick_ms_{tick_ms ? tick_ms : kDefaultTickMs}
+    , start_{std::chrono::steady_clock::now()}
+{
+    slots_.fill(kNil);
+}
+
+timer_wheel::timer_id timer_wheel::schedule(uint64_t delay_ms, callback cb)
+{
+    return add(delay_ms, 0, std::move(cb));
+}
+
+timer_wheel::timer_id timer_wheel::schedule_every(uint64_t interval_ms, callback cb)
+{
+    return add(interval_ms, interval_ms ? interval_ms : tick_ms_, std::move(cb));
+}
+
+bool timer_wheel::cancel(timer_id id)
+{
+    auto index = static_cast<uint32_t>(id & UINT32_MAX);
+    auto generation = static_cast<uint32_t>(id >> 32);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (index >= nodes_.size() || nodes_[index].generation != generation || !nodes_[index].cb)
+    {
+        return false;
+    }
+
+    if (nodes_[index].slot != kNil)
+    {
+        unlink(index);
+    }
+    release(index);
+    return true;
+}
+
+size_t timer_wheel::size() const
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return pending_;
+}
+
+void timer_wheel::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        is_stopped_ = true;
+    }
+    timer_.cancel();
+}
+
+timer_wheel::timer_id timer_wheel::add(uint64_t delay_ms, uint64_t interval_ms, callback cb)
+{
+    if (!cb)
+    {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+
+    uint32_t index = free_head_;
+    if (index == kNil)
+    {
+        index = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    else
+    {
+        free_head_ = nodes_[index].next;
+    }
+
+    auto &n = nodes_[index];
+    n.expire = current_tick_ + to_ticks(delay_ms);
+    n.interval = interval_ms ? to_ticks(interval_ms) : 0;
+    n.cb = std::move(cb);
+    link(index);
+    ++pending_;
+
+    return make_id(index, n.generation);
+}
+
+uint64_t timer_wheel::to_ticks(uint64_t ms) const
+{
+    auto ticks = (ms + tick_ms_ - 1) / tick_ms_;
+    return ticks ? ticks : 1;
+}
+
+void timer_wheel::link(uint32_t index, bool is_cascade)
+{
+    static constexpr uint64_t kMaxTicks = (1ULL << (kSlotBits * kLevels)) - 1;
+
+    auto &n = nodes_[index];
+    auto min_tick = is_cascade ? current_tick_ : current_tick_ + 1;
+    if (n.expire < min_tick)
+    {
+        n.expire = min_tick;
+    }
+    if (n.expire - current_tick_ > kMaxTicks)
+    {
+        n.expire = current_tick_ + kMaxTicks;
+    }
+
+    uint64_t delta = n.expire - current_tick_;
+    uint32_t level = 0;
+    while (level + 1 < kLevels && delta >= (1ULL << (kSlotBits * (level + 1))))
+    {
+        ++level;
+    }
+
+    auto slot = level * kSlots + static_cast<uint32_t>((n.expire >> (kSlotBits * level)) & (kSlots - 1));
+    n.slot = slot;
+    n.prev = kNil;
+    n.next = slots_[slot];
+    if (n.next != kNil)
+    {
+        nodes_[n.next].prev = index;
+    }
+    slots_[slot] = index;
+}
+
+void timer_wheel::unlink(uint32_t index)
+{
+    auto &n = nodes_[index];
+    if (n.prev != kNil)
+    {
+        nodes_[n.prev].next = n.next;
+    }
+    else
+    {
+        slots_[n.slot] = n.next;
+    }
+
+    if (n.next != kNil)
+    {
+        nodes_[n.next].prev = n.prev;
+    }
+
+    n.prev = n.next = n.slot = kNil;
+}
+
+void timer_wheel::release(uint32_t index)
+{
+    auto &n = nodes_[index];
+    n.cb = nullptr;
+    n.slot = kNil;
+    n.prev = kNil;
+    // a stale id can never cancel the next timer stored in this node
+    ++n.generation;
+    n.next = free_head_;
+    free_head_ = index;
+    --pending_;
+}
+
+void timer_wheel::cascade(uint32_t level)
+{
+    auto slot = level * kSlots + static_cast<uint32_t>((current_tick_ >> (kSlotBits * level)) & (kSlots - 1));
+    auto index = slots_[slot];
+    slots_[slot] = kNil;
+
+    while (index != kNil)
+    {
+        auto next = nodes_[index].next;
+        link(index, true);
+        index = next;
+    }
+}
+
+void timer_wheel::advance(uint64_t target_tick, std::vector<std::pair<timer_id, callback>> &expired)
+{
+    while (current_tick_ < target_tick)
+    {
+        ++current_tick_;
+
+        // a wrapped level pulls the current slot of the level above down
+        for (uint32_t level = 1; level < kLevels; ++level)
+        {
+            if (current_tick_ & ((1ULL << (kSlotBits * level)) - 1))
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        auto slot = static_cast<uint32_t>(current_tick_ & (kSlots - 1));
+        auto index = slots_[slot];
+        slots_[slot] = kNil;
+
+        while (index != kNil)
+        {
+            auto &n = nodes_[index];
+            auto next = n.next;
+            n.prev = n.next = n.slot = kNil;
+
+            if (n.interval)
+            {
+                expired.emplace_back(make_id(index, n.generation), n.cb);
+                n.expire = current_tick_ + n.interval;
+                link(index);
+            }
+            else
+            {
+                expired.emplace_back(make_id(index, n.generation), std::move(n.cb));
+                release(index);
+            }
+
+            index = next;
+        }
+    }
+
+    now_ms_ = current_tick_ * tick_ms_;
+}
+
+void timer_wheel::wait_tick()
+{
+    timer_.expires_at(start_ + std::chrono::milliseconds((current_tick_ + 1) * tick_ms_));
+
+    std::weak_ptr<timer_wheel> weak_self = shared_from_this();
+    timer_.async_wait([weak_self](boost::system::error_code ec) {
+        auto strong_self = weak_self.lock();
+        if (!strong_self || ec)
+        {
+            return;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - strong_self->start_);
+        auto target_tick = static_cast<uint64_t>(elapsed.count()) / strong_self->tick_ms_;
+
+        std::vector<std::pair<timer_id, callback>> expired;
+        {
+            std::lock_guard<std::mutex> lock(strong_self->mtx_);
+            if (strong_self->is_stopped_)
+            {
+                return;
+            }
+            strong_self->advance(target_tick, expired);
+        }
+
+        strong_self->wait_tick();
+
+        for (auto &[id, cb] : expired)
+        {
+            try
+            {
+                cb();
+            }
+            catch (const std::exception &ex)
+            {
+                spdlog::error("timer {} received exception, error = {}", id, ex.what());
+            }
+        }
+    });
+}
+
+} // namespace util
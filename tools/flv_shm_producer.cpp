@@ -0,0 +1,299 @@
+/**
+Reference producer of the shared memory ingest.
+
+Replays an FLV file into the server through a shared memory ring, paced by the tag timestamps. It creates the ring in a
+memfd, hands it and an eventfd to the server on its control socket (STREAMING_SHM_INGEST_SOCKET), then pushes one record
+per FLV tag and signals the eventfd after each one. Closing the control socket ends the stream.
+
+usage: flv_shm_producer [-s socket] [-u app/stream?vhost=...] [-c ring_bytes] [-l loops] [-f] file.flv
+    -f: push as fast as the ring takes it instead of in real time, for benchmarks
+*/
+
+#include "network/shm_ring.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct options
+{
+    std::string socket_path{"/tmp/streaming_shm.sock"};
+    std::string url{"live/shm?vhost=test.com&token=shm"};
+    size_t capacity{8 * 1024 * 1024};
+    uint32_t loops{1};
+    bool is_realtime{true};
+    std::string file{};
+};
+
+using clock_type = std::chrono::steady_clock;
+
+options parse_options(int argc, char *argv[])
+{
+    options opts;
+    int opt = 0;
+    while ((opt = ::getopt(argc, argv, "s:u:c:l:f")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            opts.socket_path = optarg;
+            break;
+        case 'u':
+            opts.url = optarg;
+            break;
+        case 'c':
+            opts.capacity = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'l':
+            opts.loops = static_cast<uint32_t>(std::atoi(optarg));
+            break;
+        case 'f':
+            opts.is_realtime = false;
+            break;
+        default:
+            std::fprintf(stderr, "usage: %s [-s socket] [-u app/stream?vhost=...] [-c ring_bytes] [-l loops] [-f] file.flv\n", argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        std::fprintf(stderr, "%s: no flv file given\n", argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+    opts.file = argv[optind];
+    return opts;
+}
+
+uint32_t load_be(const unsigned char *data, size_t bytes)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+struct flv_tag
+{
+    uint8_t type{0};
+    uint32_t time_stamp{0};
+    std::vector<char> body{};
+};
+
+std::vector<flv_tag> read_flv(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("cannot open " + path);
+    }
+
+    // header and the first previous tag size
+    unsigned char header[13];
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || std::memcmp(header, "FLV", 3) != 0)
+    {
+        throw std::runtime_error(path + " is not an flv file");
+    }
+    file.seekg(load_be(header + 5, 4) + 4);
+
+    std::vector<flv_tag> tags;
+    unsigned char tag_header[11];
+    while (file.read(reinterpret_cast<char *>(tag_header), sizeof(tag_header)))
+    {
+        flv_tag tag;
+        tag.type = tag_header[0] & 0x1f;
+        tag.time_stamp = load_be(tag_header + 4, 3) | (static_cast<uint32_t>(tag_header[7]) << 24);
+        tag.body.resize(load_be(tag_header + 1, 3));
+        if (!file.read(tag.body.data(), static_cast<std::streamsize>(tag.body.size())))
+        {
+            break;
+        }
+        file.seekg(4, std::ios::cur);
+        tags.emplace_back(std::move(tag));
+    }
+    return tags;
+}
+
+int connect_control(const options &opts, int ring_fd, int event_fd)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (opts.socket_path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("socket path is too long");
+    }
+    std::memcpy(addr.sun_path, opts.socket_path.c_str(), opts.socket_path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        throw std::runtime_error("cannot connect to " + opts.socket_path + ": " + std::strerror(errno));
+    }
+
+    network::shm::hello msg;
+    if (opts.url.size() >= sizeof(msg.url))
+    {
+        throw std::runtime_error("url is too long");
+    }
+    std::memcpy(msg.url, opts.url.c_str(), opts.url.size());
+
+    iovec iov{&msg, sizeof(msg)};
+    msghdr hdr{};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    int fds[2] = {ring_fd, event_fd};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))]{};
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    auto *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (::sendmsg(fd, &hdr, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(msg)))
+    {
+        throw std::runtime_error(std::string("cannot send the hello: ") + std::strerror(errno));
+    }
+
+    network::shm::hello_reply reply;
+    if (::recv(fd, &reply, sizeof(reply), MSG_WAITALL) != static_cast<ssize_t>(sizeof(reply)) || reply.error)
+    {
+        throw std::runtime_error("the server rejected the stream " + opts.url);
+    }
+    return fd;
+}
+
+// the server closes the control socket when it stops reading the ring
+bool is_server_gone(int control_fd)
+{
+    char byte = 0;
+    auto received = ::recv(control_fd, &byte, sizeof(byte), MSG_DONTWAIT | MSG_PEEK);
+    return received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto opts = parse_options(argc, argv);
+
+    try
+    {
+        auto tags = read_flv(opts.file);
+        if (tags.empty())
+        {
+            throw std::runtime_error(opts.file + " has no tags");
+        }
+
+        // sealed at its size, the server does not map a ring that could shrink
+        int ring_fd = ::memfd_create("streaming_shm_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        auto mapped_size = network::shm::mapped_size(opts.capacity);
+        if (ring_fd < 0 || ::ftruncate(ring_fd, static_cast<off_t>(mapped_size)) < 0 ||
+            ::fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        {
+            throw std::runtime_error(std::string("cannot create the ring: ") + std::strerror(errno));
+        }
+
+        auto *mapped = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+        network::shm::spsc_ring ring;
+        if (mapped == MAP_FAILED || !network::shm::spsc_ring::init(mapped, opts.capacity) || !ring.attach(mapped, mapped_size))
+        {
+            throw std::runtime_error("cannot lay the ring out, the capacity must be a power of two");
+        }
+
+        int event_fd = ::eventfd(0, EFD_CLOEXEC);
+        int control_fd = connect_control(opts, ring_fd, event_fd);
+
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t full_waits = 0;
+        uint32_t loop_offset = 0;
+        auto begin = clock_type::now();
+        for (uint32_t loop = 0; loop < opts.loops; ++loop)
+        {
+            for (auto &tag : tags)
+            {
+                // the metadata and the sequence headers are only sent once, the server keeps them
+                if (loop && (tag.type == 18 || (tag.body.size() > 1 && tag.body[1] == 0)))
+                {
+                    continue;
+                }
+
+                auto time_stamp = loop_offset + tag.time_stamp;
+                if (opts.is_realtime)
+                {
+                    std::this_thread::sleep_until(begin + std::chrono::milliseconds(time_stamp));
+                }
+
+                while (!ring.push(static_cast<network::shm::Record_Type>(tag.type), time_stamp, tag.body.data(), tag.body.size()))
+                {
+                    if (tag.body.size() > ring.max_payload())
+                    {
+                        throw std::runtime_error("a tag is larger than the ring can carry, use a larger -c");
+                    }
+
+                    if (is_server_gone(control_fd))
+                    {
+                        throw std::runtime_error("the server stopped reading the ring");
+                    }
+
+                    ++full_waits;
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+
+                uint64_t one = 1;
+                if (::write(event_fd, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)))
+                {
+                    throw std::runtime_error("cannot signal the eventfd");
+                }
+
+                ++records;
+                bytes += tag.body.size();
+            }
+            loop_offset += tags.back().time_stamp + 40;
+        }
+
+        auto elapsed = std::chrono::duration<double>(clock_type::now() - begin).count();
+        std::printf("pushed %llu records, %llu bytes in %.2f s, %.1f MB/s, waited for ring space %llu times\n",
+            static_cast<unsigned long long>(records), static_cast<unsigned long long>(bytes), elapsed, static_cast<double>(bytes) / elapsed / 1e6,
+            static_cast<unsigned long long>(full_waits));
+
+        // let the server drain the ring before the stream is closed, for at most a second
+        for (int i = 0; i < 1000 && !ring.is_empty(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ::close(control_fd);
+        ::close(event_fd);
+        ::munmap(mapped, mapped_size);
+        ::close(ring_fd);
+    }
+    catch (const std::exception &ex)
+    {
+        std::fprintf(stderr, "flv_shm_producer failed: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}